@@ -0,0 +1,632 @@
+/***** diskbench.c *************************************************************
+ * University of Victoria
+ * CSC 360 Fall 2018
+ * Italo Borrelli
+ * V00884840
+ *******************************************************************************
+ * diskbench.c is a source file that times the disk tools over images made by
+ * diskgen.
+ *
+ * Each configuration is a set of diskgen options. An image is generated for
+ * it and then diskinfo, disklist, diskget of single files to stdout, diskget
+ * -r of the whole image and diskput of a batch of files to a fresh copy of the
+ * image are each run a number of times. Every tool is run as its own process,
+ * the way it is used, and timed from fork to exit.
+ *
+ * The results are printed as one JSON object per line for each tool and
+ * configuration, with latency percentiles and throughput, so they can be fed
+ * straight into other programs or compared between builds.
+ ******************************************************************************/
+
+#define _XOPEN_SOURCE 700
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <string.h>
+#include <stdarg.h>
+#include <limits.h>
+#include <time.h>
+#include <ftw.h>
+
+#include "diskhelpers.h"
+
+#define BENCH_MAX_ARGS 64	//most arguments of a command run
+#define BENCH_COPY_BUFFER 1048576	//bytes copied at a time
+#define BENCH_PUT_FILES 8	//files put by each run of diskput
+#define BENCH_PUT_SIZE 16384	//bytes in each file put
+
+
+/*******************************************************************************
+ * DEFAULT SUITE
+ *******************************************************************************
+ * The configurations timed when none are given, sized for the FAT width the
+ * tools are built for: a contiguous and a fragmented image of the same files,
+ * then a deep tree of many small files.
+ ******************************************************************************/
+
+#if FAT_BITS == 12
+static char *default_suite[] = {
+	"-s 1440K -n 100 -d 10 -D 3 -f 0",
+	"-s 1440K -n 100 -d 10 -D 3 -f 50",
+	"-s 1440K -n 400 -d 40 -D 6 -z lognormal:1K:1 -f 10"
+};
+#elif FAT_BITS == 16
+static char *default_suite[] = {
+	"-s 32M -n 1000 -d 50 -D 4 -f 0",
+	"-s 32M -n 1000 -d 50 -D 4 -f 50",
+	"-s 64M -n 4000 -d 200 -D 8 -z lognormal:2K:1.5 -f 10"
+};
+#else
+static char *default_suite[] = {
+	"-s 64M -n 2000 -d 100 -D 4 -f 0",
+	"-s 64M -n 2000 -d 100 -D 4 -f 50",
+	"-s 256M -n 10000 -d 500 -D 8 -z lognormal:4K:1.5 -f 10"
+};
+#endif
+
+
+/*******************************************************************************
+ * BENCH IMAGE
+ *******************************************************************************
+ * A generated image and the files diskgen listed in its manifest.
+ ******************************************************************************/
+
+typedef struct bench_image {
+	char *config;			//diskgen options it was made with
+	char path[PATH_MAX];		//absolute path of the image
+	int64_t image_bytes;		//size of the image
+
+	char **files;			//path of every file on the image
+	int64_t *sizes;			//size of every file
+	int count;			//number of files
+	int64_t data_bytes;		//size of all files together
+} bench_image;
+
+
+/*******************************************************************************
+ * BENCH SETTINGS
+ *******************************************************************************
+ * Where the tools and scratch files are and how often each tool is run.
+ ******************************************************************************/
+
+typedef struct bench_settings {
+	char bin[PATH_MAX];		//directory with the tools
+	char work[PATH_MAX];		//directory for images and scratch files
+	int runs;			//timed runs of each tool
+	int warmups;			//untimed runs before them
+	FILE *out;			//stream the results are printed to
+} bench_settings;
+
+
+
+/*******************************************************************************
+ * function: makePath
+ *******************************************************************************
+ * Formats a path into a buffer, failing if it doesn't fit rather than running
+ * a tool on a cut off path.
+ *
+ * @param	char *path	buffer the path is written to
+ * @param	size_t size	number of bytes in the buffer
+ * @param	char *format	printf format of the path
+ *
+ * @return	void		no return value
+ ******************************************************************************/
+
+static void makePath(char *path, size_t size, char *format, ...) {
+	va_list args;
+	va_start(args, format);
+	int length = vsnprintf(path, size, format, args);
+	va_end(args);
+
+	if(length < 0 || (size_t)length >= size) {
+		printf("ERROR: Path too long\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
+
+/*******************************************************************************
+ * function: now
+ *******************************************************************************
+ * Reads the monotonic clock.
+ *
+ * @return	double		milliseconds since an arbitrary point
+ ******************************************************************************/
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+
+/*******************************************************************************
+ * function: runTool
+ *******************************************************************************
+ * Runs a command in a directory with its output thrown away and times it.
+ *
+ * @param	char *dir	directory to run it in
+ * @param	char **args	path of the program and its arguments, NULL
+ * 				terminated
+ * @param	double *ms	set to the milliseconds it ran for
+ *
+ * @return	bool		true if it exited successfully
+ ******************************************************************************/
+
+static bool runTool(char *dir, char **args, double *ms) {
+	double start = now();
+
+	pid_t pid = fork();
+	if(pid < 0) {
+		printf("ERROR: Failed to start %s\n", args[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	if(pid == 0) {
+		int null = open("/dev/null", O_WRONLY);
+		if(null < 0 || dup2(null, STDOUT_FILENO) < 0 || chdir(dir) != 0) _exit(127);
+		execv(args[0], args);
+		_exit(127);
+	}
+
+	int status;
+	waitpid(pid, &status, 0);
+	*ms = now() - start;
+
+	return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+
+/*******************************************************************************
+ * function: splitArgs
+ *******************************************************************************
+ * Splits a string of options on spaces into arguments.
+ *
+ * @param	char *options	options to split, changed in place
+ * @param	char **args	set to the arguments
+ * @param	int max		most arguments to set
+ *
+ * @return	int		number of arguments set
+ ******************************************************************************/
+
+static int splitArgs(char *options, char **args, int max) {
+	int count = 0;
+	char *arg = strtok(options, " \t");
+
+	while(arg != NULL && count < max) {
+		args[count++] = arg;
+		arg = strtok(NULL, " \t");
+	}
+
+	return count;
+}
+
+
+/*******************************************************************************
+ * function: copyFile
+ *******************************************************************************
+ * Copies a file, replacing the destination.
+ *
+ * @param	char *from	file to copy
+ * @param	char *to	file to copy it to
+ *
+ * @return	void		no return value
+ ******************************************************************************/
+
+static void copyFile(char *from, char *to) {
+	static char buf[BENCH_COPY_BUFFER];
+
+	int in = open(from, O_RDONLY);
+	int out = open(to, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+	if(in < 0 || out < 0) {
+		printf("ERROR: Copying %s failed\n", from);
+		exit(EXIT_FAILURE);
+	}
+
+	ssize_t length;
+	while((length = read(in, buf, sizeof(buf))) > 0) {
+		if(write(out, buf, length) != length) {
+			printf("ERROR: Copying %s failed\n", from);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	close(in);
+	close(out);
+}
+
+
+/*******************************************************************************
+ * function: removeEntry
+ *******************************************************************************
+ * Removes one file or empty directory for nftw.
+ ******************************************************************************/
+
+static int removeEntry(const char *path, const struct stat *sb, int flag, struct FTW *ftw) {
+	(void)sb; (void)flag; (void)ftw;
+	return remove(path);
+}
+
+
+/*******************************************************************************
+ * function: emptyDirectory
+ *******************************************************************************
+ * Removes a directory and everything in it, then makes it again empty.
+ *
+ * @param	char *dir	directory to empty
+ *
+ * @return	void		no return value
+ ******************************************************************************/
+
+static void emptyDirectory(char *dir) {
+	nftw(dir, removeEntry, 16, FTW_DEPTH|FTW_PHYS);
+	if(mkdir(dir, 0755) != 0) {
+		printf("ERROR: Making %s failed\n", dir);
+		exit(EXIT_FAILURE);
+	}
+}
+
+
+/*******************************************************************************
+ * function: makeImage
+ *******************************************************************************
+ * Generates the image of a configuration and reads its manifest.
+ *
+ * @param	bench_settings *settings
+ * 				benchmark settings
+ * @param	char *config	diskgen options of the image
+ * @param	int number	number of the configuration, used in the names
+ * @param	bench_image *image
+ * 				set to the image
+ *
+ * @return	void		no return value
+ ******************************************************************************/
+
+static void makeImage(bench_settings *settings, char *config, int number, bench_image *image) {
+	char program[PATH_MAX + 16], manifest[PATH_MAX + 16];
+	makePath(program, sizeof(program), "%s/diskgen", settings->bin);
+	makePath(image->path, sizeof(image->path), "%s/bench%d.IMA", settings->work, number);
+	makePath(manifest, sizeof(manifest), "%s/bench%d.txt", settings->work, number);
+
+	char *options = strdup(config);
+	char *args[BENCH_MAX_ARGS];
+	int count = 0;
+
+	args[count++] = program;
+	count += splitArgs(options, args + count, BENCH_MAX_ARGS - 5);
+	args[count++] = "-m";
+	args[count++] = manifest;
+	args[count++] = image->path;
+	args[count] = NULL;
+
+	double ms;
+	if(!runTool(settings->work, args, &ms)) {
+		printf("ERROR: diskgen %s failed\n", config);
+		exit(EXIT_FAILURE);
+	}
+	free(options);
+
+	struct stat buff;
+	stat(image->path, &buff);
+	image->config = config;
+	image->image_bytes = buff.st_size;
+
+	FILE *fp = fopen(manifest, "r");
+	if(fp == NULL) {
+		printf("ERROR: Opening manifest failed\n");
+		exit(EXIT_FAILURE);
+	}
+
+	int capacity = 64;
+	image->files = (char **)malloc(capacity * sizeof(char *));
+	image->sizes = (int64_t *)malloc(capacity * sizeof(int64_t));
+	image->count = 0;
+	image->data_bytes = 0;
+
+	char path[PATH_MAX];
+	long long size;
+	while(image->files != NULL && image->sizes != NULL && fscanf(fp, "%4095s %lld", path, &size) == 2) {
+		if(image->count == capacity) {
+			capacity *= 2;
+			image->files = (char **)realloc(image->files, capacity * sizeof(char *));
+			image->sizes = (int64_t *)realloc(image->sizes, capacity * sizeof(int64_t));
+			if(image->files == NULL || image->sizes == NULL) break;
+		}
+
+		image->files[image->count] = strdup(path);
+		image->sizes[image->count] = size;
+		image->data_bytes += size;
+		image->count++;
+	}
+
+	if(image->files == NULL || image->sizes == NULL) {
+		printf("ERROR: Failed to allocate manifest\n");
+		exit(EXIT_FAILURE);
+	}
+
+	fclose(fp);
+}
+
+
+/*******************************************************************************
+ * function: compareTimes
+ *******************************************************************************
+ * Orders two run times for qsort.
+ ******************************************************************************/
+
+static int compareTimes(const void *a, const void *b) {
+	double x = *(const double *)a, y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+
+/*******************************************************************************
+ * function: percentile
+ *******************************************************************************
+ * Finds a percentile of sorted run times by the nearest rank.
+ *
+ * @param	double *times	sorted run times
+ * @param	int count	number of run times
+ * @param	double p	percentile to find, 0 to 100
+ *
+ * @return	double		the run time at that percentile
+ ******************************************************************************/
+
+static double percentile(double *times, int count, double p) {
+	int rank = (int)(p / 100 * count + 0.999999);
+	if(rank < 1) rank = 1;
+	if(rank > count) rank = count;
+	return times[rank - 1];
+}
+
+
+/*******************************************************************************
+ * function: printResult
+ *******************************************************************************
+ * Prints the results of one tool on one image as a JSON object on one line.
+ *
+ * @param	bench_settings *settings
+ * 				benchmark settings
+ * @param	bench_image *image
+ * 				image the tool was run on
+ * @param	char *tool	name of the tool and mode
+ * @param	double *times	milliseconds of each run, sorted here
+ * @param	int64_t bytes	bytes handled over all the runs
+ * @param	int64_t files	files handled over all the runs
+ * @param	int failures	number of runs that failed
+ *
+ * @return	void		no return value
+ ******************************************************************************/
+
+static void printResult(bench_settings *settings, bench_image *image, char *tool, double *times, int64_t bytes, int64_t files, int failures) {
+	int runs = settings->runs, i;
+	double total = 0;
+
+	for(i = 0; i < runs; i++) total += times[i];
+	qsort(times, runs, sizeof(double), compareTimes);
+
+	double seconds = total / 1000;
+	FILE *out = settings->out;
+
+	fprintf(out, "{\"config\":\"");
+	for(i = 0; image->config[i] != '\0'; i++) {
+		if(image->config[i] == '"' || image->config[i] == '\\') fputc('\\', out);
+		fputc(image->config[i], out);
+	}
+	fprintf(out, "\",\"fat_bits\":%d,\"image_bytes\":%lld,\"files\":%d,\"data_bytes\":%lld",
+		FAT_BITS, (long long)image->image_bytes, image->count, (long long)image->data_bytes);
+	fprintf(out, ",\"tool\":\"%s\",\"runs\":%d,\"failures\":%d", tool, runs, failures);
+	fprintf(out, ",\"mean_ms\":%.3f,\"min_ms\":%.3f,\"p50_ms\":%.3f,\"p90_ms\":%.3f,\"p99_ms\":%.3f,\"max_ms\":%.3f",
+		total / runs, times[0], percentile(times, runs, 50), percentile(times, runs, 90),
+		percentile(times, runs, 99), times[runs - 1]);
+	fprintf(out, ",\"mb_per_s\":%.3f,\"files_per_s\":%.1f}\n",
+		seconds > 0 ? bytes / seconds / 1048576 : 0,
+		seconds > 0 ? files / seconds : 0);
+	fflush(out);
+}
+
+
+/*******************************************************************************
+ * function: benchImage
+ *******************************************************************************
+ * Times every tool on an image.
+ *
+ * diskinfo and disklist read the whole image each run. diskget of a single
+ * file takes the files of the manifest in turn so the runs spread over the
+ * whole image. diskget -r extracts into an empty directory and diskput puts
+ * its batch into a fresh copy of the image, both made before the timed run.
+ *
+ * @param	bench_settings *settings
+ * 				benchmark settings
+ * @param	bench_image *image
+ * 				image to time the tools on
+ *
+ * @return	void		no return value
+ ******************************************************************************/
+
+static void benchImage(bench_settings *settings, bench_image *image) {
+	char info[PATH_MAX + 16], list[PATH_MAX + 16], get[PATH_MAX + 16], put[PATH_MAX + 16];
+	char scratch[PATH_MAX + 16], put_dir[PATH_MAX + 16], put_image[PATH_MAX + 32];
+	makePath(info, sizeof(info), "%s/diskinfo", settings->bin);
+	makePath(list, sizeof(list), "%s/disklist", settings->bin);
+	makePath(get, sizeof(get), "%s/diskget", settings->bin);
+	makePath(put, sizeof(put), "%s/diskput", settings->bin);
+	makePath(scratch, sizeof(scratch), "%s/scratch", settings->work);
+	makePath(put_dir, sizeof(put_dir), "%s/put", settings->work);
+	makePath(put_image, sizeof(put_image), "%s/put.IMA", put_dir);
+
+	int total = settings->warmups + settings->runs, run, i;
+	double *times = (double *)malloc(total * sizeof(double));
+	if(times == NULL) {
+		printf("ERROR: Failed to allocate run times\n");
+		exit(EXIT_FAILURE);
+	}
+
+	char *args[BENCH_MAX_ARGS];
+	int failures;
+
+	//diskinfo and disklist
+	char *whole_tools[] = {info, list};
+	char *whole_names[] = {"diskinfo", "disklist"};
+	for(i = 0; i < 2; i++) {
+		args[0] = whole_tools[i];
+		args[1] = image->path;
+		args[2] = NULL;
+
+		failures = 0;
+		for(run = 0; run < total; run++) {
+			if(!runTool(settings->work, args, &times[run]) && run >= settings->warmups) failures++;
+		}
+
+		printResult(settings, image, whole_names[i], times + settings->warmups,
+			image->image_bytes * settings->runs, (int64_t)image->count * settings->runs, failures);
+	}
+
+	//diskget of one file at a time to stdout
+	if(image->count > 0) {
+		int64_t bytes = 0;
+		failures = 0;
+		for(run = 0; run < total; run++) {
+			int file = (int)(((int64_t)run * 7919) % image->count);
+			char *get_args[] = {get, image->path, image->files[file], "-", NULL};
+
+			if(!runTool(settings->work, get_args, &times[run]) && run >= settings->warmups) failures++;
+			if(run >= settings->warmups) bytes += image->sizes[file];
+		}
+
+		printResult(settings, image, "diskget", times + settings->warmups, bytes, settings->runs, failures);
+	}
+
+	//diskget -r of the whole image
+	failures = 0;
+	for(run = 0; run < total; run++) {
+		emptyDirectory(scratch);
+		char *get_args[] = {get, "-r", image->path, NULL};
+		if(!runTool(scratch, get_args, &times[run]) && run >= settings->warmups) failures++;
+	}
+	emptyDirectory(scratch);
+	rmdir(scratch);
+
+	printResult(settings, image, "diskget -r", times + settings->warmups,
+		image->data_bytes * settings->runs, (int64_t)image->count * settings->runs, failures);
+
+	//diskput of a batch of files to a fresh copy each time
+	emptyDirectory(put_dir);
+
+	char names[BENCH_PUT_FILES][16];
+	static char data[BENCH_PUT_SIZE];
+	for(i = 0; i < BENCH_PUT_SIZE; i++) data[i] = 'a' + i % 26;
+
+	args[0] = put;
+	args[1] = put_image;
+	for(i = 0; i < BENCH_PUT_FILES; i++) {
+		snprintf(names[i], sizeof(names[i]), "P%07d.BIN", i);
+		args[2 + i] = names[i];
+
+		char path[PATH_MAX + 64];
+		makePath(path, sizeof(path), "%s/%s", put_dir, names[i]);
+		int fd = open(path, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+		if(fd < 0 || write(fd, data, BENCH_PUT_SIZE) != BENCH_PUT_SIZE) {
+			printf("ERROR: Writing %s failed\n", path);
+			exit(EXIT_FAILURE);
+		}
+		close(fd);
+	}
+	args[2 + BENCH_PUT_FILES] = NULL;
+
+	failures = 0;
+	for(run = 0; run < total; run++) {
+		copyFile(image->path, put_image);
+		if(!runTool(put_dir, args, &times[run]) && run >= settings->warmups) failures++;
+	}
+	emptyDirectory(put_dir);
+	rmdir(put_dir);
+
+	printResult(settings, image, "diskput", times + settings->warmups,
+		(int64_t)BENCH_PUT_FILES * BENCH_PUT_SIZE * settings->runs, (int64_t)BENCH_PUT_FILES * settings->runs, failures);
+
+	free(times);
+}
+
+
+/*******************************************************************************
+ * function: main
+ *******************************************************************************
+ * Main execution for diskbench.
+ *
+ * Each configuration given, or each of the default suite, is generated and
+ * timed in turn, and its image removed once it has been timed.
+ *
+ * @param	int argc	number of arguments passed during execution
+ * @param	char *argv[]	vector of arguments passed during execution
+ *
+ * @return	int		N/A
+ ******************************************************************************/
+
+int main(int argc, char *argv[]) {
+	bench_settings settings;
+	char *bin = ".", *work = ".", *output = NULL;
+	int opt;
+
+	settings.runs = 10;
+	settings.warmups = 1;
+
+	while((opt = getopt(argc, argv, "r:W:b:w:o:")) != -1) {
+		if(opt == 'r') settings.runs = atoi(optarg);
+		else if(opt == 'W') settings.warmups = atoi(optarg);
+		else if(opt == 'b') bin = optarg;
+		else if(opt == 'w') work = optarg;
+		else if(opt == 'o') output = optarg;
+		else settings.runs = 0;
+	}
+
+	if(settings.runs < 1 || settings.warmups < 0) {
+		printf("ERROR: Usage \"diskbench [-r runs] [-W warmups] [-b tool_dir] [-w work_dir] [-o output] [\"diskgen options\" ...]\"\n");
+		exit(EXIT_FAILURE);
+	}
+
+	if(realpath(bin, settings.bin) == NULL || realpath(work, settings.work) == NULL) {
+		printf("ERROR: Directory not found\n");
+		exit(EXIT_FAILURE);
+	}
+
+	settings.out = stdout;
+	if(output != NULL && (settings.out = fopen(output, "w")) == NULL) {
+		printf("ERROR: Opening output failed\n");
+		exit(EXIT_FAILURE);
+	}
+
+	char **configs = argv + optind;
+	int count = argc - optind, i, j;
+	if(count == 0) {
+		configs = default_suite;
+		count = sizeof(default_suite) / sizeof(default_suite[0]);
+	}
+
+	for(i = 0; i < count; i++) {
+		bench_image image;
+		makeImage(&settings, configs[i], i, &image);
+		benchImage(&settings, &image);
+
+		remove(image.path);
+		char manifest[PATH_MAX + 16];
+		makePath(manifest, sizeof(manifest), "%s/bench%d.txt", settings.work, i);
+		remove(manifest);
+
+		//an index left behind when the tools ran with DISK_INDEX set
+		char sidecar[PATH_MAX + 16];
+		makePath(sidecar, sizeof(sidecar), "%s.fatidx", image.path);
+		remove(sidecar);
+
+		for(j = 0; j < image.count; j++) free(image.files[j]);
+		free(image.files);
+		free(image.sizes);
+	}
+
+	if(settings.out != stdout) fclose(settings.out);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,454 @@
+/***** diskblock.c *************************************************************
+ * University of Victoria
+ * CSC 360 Fall 2018
+ * Italo Borrelli
+ * V00884840
+ *******************************************************************************
+ * diskblock.c is a source file that reads a disk image through one of several
+ * backends, picked for each run with the DISK_BACKEND environment variable:
+ *
+ * mmap		the whole image is mapped, the default
+ * pread	blocks are read with pread and kept in a small cache, so only
+ *		the cache and not the image needs address space
+ * direct	the same with O_DIRECT, which skips the page cache and reads
+ *		exactly what is asked for from the storage
+ *
+ * The cache of the pread backends holds DISK_CACHE blocks of BLOCK_SIZE bytes,
+ * 1024 by default, and gives up the least recently used block when it is full.
+ * It is meant for the FAT and directories, which are read a little at a time
+ * and often more than once. Reads of BLOCK_BYPASS bytes or more are file data
+ * and go straight to the image so they don't push the directories out.
+ ******************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <string.h>
+
+#include "diskblock.h"
+
+#define BLOCK_DIRECT_CHUNK 1048576	//most bytes of one uncached direct read
+
+
+/*******************************************************************************
+ * function: getBackend
+ *******************************************************************************
+ * Get the backend picked for this run.
+ *
+ * @return	block_backend	the backend named by DISK_BACKEND, BLOCK_MMAP if
+ * 				it isn't set
+ *
+ * @see				diskblock.h
+ ******************************************************************************/
+
+block_backend getBackend(void) {
+	char *name = getenv("DISK_BACKEND");
+
+	if(name == NULL || strcmp(name, "mmap") == 0) return BLOCK_MMAP;
+	if(strcmp(name, "pread") == 0) return BLOCK_PREAD;
+	if(strcmp(name, "direct") == 0) return BLOCK_DIRECT;
+
+	printf("ERROR: DISK_BACKEND must be mmap, pread or direct\n");
+	exit(EXIT_FAILURE);
+}
+
+
+/*******************************************************************************
+ * function: requireMapBackend
+ *******************************************************************************
+ * Stop a tool that always maps the image if another backend was picked, so
+ * DISK_BACKEND is never quietly ignored.
+ *
+ * @param	FILE *out	stream the error is printed to
+ * @param	char *tool	name of the tool
+ *
+ * @return	void		no return value
+ *
+ * @see				diskblock.h
+ ******************************************************************************/
+
+void requireMapBackend(FILE *out, char *tool) {
+	if(getBackend() == BLOCK_MMAP) return;
+
+	fprintf(out, "ERROR: %s always maps the image, DISK_BACKEND must be mmap\n", tool);
+	exit(EXIT_FAILURE);
+}
+
+
+/*******************************************************************************
+ * function: openBlockDevice
+ *******************************************************************************
+ * Open a disk image for reading through a backend.
+ *
+ * @param	block_device *dev	device to initialize
+ * @param	char *path	path of the disk image
+ * @param	block_backend backend
+ * 				how to read the image
+ *
+ * @return	bool		false if the image can't be opened that way
+ *
+ * @see				diskblock.h
+ ******************************************************************************/
+
+bool openBlockDevice(block_device *dev, char *path, block_backend backend) {
+	memset(dev, 0, sizeof(block_device));
+	dev->backend = backend;
+	dev->newest = dev->oldest = -1;
+
+	dev->fd = open(path, O_RDONLY | (backend == BLOCK_DIRECT ? O_DIRECT : 0));
+	if(dev->fd < 0) return false;
+
+	struct stat buff;
+	fstat(dev->fd, &buff);
+	dev->size = buff.st_size;
+
+	if(backend == BLOCK_MMAP) {
+		dev->map = mmap(0, dev->size, PROT_READ, MAP_SHARED, dev->fd, 0);
+		if(dev->map == MAP_FAILED) {
+			close(dev->fd);
+			return false;
+		}
+
+		return true;
+	}
+
+	char *blocks = getenv("DISK_CACHE");
+	dev->capacity = (blocks == NULL) ? BLOCK_CACHE_DEFAULT : atoi(blocks);
+	if(dev->capacity < 0) dev->capacity = 0;
+
+	for(dev->num_buckets = 1; dev->num_buckets < dev->capacity * 2; dev->num_buckets *= 2);
+
+	//the slots are aligned so O_DIRECT can read straight into them
+	void *data = NULL;
+	if(dev->capacity > 0 && posix_memalign(&data, BLOCK_SIZE, (size_t)dev->capacity * BLOCK_SIZE) != 0) data = NULL;
+
+	dev->data = (char *)data;
+	dev->tags = (int64_t *)malloc(dev->capacity * sizeof(int64_t));
+	dev->newer = (int *)malloc(dev->capacity * sizeof(int));
+	dev->older = (int *)malloc(dev->capacity * sizeof(int));
+	dev->chain = (int *)malloc(dev->capacity * sizeof(int));
+	dev->buckets = (int *)malloc(dev->num_buckets * sizeof(int));
+
+	if(dev->capacity > 0 && (dev->data == NULL || dev->tags == NULL || dev->newer == NULL || dev->older == NULL || dev->chain == NULL)) {
+		printf("ERROR: Failed to allocate block cache\n");
+		exit(EXIT_FAILURE);
+	}
+
+	if(dev->buckets == NULL || pthread_mutex_init(&dev->mutex, NULL) != 0) {
+		printf("ERROR: Failed to allocate block cache\n");
+		exit(EXIT_FAILURE);
+	}
+
+	int i;
+	for(i = 0; i < dev->num_buckets; i++) dev->buckets[i] = -1;
+
+	return true;
+}
+
+
+/*******************************************************************************
+ * function: closeBlockDevice
+ *******************************************************************************
+ * Close a disk image and release its mapping or cache.
+ *
+ * @param	block_device *dev	device to close
+ *
+ * @return	void		no return value
+ *
+ * @see				diskblock.h
+ ******************************************************************************/
+
+void closeBlockDevice(block_device *dev) {
+	if(dev->backend == BLOCK_MMAP) {
+		munmap(dev->map, dev->size);
+	} else {
+		free(dev->data);
+		free(dev->tags);
+		free(dev->newer);
+		free(dev->older);
+		free(dev->chain);
+		free(dev->buckets);
+		pthread_mutex_destroy(&dev->mutex);
+	}
+
+	close(dev->fd);
+	dev->fd = -1;
+	dev->map = NULL;
+}
+
+
+/*******************************************************************************
+ * function: readAt
+ *******************************************************************************
+ * Read a range of the image with pread, as far as the end of the image.
+ *
+ * For BLOCK_DIRECT the buffer, offset and length must all be multiples of
+ * BLOCK_SIZE.
+ *
+ * @param	block_device *dev	device to read from
+ * @param	int64_t offset	byte offset in the image
+ * @param	char *buf	where to read to
+ * @param	size_t length	number of bytes to read
+ *
+ * @return	int64_t		bytes read, less than length only at the end
+ * 				of the image, -1 if the read failed
+ ******************************************************************************/
+
+static int64_t readAt(block_device *dev, int64_t offset, char *buf, size_t length) {
+	size_t done = 0;
+
+	while(done < length) {
+		ssize_t got = pread(dev->fd, buf + done, length - done, offset + done);
+		if(got < 0) return -1;
+		if(got == 0) break;
+		done += got;
+	}
+
+	return done;
+}
+
+
+/*******************************************************************************
+ * function: readUncached
+ *******************************************************************************
+ * Read a range of the image without the cache.
+ *
+ * O_DIRECT reads whole aligned blocks, so a direct read goes through an
+ * aligned buffer of at most BLOCK_DIRECT_CHUNK bytes at a time.
+ *
+ * @param	block_device *dev	device to read from
+ * @param	int64_t offset	byte offset in the image
+ * @param	char *buf	where to read to
+ * @param	size_t length	number of bytes to read
+ *
+ * @return	bool		true if the whole range was read
+ ******************************************************************************/
+
+static bool readUncached(block_device *dev, int64_t offset, char *buf, size_t length) {
+	if(dev->backend != BLOCK_DIRECT) return readAt(dev, offset, buf, length) == (int64_t)length;
+
+	int64_t start = offset & ~(int64_t)(BLOCK_SIZE - 1);
+	int64_t end = (offset + length + BLOCK_SIZE - 1) & ~(int64_t)(BLOCK_SIZE - 1);
+	size_t chunk = (end - start < BLOCK_DIRECT_CHUNK) ? end - start : BLOCK_DIRECT_CHUNK;
+
+	void *bounce;
+	if(posix_memalign(&bounce, BLOCK_SIZE, chunk) != 0) {
+		printf("ERROR: Failed to allocate read buffer\n");
+		exit(EXIT_FAILURE);
+	}
+
+	bool ok = true;
+	while(ok && start < end) {
+		size_t bytes = (end - start < (int64_t)chunk) ? (size_t)(end - start) : chunk;
+		int64_t got = readAt(dev, start, (char *)bounce, bytes);
+
+		//only the part of the chunk inside the range is copied out
+		int64_t from = (offset > start) ? offset : start;
+		int64_t to = (offset + (int64_t)length < start + (int64_t)bytes) ? offset + length : start + bytes;
+		if(got < to - start) ok = false;
+		else memcpy(buf + (from - offset), (char *)bounce + (from - start), to - from);
+
+		start += bytes;
+	}
+
+	free(bounce);
+	return ok;
+}
+
+
+/*******************************************************************************
+ * function: touchSlot
+ *******************************************************************************
+ * Moves a slot to the most recently used end of the list, taking it out of
+ * the list first if it is already in it.
+ *
+ * @param	block_device *dev	device the cache belongs to
+ * @param	int slot	slot to move
+ * @param	bool linked	true if the slot is in the list
+ *
+ * @return	void		no return value
+ ******************************************************************************/
+
+static void touchSlot(block_device *dev, int slot, bool linked) {
+	if(linked) {
+		if(dev->newest == slot) return;
+
+		if(dev->older[slot] != -1) dev->newer[dev->older[slot]] = dev->newer[slot];
+		else dev->oldest = dev->newer[slot];
+		dev->older[dev->newer[slot]] = dev->older[slot];
+	}
+
+	dev->older[slot] = dev->newest;
+	dev->newer[slot] = -1;
+	if(dev->newest != -1) dev->newer[dev->newest] = slot;
+	dev->newest = slot;
+	if(dev->oldest == -1) dev->oldest = slot;
+}
+
+
+/*******************************************************************************
+ * function: hashBlock
+ *******************************************************************************
+ * Finds the bucket of a block.
+ *
+ * @param	block_device *dev	device the cache belongs to
+ * @param	int64_t block	block number
+ *
+ * @return	int		bucket of the block
+ ******************************************************************************/
+
+static int hashBlock(block_device *dev, int64_t block) {
+	return (int)(((uint64_t)block * 0x9e3779b97f4a7c15ULL) >> 40) & (dev->num_buckets - 1);
+}
+
+
+/*******************************************************************************
+ * function: loadBlock
+ *******************************************************************************
+ * Finds the slot holding a block, reading the block into the least recently
+ * used slot if it isn't cached. The cache mutex must be held.
+ *
+ * @param	block_device *dev	device the cache belongs to
+ * @param	int64_t block	block to find
+ *
+ * @return	int		slot holding the block, -1 if it couldn't be
+ * 				read
+ ******************************************************************************/
+
+static int loadBlock(block_device *dev, int64_t block) {
+	int bucket = hashBlock(dev, block);
+	int slot;
+
+	for(slot = dev->buckets[bucket]; slot != -1; slot = dev->chain[slot]) {
+		if(dev->tags[slot] == block) {
+			touchSlot(dev, slot, true);
+			return slot;
+		}
+	}
+
+	bool linked = dev->used == dev->capacity;
+	if(!linked) {
+		slot = dev->used++;
+	} else {
+		//give up the least recently used block, taking it out of its
+		//bucket
+		slot = dev->oldest;
+		if(dev->tags[slot] != -1) {
+			int *link = &dev->buckets[hashBlock(dev, dev->tags[slot])];
+			while(*link != slot) link = &dev->chain[*link];
+			*link = dev->chain[slot];
+		}
+	}
+
+	char *data = dev->data + (size_t)slot * BLOCK_SIZE;
+	int64_t got = readAt(dev, block * BLOCK_SIZE, data, BLOCK_SIZE);
+
+	//a slot that failed to read is left empty at the old end of the list
+	if(got < 0) {
+		if(linked) dev->tags[slot] = -1;
+		else dev->used--;
+		return -1;
+	}
+
+	//the last block of the image may be short
+	memset(data + got, 0, BLOCK_SIZE - got);
+
+	dev->tags[slot] = block;
+	dev->chain[slot] = dev->buckets[bucket];
+	dev->buckets[bucket] = slot;
+	touchSlot(dev, slot, linked);
+
+	return slot;
+}
+
+
+/*******************************************************************************
+ * function: readBlocks
+ *******************************************************************************
+ * Read a range of bytes of the image.
+ *
+ * Mapped images are copied from the mapping. Otherwise a short read goes
+ * through the cache one block at a time and a long one straight to the image.
+ * Any number of threads can read at once, the cache is used by one at a time.
+ *
+ * @param	block_device *dev	device to read from
+ * @param	int64_t offset	byte offset in the image
+ * @param	char *buf	where to read to
+ * @param	size_t length	number of bytes to read
+ *
+ * @return	bool		false if the range is outside the image or
+ * 				couldn't be read
+ *
+ * @see				diskblock.h
+ ******************************************************************************/
+
+bool readBlocks(block_device *dev, int64_t offset, char *buf, size_t length) {
+	if(offset < 0 || (int64_t)length > dev->size || offset > dev->size - (int64_t)length) return false;
+
+	if(dev->map != NULL) {
+		memcpy(buf, dev->map + offset, length);
+		return true;
+	}
+
+	if(length >= BLOCK_BYPASS || dev->capacity == 0) return readUncached(dev, offset, buf, length);
+
+	if(pthread_mutex_lock(&dev->mutex) != 0) {
+		printf("ERROR: Failed to lock mutex\n");
+		exit(EXIT_FAILURE);
+	}
+
+	bool ok = true;
+	while(length > 0) {
+		int slot = loadBlock(dev, offset / BLOCK_SIZE);
+		if(slot == -1) {
+			ok = false;
+			break;
+		}
+
+		size_t within = offset % BLOCK_SIZE;
+		size_t bytes = (length < BLOCK_SIZE - within) ? length : BLOCK_SIZE - within;
+		memcpy(buf, dev->data + (size_t)slot * BLOCK_SIZE + within, bytes);
+
+		buf += bytes;
+		offset += bytes;
+		length -= bytes;
+	}
+
+	pthread_mutex_unlock(&dev->mutex);
+	return ok;
+}
+
+
+/*******************************************************************************
+ * function: adviseBlocks
+ *******************************************************************************
+ * Tell the kernel a range of the image will be read soon so it can start
+ * reading it in the background.
+ *
+ * A mapped image is advised through the mapping and a pread image through the
+ * file. An image read with O_DIRECT isn't advised at all since its reads skip
+ * the page cache the range would be read into.
+ *
+ * @param	block_device *dev	device the range will be read from
+ * @param	int64_t offset	byte offset in the image
+ * @param	size_t length	number of bytes that will be read
+ *
+ * @return	void		no return value
+ *
+ * @see				diskblock.h
+ ******************************************************************************/
+
+void adviseBlocks(block_device *dev, int64_t offset, size_t length) {
+	if(dev->map != NULL) {
+		//madvise takes a range starting on a page
+		int64_t start = offset - offset % sysconf(_SC_PAGESIZE);
+		madvise(dev->map + start, length + (offset - start), MADV_WILLNEED);
+	} else if(dev->backend == BLOCK_PREAD) {
+		posix_fadvise(dev->fd, offset, length, POSIX_FADV_WILLNEED);
+	}
+}
@@ -0,0 +1,85 @@
+/***** diskblock.h *************************************************************
+ * University of Victoria
+ * CSC 360 Fall 2018
+ * Italo Borrelli
+ * V00884840
+ *******************************************************************************
+ * This header file declares the mehods defined in diskblock.c.
+ ******************************************************************************/
+
+#ifndef DISK_BLOCK_H_
+#define DISK_BLOCK_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#include "diskhelpers.h"
+
+#define BLOCK_SIZE 4096		//bytes read and cached at a time, aligned
+				//for O_DIRECT
+#define BLOCK_CACHE_DEFAULT 1024	//blocks cached unless DISK_CACHE says
+#define BLOCK_BYPASS 65536	//reads this large skip the cache
+
+
+/*******************************************************************************
+ * BLOCK BACKEND
+ *******************************************************************************
+ * How the image is read, picked for each run by DISK_BACKEND.
+ ******************************************************************************/
+
+typedef enum block_backend {
+	BLOCK_MMAP,			//the whole image is mapped
+	BLOCK_PREAD,			//read with pread through the page cache
+	BLOCK_DIRECT			//read with pread around the page cache
+} block_backend;
+
+
+/*******************************************************************************
+ * BLOCK DEVICE
+ *******************************************************************************
+ * A disk image opened read only through one of the backends. The pread
+ * backends keep the blocks read last in a bounded cache, with the least
+ * recently used block given up first when it is full. Blocks are numbered by
+ * their byte offset divided by BLOCK_SIZE.
+ *
+ * The cache is an array of slots chained into a hash table by block number and
+ * into a list from most to least recently used, linked by slot number.
+ ******************************************************************************/
+
+typedef struct block_device {
+	block_backend backend;		//how the image is read
+	int fd;				//image file, opened with O_DIRECT for
+					//BLOCK_DIRECT
+	int64_t size;			//size of the image in bytes
+	char *map;			//the whole image for BLOCK_MMAP, else NULL
+
+	char *data;			//BLOCK_SIZE bytes for each slot
+	int64_t *tags;			//block in each slot, -1 if empty
+	int *newer;			//slot used more recently, -1 for the newest
+	int *older;			//slot used less recently, -1 for the oldest
+	int *chain;			//next slot in the same hash bucket
+	int *buckets;			//first slot of each bucket or -1
+	int capacity;			//number of slots, 0 for no cache
+	int num_buckets;		//number of buckets, a power of two
+	int newest;			//most recently used slot, -1 if none
+	int oldest;			//least recently used slot, -1 if none
+	int used;			//number of slots holding a block
+	pthread_mutex_t mutex;		//taken to use the cache
+} block_device;
+
+
+/*******************************************************************************
+ * FUNCTION DECLARATIONS
+ ******************************************************************************/
+
+block_backend getBackend(void);
+void requireMapBackend(FILE *out, char *tool);
+bool openBlockDevice(block_device *dev, char *path, block_backend backend);
+void closeBlockDevice(block_device *dev);
+bool readBlocks(block_device *dev, int64_t offset, char *buf, size_t length);
+void adviseBlocks(block_device *dev, int64_t offset, size_t length);
+
+
+#endif //DISK_BLOCK_H_
@@ -0,0 +1,308 @@
+/***** diskc.c *****************************************************************
+ * University of Victoria
+ * CSC 360 Fall 2018
+ * Italo Borrelli
+ * V00884840
+ *******************************************************************************
+ * diskc.c is a source file for a thin client of diskd.
+ *
+ * It does what diskinfo, disklist, diskget and diskput do, but asks a running
+ * diskd for the answer instead of opening the disk image itself. Requests for
+ * several files are sent in batches so a batch costs one round trip.
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+
+#include "diskhelpers.h"
+
+#define BATCH 64
+
+
+/*******************************************************************************
+ * function: sendAll
+ *******************************************************************************
+ * Writes a whole buffer to the daemon.
+ *
+ * A daemon that turns a PUT down hangs up without reading its data, after
+ * saying why, so the last error it sent is printed if there is one.
+ *
+ * @param	int sock	socket connected to the daemon
+ * @param	char *buf	bytes to write
+ * @param	size_t bytes	number of bytes to write
+ *
+ * @return	void		no return value
+ ******************************************************************************/
+
+void sendAll(int sock, char *buf, size_t bytes) {
+	while(bytes > 0) {
+		ssize_t done = write(sock, buf, bytes);
+		if(done <= 0) {
+			char reply[4096];
+			ssize_t got = read(sock, reply, sizeof(reply) - 1);
+			reply[(got > 0) ? got : 0] = '\0';
+
+			char *error = strstr(reply, "ERR "), *next;
+			while(error != NULL && (next = strstr(error + 4, "ERR ")) != NULL) error = next;
+
+			if(error == NULL) printf("ERROR: Lost connection to diskd\n");
+			else printf("%.*s\n", (int)strcspn(error + 4, "\r\n"), error + 4);
+			exit(EXIT_FAILURE);
+		}
+
+		buf += done;
+		bytes -= done;
+	}
+}
+
+
+/*******************************************************************************
+ * function: readResponse
+ *******************************************************************************
+ * Reads the status line of the next response.
+ *
+ * @param	FILE *in	buffered reader of the socket
+ * @param	char *message	set to the error message of a failed request
+ * @param	size_t message_size	size of message
+ *
+ * @return	long		length of the data that follows or -1 on error
+ ******************************************************************************/
+
+long readResponse(FILE *in, char *message, size_t message_size) {
+	char line[256];
+	if(fgets(line, sizeof(line), in) == NULL) {
+		printf("ERROR: Lost connection to diskd\n");
+		exit(EXIT_FAILURE);
+	}
+
+	line[strcspn(line, "\r\n")] = '\0';
+
+	long length;
+	if(sscanf(line, "OK %ld", &length) == 1) return length;
+
+	snprintf(message, message_size, "%s", (strncmp(line, "ERR ", 4) == 0) ? line + 4 : line);
+	return -1;
+}
+
+
+/*******************************************************************************
+ * function: copyResponse
+ *******************************************************************************
+ * Copies the data of a response to a file.
+ *
+ * @param	FILE *in	buffered reader of the socket
+ * @param	FILE *out	file to copy the data to
+ * @param	long length	number of bytes of data
+ *
+ * @return	void		no return value
+ ******************************************************************************/
+
+void copyResponse(FILE *in, FILE *out, long length) {
+	char buf[65536];
+
+	while(length > 0) {
+		size_t bytes = (length < (long)sizeof(buf)) ? (size_t)length : sizeof(buf);
+		if(fread(buf, 1, bytes, in) != bytes) {
+			printf("ERROR: Lost connection to diskd\n");
+			exit(EXIT_FAILURE);
+		}
+
+		if(fwrite(buf, 1, bytes, out) != bytes) {
+			printf("ERROR: Failed to write file\n");
+			exit(EXIT_FAILURE);
+		}
+
+		length -= bytes;
+	}
+}
+
+
+/*******************************************************************************
+ * function: sendPut
+ *******************************************************************************
+ * Sends a PUT request and the data of the host file.
+ *
+ * The host file is found the same way diskput finds it, by the name after the
+ * last slash of the path.
+ *
+ * @param	int sock	socket connected to the daemon
+ * @param	char *image	absolute path of the disk image
+ * @param	char *path	path of the new file on the disk image
+ *
+ * @return	bool		false if the host file could not be read
+ ******************************************************************************/
+
+bool sendPut(int sock, char *image, char *path) {
+	char *filename = strrchr(path, '/');
+	filename = (filename == NULL) ? path : filename + 1;
+
+	int fd = open(filename, O_RDONLY);
+	if(fd < 0) {
+		if(errno == ENOENT) printf("File not found: %s\n", filename);
+		else printf("ERROR: Opening file for copying failed\n");
+		return false;
+	}
+
+	struct stat buff;
+	fstat(fd, &buff);
+
+	//a directory entry can't hold a size of 4 GiB or more
+	if(buff.st_size > 0xffffffffll) {
+		printf("File too large: %s\n", filename);
+		close(fd);
+		return false;
+	}
+
+	char line[PATH_MAX * 2 + 64];
+	int length = snprintf(line, sizeof(line), "PUT %ld %ld %s %s\n", (long)buff.st_size, (long)buff.st_mtime, path, image);
+	sendAll(sock, line, length);
+
+	char buf[65536];
+	long left = buff.st_size;
+	while(left > 0) {
+		ssize_t done = read(fd, buf, (left < (long)sizeof(buf)) ? left : (long)sizeof(buf));
+		if(done <= 0) {
+			//the daemon is owed the size it was promised
+			printf("ERROR: Failed to read %s\n", filename);
+			exit(EXIT_FAILURE);
+		}
+
+		sendAll(sock, buf, done);
+		left -= done;
+	}
+
+	close(fd);
+	return true;
+}
+
+
+/*******************************************************************************
+ * function: main
+ *******************************************************************************
+ * Main execution for diskc.
+ *
+ * Connects to diskd and sends the requests for the given command. For get and
+ * put the requests for up to BATCH files are sent before any response is read.
+ *
+ * @param	int argc	number of arguments passed during execution
+ * @param	char *argv[]	vector of arguments passed during execution
+ *
+ * @return	int		N/A
+ ******************************************************************************/
+
+int main(int argc, char *argv[]) {
+	bool report = argc == 4 && (strcmp(argv[2], "info") == 0 || strcmp(argv[2], "list") == 0);
+	bool get = argc >= 5 && strcmp(argv[2], "get") == 0;
+	bool put = argc >= 5 && strcmp(argv[2], "put") == 0;
+
+	if(!report && !get && !put) {
+		printf("ERROR: Usage \"diskc <socket_path> info|list <disk_image>\"\n");
+		printf("       or    \"diskc <socket_path> get <disk_image> <file_name|path/to/file> [...]\"\n");
+		printf("       or    \"diskc <socket_path> put <disk_image> <file_name> [file_name ...]\"\n");
+		exit(EXIT_FAILURE);
+	}
+
+	//the daemon runs somewhere else so it needs the full image path
+	char image[PATH_MAX];
+	if(realpath(argv[3], image) == NULL) {
+		printf("ERROR: Open failed\n");
+		exit(EXIT_FAILURE);
+	}
+
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, argv[1], sizeof(addr.sun_path) - 1);
+
+	int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(sock < 0 || connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		printf("ERROR: Failed to connect to diskd\n");
+		exit(EXIT_FAILURE);
+	}
+
+	//a daemon that hangs up is reported by sendAll, not by a signal
+	signal(SIGPIPE, SIG_IGN);
+
+	FILE *in = fdopen(sock, "r");
+	if(in == NULL) {
+		printf("ERROR: Failed to open socket\n");
+		exit(EXIT_FAILURE);
+	}
+
+	char line[PATH_MAX * 2 + 64], message[256];
+	int length;
+	long data_length;
+	bool failed = false;
+
+	if(report) {
+		length = snprintf(line, sizeof(line), "%s %s\n", (argv[2][0] == 'i') ? "INFO" : "LIST", image);
+		sendAll(sock, line, length);
+
+		data_length = readResponse(in, message, sizeof(message));
+		if(data_length < 0) {
+			printf("%s\n", message);
+			exit(EXIT_FAILURE);
+		}
+
+		copyResponse(in, stdout, data_length);
+	}
+
+	char **names = argv + 4;
+	int count = argc - 4, i, j;
+	for(i = 0; (get || put) && i < count; i += BATCH) {
+		int end = (i + BATCH < count) ? i + BATCH : count;
+		bool sent[BATCH];
+
+		//send the whole batch before reading any response
+		for(j = i; j < end; j++) {
+			if(put) {
+				sent[j-i] = sendPut(sock, image, names[j]);
+			} else {
+				length = snprintf(line, sizeof(line), "GET %s %s\n", names[j], image);
+				sendAll(sock, line, length);
+				sent[j-i] = true;
+			}
+		}
+
+		for(j = i; j < end; j++) {
+			if(!sent[j-i]) { failed = true; continue; }
+
+			data_length = readResponse(in, message, sizeof(message));
+			if(data_length < 0) {
+				printf("%s: %s\n", message, names[j]);
+				failed = true;
+				continue;
+			}
+
+			if(put) continue;
+
+			//the file is written to the current directory under its own
+			//name
+			char *new_name = strrchr(names[j], '/');
+			new_name = (new_name == NULL) ? names[j] : new_name + 1;
+
+			FILE *out = fopen(new_name, "w");
+			if(out == NULL) {
+				printf("ERROR: Failed to open new file\n");
+				exit(EXIT_FAILURE);
+			}
+
+			copyResponse(in, out, data_length);
+			fclose(out);
+		}
+	}
+
+	sendAll(sock, "QUIT\n", 5);
+	fclose(in);
+
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,822 @@
+/***** diskcheck.c *************************************************************
+ * University of Victoria
+ * CSC 360 Fall 2018
+ * Italo Borrelli
+ * V00884840
+ *******************************************************************************
+ * diskcheck.c is a source file that checks a FAT disk image for damage and
+ * can repair what it finds.
+ *
+ * The FAT is read once from start to end, marking every cluster another
+ * cluster links to. The directory tree is then walked once and every cluster
+ * of every file and directory is claimed by its owner. A cluster claimed twice
+ * is cross-linked, or cyclic when the owner claimed it before, and a chain
+ * that doesn't match the size of its file is reported. Clusters in use that
+ * nobody claimed are lost, and the chains they form are found from the
+ * clusters nothing links to. The copies of the FAT are also compared with the
+ * first, which is the one every other tool reads, and on FAT32 the free
+ * cluster count in the FSInfo sector with the free entries of the FAT.
+ *
+ * Every cluster is claimed at most once so the whole check is linear in the
+ * number of clusters, whatever state the chains are in.
+ *
+ * With -r the damage is repaired: chains are cut where they go wrong, files
+ * get the size of their chain, lost clusters are freed, the other FAT copies
+ * are made the same as the first and the free cluster count is written again.
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <string.h>
+
+#include "diskhelpers.h"
+#include "diskblock.h"
+#include "diskindex.h"
+#include "diskjournal.h"
+
+#define UNCLAIMED -1			//owner of a cluster nobody claimed
+#define LOST -2				//owner of a cluster of a lost chain
+#define CHECK_PATH_MAX 4096		//longest path printed
+
+
+/*******************************************************************************
+ * CHECK NODE
+ *******************************************************************************
+ * A file or directory found by the walk, kept so problems can be reported by
+ * path.
+ ******************************************************************************/
+
+typedef struct check_node {
+	int parent;			//node of the directory it is in, -1 for root
+	char name[13];			//name of the file, empty for root
+	int64_t offset;			//byte offset of its entry, -1 for root
+	int clusters;			//number of clusters of a directory claimed
+} check_node;
+
+
+/*******************************************************************************
+ * CHECK STATE
+ *******************************************************************************
+ * Everything the check knows about the disk image so far.
+ ******************************************************************************/
+
+typedef struct check_state {
+	fat_volume *vol;		//volume being checked
+	bool repair;			//true to repair what is found
+
+	int *owner;			//node that claimed each cluster
+	uint64_t *linked;		//one bit per cluster, set when another
+					//cluster links to it
+
+	check_node *nodes;		//every file and directory found
+	int count;			//number of nodes
+	int capacity;			//number of nodes allocated
+
+	int *stack;			//directories waiting to be walked
+	int stack_count;		//number of directories waiting
+	int stack_capacity;		//number of directories allocated
+
+	int files;			//number of files found
+	int dirs;			//number of directories found
+	int problems;			//number of problems found
+	int repaired;			//number of problems repaired
+} check_state;
+
+
+/*******************************************************************************
+ * function: isUsed
+ *******************************************************************************
+ * Checks if a cluster is in use, which a free or bad cluster isn't.
+ *
+ * @param	fat_volume *vol	volume context
+ * @param	int cluster	cluster to check
+ *
+ * @return	bool		true if the cluster is in use
+ ******************************************************************************/
+
+static bool isUsed(fat_volume *vol, int cluster) {
+	return vol->fat[cluster] != 0x000 && vol->fat[cluster] != FAT_BAD;
+}
+
+
+/*******************************************************************************
+ * function: isLink
+ *******************************************************************************
+ * Checks if a FAT entry links to another cluster of the FAT.
+ *
+ * @param	fat_volume *vol	volume context
+ * @param	int value	value of the FAT entry
+ *
+ * @return	bool		true if the value is the number of a cluster
+ ******************************************************************************/
+
+static bool isLink(fat_volume *vol, int value) {
+	return value >= 2 && value < vol->num_entries;
+}
+
+
+/*******************************************************************************
+ * function: getPath
+ *******************************************************************************
+ * Builds the path of a node, e.g. "SUB/FILE.TXT", or ROOT for the root.
+ *
+ * The path is built from its end back so the depth of the tree never matters.
+ *
+ * @param	check_state *state	state of the check
+ * @param	int node	node to build the path of
+ * @param	char *path	char array of CHECK_PATH_MAX bytes to modify
+ *
+ * @return	char*		the path, which starts somewhere in path
+ ******************************************************************************/
+
+static char *getPath(check_state *state, int node, char *path) {
+	char *start = path + CHECK_PATH_MAX - 1;
+	*start = '\0';
+
+	if(node <= 0) return strcpy(path, "ROOT");
+
+	while(node > 0) {
+		int length = strlen(state->nodes[node].name);
+		if(start - path < length + 1) break;
+
+		start -= length;
+		memcpy(start, state->nodes[node].name, length);
+
+		node = state->nodes[node].parent;
+		if(node > 0) *--start = '/';
+	}
+
+	return start;
+}
+
+
+/*******************************************************************************
+ * function: addNode
+ *******************************************************************************
+ * Adds a file or directory to the nodes of the check.
+ *
+ * @param	check_state *state	state of the check
+ * @param	int parent	node of the directory it is in
+ * @param	int64_t offset	byte offset of its entry, -1 for root
+ *
+ * @return	int		the new node
+ ******************************************************************************/
+
+static int addNode(check_state *state, int parent, int64_t offset) {
+	if(state->count == state->capacity) {
+		state->capacity *= 2;
+		state->nodes = (check_node *)realloc(state->nodes, state->capacity * sizeof(check_node));
+		if(state->nodes == NULL) {
+			printf("ERROR: Failed to allocate nodes\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	check_node *node = &state->nodes[state->count];
+	node->parent = parent;
+	node->offset = offset;
+	node->clusters = 0;
+	node->name[0] = '\0';
+	if(offset >= 0) formatName(state->vol->ptr + offset, node->name);
+
+	return state->count++;
+}
+
+
+/*******************************************************************************
+ * function: getEntrySize
+ *******************************************************************************
+ * Gets the size in a directory entry.
+ *
+ * @param	char *entry	pointer to the directory entry
+ *
+ * @return	uint32_t	size of the file in bytes
+ ******************************************************************************/
+
+static uint32_t getEntrySize(char *entry) {
+	return (entry[28] & 0xff) | (entry[29] & 0xff) << 8 | (entry[30] & 0xff) << 16 | (uint32_t)(entry[31] & 0xff) << 24;
+}
+
+
+/*******************************************************************************
+ * function: setEntrySize
+ *******************************************************************************
+ * Changes the first cluster and size in the entry of a node.
+ *
+ * @param	check_state *state	state of the check
+ * @param	int node	node to change
+ * @param	int cluster	new first cluster
+ * @param	uint32_t size	new size in bytes
+ *
+ * @return	void		no return value
+ ******************************************************************************/
+
+static void setEntrySize(check_state *state, int node, int cluster, uint32_t size) {
+	char *entry = state->vol->ptr + state->nodes[node].offset;
+
+	setEntryCluster(entry, cluster);
+	entry[28] = size & 0xff;
+	entry[29] = (size & 0xff00) >> 8;
+	entry[30] = (size & 0xff0000) >> 16;
+	entry[31] = (size & 0xff000000) >> 24;
+
+	markWritten(state->vol, state->nodes[node].offset, 0x20, true);
+}
+
+
+/*******************************************************************************
+ * function: dropEntry
+ *******************************************************************************
+ * Deletes the entry of a directory that can't be kept.
+ *
+ * @param	check_state *state	state of the check
+ * @param	int node	node of the directory
+ *
+ * @return	void		no return value
+ ******************************************************************************/
+
+static void dropEntry(check_state *state, int node) {
+	state->vol->ptr[state->nodes[node].offset] = (char)0xe5;
+	markWritten(state->vol, state->nodes[node].offset, 0x20, true);
+}
+
+
+/*******************************************************************************
+ * function: checkFAT
+ *******************************************************************************
+ * Reads the FAT once from start to end.
+ *
+ * Every cluster linked to by another is marked, and a link to a cluster that
+ * doesn't exist is reported and, when repairing, made the end of its chain.
+ *
+ * @param	check_state *state	state of the check
+ *
+ * @return	void		no return value
+ ******************************************************************************/
+
+static void checkFAT(check_state *state) {
+	fat_volume *vol = state->vol;
+	int n;
+
+	for(n = 2; n < vol->num_entries; n++) {
+		int value = vol->fat[n];
+		if(value == 0x000 || value == FAT_BAD || isEndOfChain(value)) continue;
+
+		if(isLink(vol, value)) {
+			state->linked[value / 64] |= (uint64_t)1 << (value % 64);
+			continue;
+		}
+
+		printf("Bad link: cluster %d links to %d, which is not a cluster\n", n, value);
+		state->problems++;
+
+		if(state->repair) {
+			setFAT(vol, n, FAT_EOC);
+			state->repaired++;
+		}
+	}
+}
+
+
+/*******************************************************************************
+ * function: claimChain
+ *******************************************************************************
+ * Claims every cluster of the chain of a file or directory.
+ *
+ * The chain is followed until it ends or runs into a cluster it can't have: a
+ * free or bad one, one claimed by something else or one it claimed already.
+ * That is reported and, when repairing, the chain is ended right before it.
+ *
+ * @param	check_state *state	state of the check
+ * @param	int node	node the chain belongs to
+ * @param	int first_cluster	first cluster of the chain
+ * @param	bool *cut	set to true if the chain couldn't be claimed
+ * 				from its first cluster
+ *
+ * @return	int		number of clusters claimed
+ ******************************************************************************/
+
+static int claimChain(check_state *state, int node, int first_cluster, bool *cut) {
+	fat_volume *vol = state->vol;
+	char path[CHECK_PATH_MAX], other[CHECK_PATH_MAX];
+	int cluster = first_cluster, prev = -1, count = 0;
+
+	*cut = false;
+
+	while(true) {
+		char *problem = NULL;
+
+		if(!isLink(vol, cluster)) problem = "a cluster that doesn't exist";
+		else if(!isUsed(vol, cluster)) problem = (vol->fat[cluster] == 0x000) ? "a free cluster" : "a bad cluster";
+
+		if(problem != NULL) {
+			printf("Broken chain: %s runs into %s at %d\n", getPath(state, node, path), problem, cluster);
+		} else if(state->owner[cluster] == node) {
+			printf("Cyclic chain: %s loops back to cluster %d\n", getPath(state, node, path), cluster);
+		} else if(state->owner[cluster] != UNCLAIMED) {
+			printf("Cross-linked: %s and %s share cluster %d\n", getPath(state, node, path), getPath(state, state->owner[cluster], other), cluster);
+		} else {
+			state->owner[cluster] = node;
+			count++;
+
+			int next = vol->fat[cluster];
+			if(!isLink(vol, next)) break;
+
+			prev = cluster;
+			cluster = next;
+			continue;
+		}
+
+		state->problems++;
+
+		//the chain is ended before the cluster it can't have, or not
+		//kept at all when that is its first
+		if(prev == -1) *cut = true;
+		else if(state->repair) {
+			setFAT(vol, prev, FAT_EOC);
+			state->repaired++;
+		}
+
+		break;
+	}
+
+	return count;
+}
+
+
+/*******************************************************************************
+ * function: trimChain
+ *******************************************************************************
+ * Frees every cluster of a claimed chain after the first few.
+ *
+ * @param	check_state *state	state of the check
+ * @param	int first_cluster	first cluster of the chain
+ * @param	int keep	number of clusters to keep, at least 1
+ *
+ * @return	void		no return value
+ ******************************************************************************/
+
+static void trimChain(check_state *state, int first_cluster, int keep) {
+	fat_volume *vol = state->vol;
+	int cluster = first_cluster, i;
+
+	for(i = 1; i < keep; i++) cluster = vol->fat[cluster];
+
+	int next = vol->fat[cluster];
+	setFAT(vol, cluster, FAT_EOC);
+
+	//claimChain already ended the chain wherever it went wrong
+	while(isLink(vol, next) && state->owner[next] != UNCLAIMED) {
+		cluster = next;
+		next = vol->fat[cluster];
+		state->owner[cluster] = UNCLAIMED;
+		setFAT(vol, cluster, 0x000);
+	}
+}
+
+
+/*******************************************************************************
+ * function: checkFile
+ *******************************************************************************
+ * Checks the chain of a file against its size.
+ *
+ * @param	check_state *state	state of the check
+ * @param	int node	node of the file
+ *
+ * @return	void		no return value
+ ******************************************************************************/
+
+static void checkFile(check_state *state, int node) {
+	fat_volume *vol = state->vol;
+	char *entry = vol->ptr + state->nodes[node].offset;
+	char path[CHECK_PATH_MAX];
+
+	int first_cluster = getEntryCluster(entry);
+	uint32_t size = getEntrySize(entry);
+	int needed = (size + (uint32_t)vol->cluster_size - 1) / vol->cluster_size;
+
+	state->files++;
+
+	//an empty file has no chain at all
+	if(first_cluster == 0 && size == 0) return;
+
+	bool cut = false;
+	int count = 0;
+	if(first_cluster != 0) count = claimChain(state, node, first_cluster, &cut);
+
+	if(cut) {
+		//nothing of the chain can be trusted so the file is emptied
+		if(state->repair) {
+			setEntrySize(state, node, 0, 0);
+			state->repaired++;
+		}
+		return;
+	}
+
+	if(count == needed) return;
+
+	printf("Size mismatch: %s is %u bytes, which needs %d clusters, but has %d\n", getPath(state, node, path), size, needed, count);
+	state->problems++;
+
+	if(!state->repair) return;
+
+	//a chain that is too long is trimmed to the size, a size that is too
+	//large is cut down to the chain
+	if(count > needed && needed > 0) trimChain(state, first_cluster, needed);
+	else if(count > needed) {
+		trimChain(state, first_cluster, 1);
+		state->owner[first_cluster] = UNCLAIMED;
+		setFAT(vol, first_cluster, 0x000);
+		setEntrySize(state, node, 0, 0);
+	} else {
+		setEntrySize(state, node, (count == 0) ? 0 : first_cluster, (uint32_t)count * vol->cluster_size);
+	}
+
+	state->repaired++;
+}
+
+
+/*******************************************************************************
+ * function: checkRange
+ *******************************************************************************
+ * Checks every entry in a byte range of a directory.
+ *
+ * Files are checked right away and directories are claimed and left on the
+ * stack to be walked.
+ *
+ * @param	check_state *state	state of the check
+ * @param	int parent	node of the directory
+ * @param	int64_t offset	byte offset of the first entry of the range
+ * @param	int64_t end	byte offset right after the range
+ *
+ * @return	bool		false once the end of the directory is reached
+ ******************************************************************************/
+
+static bool checkRange(check_state *state, int parent, int64_t offset, int64_t end) {
+	fat_volume *vol = state->vol;
+
+	for(; offset < end; offset += 0x20) {
+		char *entry = vol->ptr + offset;
+		int attr = entry[11] & 0xff;
+
+		//0x00 marks the end of the directory
+		if(entry[0] == 0x00) return false;
+
+		//skip deleted entries, long file names, volume labels and the .
+		//and .. entries
+		if((entry[0] & 0xff) == 0xe5 || attr == 0x0f || (attr & 0x08) != 0 || entry[0] == '.') continue;
+
+		int node = addNode(state, parent, offset);
+
+		if((attr & 0x10) == 0) {
+			checkFile(state, node);
+			continue;
+		}
+
+		state->dirs++;
+
+		//the size of a directory is always 0, its chain says how long it is
+		if(getEntrySize(entry) != 0) {
+			char path[CHECK_PATH_MAX];
+			printf("Bad size: %s is a directory of %u bytes\n", getPath(state, node, path), getEntrySize(entry));
+			state->problems++;
+
+			if(state->repair) {
+				setEntrySize(state, node, getEntryCluster(entry), 0);
+				state->repaired++;
+			}
+		}
+
+		bool cut = false;
+		state->nodes[node].clusters = claimChain(state, node, getEntryCluster(entry), &cut);
+
+		//a directory that can't be claimed from its first cluster, which
+		//includes one that contains its own ancestor, isn't walked
+		if(cut) {
+			if(state->repair) {
+				dropEntry(state, node);
+				state->repaired++;
+			}
+			continue;
+		}
+
+		if(state->stack_count == state->stack_capacity) {
+			state->stack_capacity *= 2;
+			state->stack = (int *)realloc(state->stack, state->stack_capacity * sizeof(int));
+			if(state->stack == NULL) {
+				printf("ERROR: Failed to allocate directories\n");
+				exit(EXIT_FAILURE);
+			}
+		}
+
+		state->stack[state->stack_count++] = node;
+	}
+
+	return true;
+}
+
+
+/*******************************************************************************
+ * function: checkTree
+ *******************************************************************************
+ * Walks every directory of the disk image, starting at the root.
+ *
+ * A directory's chain was claimed before it was put on the stack, so it is
+ * read only as far as it was claimed, which ends even a cyclic chain.
+ *
+ * @param	check_state *state	state of the check
+ *
+ * @return	void		no return value
+ ******************************************************************************/
+
+static void checkTree(check_state *state) {
+	fat_volume *vol = state->vol;
+	int root = addNode(state, -1, -1);
+	int i;
+
+	if(vol->root_cluster == 0) {
+		int64_t offset = vol->root_sector_start * vol->bytes_per_sector;
+		checkRange(state, root, offset, offset + (int64_t)vol->sectors_for_root * vol->bytes_per_sector);
+	} else {
+		bool cut = false;
+		state->nodes[root].clusters = claimChain(state, root, vol->root_cluster, &cut);
+		if(!cut) state->stack[state->stack_count++] = root;
+	}
+
+	while(state->stack_count > 0) {
+		int node = state->stack[--state->stack_count];
+		int cluster = (node == root) ? vol->root_cluster : getEntryCluster(vol->ptr + state->nodes[node].offset);
+
+		for(i = 0; i < state->nodes[node].clusters; i++) {
+			int64_t offset = getClusterOffset(vol, cluster);
+			if(!checkRange(state, node, offset, offset + vol->cluster_size)) break;
+
+			cluster = vol->fat[cluster];
+		}
+	}
+}
+
+
+/*******************************************************************************
+ * function: checkLost
+ *******************************************************************************
+ * Finds the clusters in use that no file or directory claimed.
+ *
+ * A lost chain starts at a cluster nothing links to. Whatever is left after
+ * following those is made of cycles, which have no start.
+ *
+ * @param	check_state *state	state of the check
+ *
+ * @return	void		no return value
+ ******************************************************************************/
+
+static void checkLost(check_state *state) {
+	fat_volume *vol = state->vol;
+	int pass, n, lost = 0;
+
+	for(pass = 0; pass < 2; pass++) {
+		for(n = 2; n < vol->num_entries; n++) {
+			if(!isUsed(vol, n) || state->owner[n] != UNCLAIMED) continue;
+
+			bool linked = (state->linked[n / 64] >> (n % 64)) & 1;
+			if(pass == 0 && linked) continue;
+
+			int cluster = n, count = 0;
+			while(isLink(vol, cluster) && isUsed(vol, cluster) && state->owner[cluster] == UNCLAIMED) {
+				state->owner[cluster] = LOST;
+				count++;
+				cluster = vol->fat[cluster];
+			}
+
+			if(pass == 0) printf("Lost chain: %d clusters starting at cluster %d\n", count, n);
+			else printf("Lost chain: %d clusters in a cycle through cluster %d\n", count, n);
+			lost++;
+		}
+	}
+
+	state->problems += lost;
+	if(!state->repair) return;
+
+	for(n = 2; n < vol->num_entries; n++) {
+		if(state->owner[n] != LOST) continue;
+
+		state->owner[n] = UNCLAIMED;
+		setFAT(vol, n, 0x000);
+	}
+
+	//every lost chain was freed at once
+	state->repaired += lost;
+}
+
+
+/*******************************************************************************
+ * function: checkCopies
+ *******************************************************************************
+ * Compares every copy of the FAT with the first, sector by sector.
+ *
+ * When repairing, a sector that differs is replaced by the one of the first
+ * FAT, which is the copy every tool reads.
+ *
+ * @param	check_state *state	state of the check
+ *
+ * @return	void		no return value
+ ******************************************************************************/
+
+static void checkCopies(check_state *state) {
+	fat_volume *vol = state->vol;
+	int bps = vol->bytes_per_sector;
+	int64_t fat_size = (int64_t)vol->sectors_per_fat * bps;
+	int i, sector;
+
+	for(i = 1; i < vol->num_fats; i++) {
+		int differ = 0;
+
+		for(sector = 0; sector < vol->sectors_per_fat; sector++) {
+			int64_t offset = vol->fat_start + (int64_t)sector * bps;
+			if(memcmp(vol->ptr + offset, vol->ptr + offset + i * fat_size, bps) == 0) continue;
+
+			differ++;
+
+			if(state->repair) {
+				memcpy(vol->ptr + offset + i * fat_size, vol->ptr + offset, bps);
+				markWritten(vol, offset + i * fat_size, bps, true);
+			}
+		}
+
+		if(differ == 0) continue;
+
+		printf("FAT copy %d differs from the first in %d sectors\n", i + 1, differ);
+		state->problems++;
+		if(state->repair) state->repaired++;
+	}
+}
+
+
+/*******************************************************************************
+ * function: checkHint
+ *******************************************************************************
+ * Compares the free cluster count stored in the FSInfo sector of a FAT32
+ * image with the free entries of the first FAT.
+ *
+ * Only the count is checked, the next free cluster is just where to start
+ * looking and is never wrong. The volume took the stored count on trust, so
+ * the free entries are counted here and the volume is given the right count
+ * either way. When repairing, it is written along with the FAT by flushFAT.
+ *
+ * @param	check_state *state	state of the check
+ *
+ * @return	void		no return value
+ *
+ * @see				bool readFreeHint(fat_volume*, int*, int*)
+ ******************************************************************************/
+
+static void checkHint(check_state *state) {
+	fat_volume *vol = state->vol;
+	int free_count, next_free, i;
+
+	vol->free_count = 0;
+	for(i = 2; i < vol->num_entries; i++) {
+		if(vol->fat[i] == 0x000) vol->free_count++;
+	}
+
+	if(!readFreeHint(vol, &free_count, &next_free) || free_count == vol->free_count) return;
+
+	if(free_count == -1) printf("FSInfo free cluster count is unknown, %d clusters are free\n", vol->free_count);
+	else printf("FSInfo free cluster count is %d, %d clusters are free\n", free_count, vol->free_count);
+	state->problems++;
+	if(state->repair) state->repaired++;
+}
+
+
+/*******************************************************************************
+ * function: main
+ *******************************************************************************
+ * Main execution for diskcheck.
+ *
+ * Checks the disk image, prints every problem found and a summary, and with
+ * -r repairs the problems and commits the repair like diskput commits a batch.
+ *
+ * @param	int argc	number of arguments passed during execution
+ * @param	char *argv[]	vector of arguments passed during execution
+ *
+ * @return	int		EXIT_FAILURE if problems are left on the image
+ *
+ * @see				diskhelpers.h
+ * @see				void checkFAT(check_state*)
+ * @see				void checkTree(check_state*)
+ * @see				void checkLost(check_state*)
+ * @see				void checkCopies(check_state*)
+ * @see				void checkHint(check_state*)
+ ******************************************************************************/
+
+int main(int argc, char *argv[]) {
+	bool repair = false;
+	int opt;
+	while((opt = getopt(argc, argv, "r")) != -1) {
+		if(opt == 'r') repair = true;
+		else {
+			//an unknown option falls through to the usage
+			optind = argc;
+			break;
+		}
+	}
+
+	if(optind >= argc) {
+		printf("ERROR: Usage \"diskcheck [-r] <disk_image>\"\n");
+		exit(EXIT_FAILURE);
+	}
+
+	char *image_path = argv[optind];
+
+	//the image is always mapped, the backends only serve the readers
+	requireMapBackend(stdout, "diskcheck");
+
+	//finish a batch a writer committed but did not get to apply, the image
+	//stays locked until the tool is done with it, exclusively if it writes
+	int lock = replayJournal(image_path, repair);
+
+	int fd = open(image_path, repair ? O_RDWR : O_RDONLY);
+	if(fd < 0) {
+		printf("ERROR: Open failed\n");
+		exit(EXIT_FAILURE);
+	}
+
+	//create buffer for file statistics
+	struct stat buff;
+	fstat(fd, &buff);
+
+	//a repair is copy on write when journaled so nothing reaches the image
+	//before it is committed
+	bool journaled = repair && useJournal();
+	char *ptr = mmap(0, buff.st_size, repair ? PROT_READ|PROT_WRITE : PROT_READ, journaled ? MAP_PRIVATE : MAP_SHARED, fd, 0);
+
+	if(ptr == MAP_FAILED) {
+		printf("ERROR: Failed to map file\n");
+		exit(EXIT_FAILURE);
+	}
+
+	//the FAT is always decoded from the image, never taken from a sidecar
+	fat_volume vol;
+	getBasicInfo(&vol, ptr);
+	if(journaled) openJournal(&vol, fd, image_path);
+
+	check_state state;
+	memset(&state, 0, sizeof(state));
+	state.vol = &vol;
+	state.repair = repair;
+	state.capacity = 1024;
+	state.stack_capacity = 64;
+	state.owner = (int *)malloc(vol.num_entries * sizeof(int));
+	state.linked = (uint64_t *)calloc((vol.num_entries + 63) / 64, sizeof(uint64_t));
+	state.nodes = (check_node *)malloc(state.capacity * sizeof(check_node));
+	state.stack = (int *)malloc(state.stack_capacity * sizeof(int));
+
+	if(state.owner == NULL || state.linked == NULL || state.nodes == NULL || state.stack == NULL) {
+		printf("ERROR: Failed to allocate check\n");
+		exit(EXIT_FAILURE);
+	}
+
+	int i;
+	for(i = 0; i < vol.num_entries; i++) state.owner[i] = UNCLAIMED;
+
+	//the copies and the free count are compared before any repair changes
+	//the first FAT
+	checkCopies(&state);
+	checkHint(&state);
+	checkFAT(&state);
+	checkTree(&state);
+	checkLost(&state);
+
+	printf("Checked %d files and %d directories in %d clusters\n", state.files, state.dirs, vol.num_entries - 2);
+	if(repair) printf("%d problems found, %d repaired\n", state.problems, state.repaired);
+	else printf("%d problems found\n", state.problems);
+
+	if(repair) {
+		flushFAT(&vol);
+		commitJournal(&vol);
+
+		//the sidecar of the image no longer matches it so save it again
+		if(useSidecar() && state.repaired > 0) {
+			dir_index idx;
+			buildIndex(&vol, &idx);
+			saveIndex(&vol, &idx, image_path);
+			freeIndex(&idx);
+		}
+	}
+
+	free(state.owner);
+	free(state.linked);
+	free(state.nodes);
+	free(state.stack);
+	closeJournal(&vol);
+	freeVolume(&vol);
+	munmap(ptr, buff.st_size);
+	close(fd);
+	close(lock);
+
+	return (state.problems > state.repaired) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
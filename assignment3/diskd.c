@@ -0,0 +1,820 @@
+/***** diskd.c *****************************************************************
+ * University of Victoria
+ * CSC 360 Fall 2018
+ * Italo Borrelli
+ * V00884840
+ *******************************************************************************
+ * diskd.c is a source file for a daemon that keeps FAT disk images open and
+ * answers requests about them over a Unix domain socket.
+ *
+ * The first request for an image opens it, maps it and builds its volume
+ * context, directory index and free cluster map. Every later request for the
+ * same image, from any client, uses them as they are. Each client is served by
+ * its own thread, requests that only read an image run at the same time and
+ * requests that write to it take the image for themselves.
+ *
+ * A client may send any number of requests before reading the responses, which
+ * come back one for each request in the same order.
+ *
+ * With DISK_JOURNAL set every PUT is committed through the journal of its image
+ * before the client is told it succeeded.
+ *
+ * Requests, one per line, with the image path always last:
+ *	INFO <image>				the report printed by diskinfo
+ *	LIST <image>				the listing printed by disklist
+ *	GET <file|path/to/file> <image>		the contents of a file
+ *	PUT <size> <mtime> <path> <image>	followed by size bytes of data
+ *	QUIT					closes the connection
+ *
+ * Responses:
+ *	OK <length>				followed by length bytes of data
+ *	ERR <message>
+ ******************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+#include <sys/un.h>
+#include <string.h>
+#include <signal.h>
+#include <limits.h>
+#include <pthread.h>
+
+#include "diskhelpers.h"
+#include "diskblock.h"
+#include "diskindex.h"
+#include "diskformat.h"
+#include "diskwrite.h"
+#include "diskjournal.h"
+
+#define MAX_LINE PATH_MAX + 256
+
+
+/*******************************************************************************
+ * SERVED IMAGE
+ *******************************************************************************
+ * A disk image kept open by the daemon, in a list of every image opened so far.
+ ******************************************************************************/
+
+typedef struct served_image {
+	char *path;			//absolute path of the image
+	int fd;				//file descriptor of the image
+	char *ptr;			//mapping of the image
+	size_t size;			//size of the image in bytes
+	int64_t mtime;			//modification time of the image in nanoseconds
+	bool writable;			//the image could be opened read/write
+	bool loaded;			//the volume and index below are in use
+	char error[GEOMETRY_ERROR];	//why the image could not be read in again
+
+	fat_volume vol;			//volume context of the image
+	dir_index idx;			//directory index of the image
+	pthread_rwlock_t lock;		//read by many requests, written by one
+
+	struct served_image *next;	//next image opened by the daemon
+} served_image;
+
+served_image *images = NULL;
+pthread_mutex_t images_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+char *socket_path;
+
+
+/*******************************************************************************
+ * function: loadImage
+ *******************************************************************************
+ * Opens and maps an image and builds its volume context and directory index.
+ *
+ * The size and modification time of the image are kept so a change made to it
+ * by another process can be noticed later. The image has to be locked.
+ *
+ * @param	served_image *image	image to read in, with its path set
+ * @param	char *error	set to why the image could not be read in, must
+ * 				hold GEOMETRY_ERROR bytes
+ *
+ * @return	bool		true if the image was read in
+ *
+ * @see				bool checkVolume(fat_volume*, dir_index*, char*, int64_t, char*, char*)
+ * @see				void buildFreeMap(fat_volume*)
+ ******************************************************************************/
+
+bool loadImage(served_image *image, char *error) {
+	snprintf(error, GEOMETRY_ERROR, "Open failed");
+
+	//open read/write if allowed so PUT can be served, read only otherwise
+	image->writable = true;
+	image->fd = open(image->path, O_RDWR);
+	if(image->fd < 0) {
+		image->writable = false;
+		image->fd = open(image->path, O_RDONLY);
+	}
+
+	struct stat buff;
+	if(image->fd < 0 || fstat(image->fd, &buff) < 0) {
+		if(image->fd >= 0) close(image->fd);
+		return false;
+	}
+
+	image->size = buff.st_size;
+	image->mtime = (int64_t)buff.st_mtim.tv_sec * 1000000000 + buff.st_mtim.tv_nsec;
+
+	//a journaled image is changed copy on write until each PUT is
+	//committed
+	int flags = (image->writable && useJournal()) ? MAP_PRIVATE : MAP_SHARED;
+	image->ptr = mmap(0, image->size, PROT_READ|(image->writable ? PROT_WRITE : 0), flags, image->fd, 0);
+	if(image->ptr == MAP_FAILED) {
+		close(image->fd);
+		return false;
+	}
+
+	if(!checkVolume(&image->vol, &image->idx, image->ptr, image->size, image->path, error)) {
+		munmap(image->ptr, image->size);
+		close(image->fd);
+		return false;
+	}
+
+	//readers share the volume so nothing in it may be filled in lazily
+	//while they hold it
+	buildFreeMap(&image->vol);
+	if(image->writable && useJournal()) openJournal(&image->vol, image->fd, image->path);
+
+	image->loaded = true;
+	return true;
+}
+
+
+/*******************************************************************************
+ * function: reloadImage
+ *******************************************************************************
+ * Drops everything the daemon built from an image and reads it in again.
+ *
+ * The image has to be locked for writing. If it can no longer be read in, the
+ * reason is kept and its size and modification time are still taken, so the
+ * image is only tried again once it changes once more.
+ *
+ * @param	served_image *image	image to read in again
+ *
+ * @return	void		no return value
+ *
+ * @see				bool loadImage(served_image*, char*)
+ ******************************************************************************/
+
+void reloadImage(served_image *image) {
+	if(image->loaded) {
+		closeJournal(&image->vol);
+		freeIndex(&image->idx);
+		freeVolume(&image->vol);
+		munmap(image->ptr, image->size);
+		close(image->fd);
+		memset(&image->vol, 0, sizeof(image->vol));
+		memset(&image->idx, 0, sizeof(image->idx));
+		image->loaded = false;
+	}
+
+	if(!loadImage(image, image->error)) {
+		uint64_t size = 0;
+		int64_t mtime = 0;
+		statImage(image->path, &size, &mtime);
+
+		image->size = size;
+		image->mtime = mtime;
+	}
+}
+
+
+/*******************************************************************************
+ * function: imageChanged
+ *******************************************************************************
+ * Checks if an image file has changed since the daemon last read it in.
+ *
+ * @param	served_image *image	image to check
+ *
+ * @return	bool		true if its size or modification time moved
+ *
+ * @see				bool statImage(char*, uint64_t*, int64_t*)
+ ******************************************************************************/
+
+bool imageChanged(served_image *image) {
+	uint64_t size = 0;
+	int64_t mtime = 0;
+	statImage(image->path, &size, &mtime);
+
+	return size != image->size || mtime != image->mtime;
+}
+
+
+/*******************************************************************************
+ * function: getImage
+ *******************************************************************************
+ * Finds an image the daemon has open or opens it.
+ *
+ * An image that isn't a FAT image the daemon can read is closed again and
+ * only the client that asked for it is told, every other client carries on.
+ *
+ * @param	char *image_path	path of the image as sent by the client
+ * @param	char *error	set to why the image could not be opened, must
+ * 				hold GEOMETRY_ERROR bytes
+ *
+ * @return	served_image*	the open image or NULL if it could not be opened
+ *
+ * @see				bool loadImage(served_image*, char*)
+ ******************************************************************************/
+
+served_image *getImage(char *image_path, char *error) {
+	snprintf(error, GEOMETRY_ERROR, "Open failed");
+
+	char path[PATH_MAX];
+	if(realpath(image_path, path) == NULL) return NULL;
+
+	if(pthread_mutex_lock(&images_mutex) != 0) {
+		fprintf(stderr, "ERROR: Failed to lock mutex\n");
+		exit(EXIT_FAILURE);
+	}
+
+	served_image *image;
+	for(image = images; image != NULL; image = image->next) {
+		if(strcmp(image->path, path) == 0) break;
+	}
+
+	if(image == NULL) {
+		image = (served_image *)calloc(1, sizeof(served_image));
+		if(image == NULL) {
+			fprintf(stderr, "ERROR: Failed to allocate image\n");
+			exit(EXIT_FAILURE);
+		}
+
+		image->path = strdup(path);
+
+		//finish a batch a writer committed but did not get to apply, the
+		//image stays locked shared while it is read in
+		int lock = replayJournal(path, false);
+		bool loaded = loadImage(image, error);
+		if(lock >= 0) close(lock);
+
+		if(!loaded) {
+			free(image->path);
+			free(image);
+			image = NULL;
+		} else {
+			if(pthread_rwlock_init(&image->lock, NULL) != 0) {
+				fprintf(stderr, "ERROR: Failed to initialize lock\n");
+				exit(EXIT_FAILURE);
+			}
+
+			image->next = images;
+			images = image;
+		}
+	}
+
+	if(pthread_mutex_unlock(&images_mutex) != 0) {
+		fprintf(stderr, "ERROR: Failed to unlock mutex\n");
+		exit(EXIT_FAILURE);
+	}
+
+	return image;
+}
+
+
+/*******************************************************************************
+ * function: unlockImage
+ *******************************************************************************
+ * Releases the lock of an image.
+ *
+ * @param	served_image *image	image to unlock
+ * @param	int lock	image file returned by lockImage
+ *
+ * @return	void		no return value
+ ******************************************************************************/
+
+void unlockImage(served_image *image, int lock) {
+	if(lock >= 0) close(lock);
+
+	if(pthread_rwlock_unlock(&image->lock) != 0) {
+		fprintf(stderr, "ERROR: Failed to unlock image\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
+
+/*******************************************************************************
+ * function: lockImage
+ *******************************************************************************
+ * Takes the lock of an image for reading or for writing, and reads the image
+ * in again if another process has changed it.
+ *
+ * The threads of the daemon share the image through its rwlock, and each
+ * request also takes a flock on the image file of its own, like any other
+ * tool, so other processes can write to the image between requests. Once the
+ * flock is held the size and modification time of the image file are checked
+ * against the ones it was read in with. Readers share the volume and index so
+ * only a writer may build them again; a reader that finds the image changed
+ * steps aside for a writer that does it and then starts over.
+ *
+ * @param	served_image *image	image to lock
+ * @param	bool write	true to hold the image alone
+ * @param	int *lock	set to the image file the flock is held through,
+ * 				-1 if the image could not be opened
+ * @param	char *error	set to why the image could not be read in again,
+ * 				must hold GEOMETRY_ERROR bytes
+ *
+ * @return	bool		true if the image is locked, false if it changed
+ * 				into one the daemon can't read and nothing is held
+ *
+ * @see				int replayJournal(char*, bool)
+ * @see				void reloadImage(served_image*)
+ ******************************************************************************/
+
+bool lockImage(served_image *image, bool write, int *lock, char *error) {
+	int result = write ? pthread_rwlock_wrlock(&image->lock) : pthread_rwlock_rdlock(&image->lock);
+
+	if(result != 0) {
+		fprintf(stderr, "ERROR: Failed to lock image\n");
+		exit(EXIT_FAILURE);
+	}
+
+	*lock = replayJournal(image->path, write);
+
+	if(imageChanged(image)) {
+		if(!write) {
+			unlockImage(image, *lock);
+			if(lockImage(image, true, lock, error)) unlockImage(image, *lock);
+			return lockImage(image, false, lock, error);
+		}
+
+		reloadImage(image);
+	}
+
+	if(!image->loaded) {
+		snprintf(error, GEOMETRY_ERROR, "%s", image->error);
+		unlockImage(image, *lock);
+		return false;
+	}
+
+	return true;
+}
+
+
+/*******************************************************************************
+ * function: sendAll
+ *******************************************************************************
+ * Writes a whole buffer to the client.
+ *
+ * @param	int client	socket of the client
+ * @param	char *buf	bytes to write
+ * @param	size_t bytes	number of bytes to write
+ *
+ * @return	bool		false if the client has gone away
+ ******************************************************************************/
+
+bool sendAll(int client, char *buf, size_t bytes) {
+	while(bytes > 0) {
+		ssize_t done = write(client, buf, bytes);
+		if(done <= 0) return false;
+
+		buf += done;
+		bytes -= done;
+	}
+
+	return true;
+}
+
+
+/*******************************************************************************
+ * function: sendError
+ *******************************************************************************
+ * Tells the client a request failed.
+ *
+ * @param	int client	socket of the client
+ * @param	char *message	why the request failed
+ *
+ * @return	bool		false if the client has gone away
+ ******************************************************************************/
+
+bool sendError(int client, char *message) {
+	char line[256];
+	int length = snprintf(line, sizeof(line), "ERR %s\n", message);
+
+	return sendAll(client, line, length);
+}
+
+
+/*******************************************************************************
+ * function: sendReport
+ *******************************************************************************
+ * Answers INFO and LIST with the report diskinfo or disklist would print.
+ *
+ * @param	int client	socket of the client
+ * @param	served_image *image	image the report is about
+ * @param	bool list	true for the listing, false for the information
+ *
+ * @return	bool		false if the client has gone away
+ *
+ * @see				void printInfo(FILE*, fat_volume*, dir_index*)
+ * @see				void printListing(FILE*, fat_volume*, list_format)
+ ******************************************************************************/
+
+bool sendReport(int client, served_image *image, bool list) {
+	char *report = NULL;
+	size_t length = 0;
+
+	int lock;
+	char error[GEOMETRY_ERROR];
+	if(!lockImage(image, false, &lock, error)) return sendError(client, error);
+
+	FILE *out = open_memstream(&report, &length);
+	if(out == NULL) {
+		unlockImage(image, lock);
+		return sendError(client, "Failed to allocate report");
+	}
+
+	if(list) printListing(out, &image->vol, LIST_TEXT);
+	else printInfo(out, &image->vol, &image->idx);
+	unlockImage(image, lock);
+
+	fclose(out);
+
+	char header[32];
+	int header_length = sprintf(header, "OK %zu\n", length);
+	bool sent = sendAll(client, header, header_length) && sendAll(client, report, length);
+
+	free(report);
+	return sent;
+}
+
+
+/*******************************************************************************
+ * function: sendFile
+ *******************************************************************************
+ * Answers GET with the contents of a file on the image.
+ *
+ * The file is sent one extent at a time straight from the image with sendfile
+ * and written out of the mapping if sendfile can't be used. The extents after
+ * the one being sent are advised so they are read ahead of it.
+ *
+ * @param	int client	socket of the client
+ * @param	served_image *image	image the file is on
+ * @param	char *name	file name or path of the file
+ *
+ * @return	bool		false if the client has gone away
+ *
+ * @see				int getExtents(fat_volume*, int, fat_extent**)
+ * @see				int readAhead(fat_volume*, fat_extent*, int, int, int)
+ ******************************************************************************/
+
+bool sendFile(int client, served_image *image, char *name) {
+	int lock;
+	char error[GEOMETRY_ERROR];
+	if(!lockImage(image, false, &lock, error)) return sendError(client, error);
+
+	fat_volume *vol = &image->vol;
+
+	//a path is looked up from the root, a plain name anywhere in the tree
+	int r;
+	if(strchr(name, '/') != NULL) r = findPath(&image->idx, name);
+	else r = findName(&image->idx, name);
+
+	if(r == -1 || (image->idx.records[r].attr & 0x10) != 0) {
+		unlockImage(image, lock);
+		return sendError(client, "File not found");
+	}
+
+	//a FAT32 file can be up to 4 GiB - 1 so the size doesn't fit an int
+	int64_t file_size = image->idx.records[r].size;
+	fat_extent *extents = NULL;
+	int count = (file_size > 0) ? getExtents(vol, image->idx.records[r].first_cluster, &extents) : 0;
+
+	char header[32];
+	int header_length = sprintf(header, "OK %lld\n", (long long)file_size);
+	bool sent = sendAll(client, header, header_length);
+
+	int i, advised = 0;
+	int64_t left = file_size;
+	for(i = 0; sent && i < count && left > 0; i++) {
+		advised = readAhead(vol, extents, count, i, advised);
+
+		off_t from = getClusterOffset(vol, extents[i].start);
+		size_t bytes = (size_t)extents[i].length * vol->cluster_size;
+		if(bytes > (size_t)left) bytes = left;
+		left -= bytes;
+
+		while(bytes > 0) {
+			ssize_t done = sendfile(client, image->fd, &from, bytes);
+			if(done <= 0) {
+				sent = sendAll(client, image->ptr + from, bytes);
+				break;
+			}
+
+			bytes -= done;
+		}
+	}
+
+	//a chain shorter than the file size is padded so the client still gets
+	//the length it was promised
+	char zeros[512] = {0};
+	while(sent && left > 0) {
+		int bytes = (left < (int64_t)sizeof(zeros)) ? (int)left : (int)sizeof(zeros);
+		sent = sendAll(client, zeros, bytes);
+		left -= bytes;
+	}
+
+	unlockImage(image, lock);
+	free(extents);
+	return sent;
+}
+
+
+/*******************************************************************************
+ * function: checkPutSize
+ *******************************************************************************
+ * Checks if a file of the size a PUT announced can go on the image.
+ *
+ * @param	served_image *image	image to put the file on
+ * @param	int64_t size	number of bytes of data that follow the PUT
+ * @param	char *error	set to why the file can't be put, must hold
+ * 				GEOMETRY_ERROR bytes
+ *
+ * @return	bool		true if the size fits a directory entry and the
+ * 				volume
+ *
+ * @see				put_status checkSize(fat_volume*, int64_t)
+ ******************************************************************************/
+
+bool checkPutSize(served_image *image, int64_t size, char *error) {
+	int lock;
+	if(!lockImage(image, false, &lock, error)) return false;
+
+	bool fits = checkSize(&image->vol, size) == PUT_OK;
+	unlockImage(image, lock);
+
+	if(!fits) snprintf(error, GEOMETRY_ERROR, "File too large");
+	return fits;
+}
+
+
+/*******************************************************************************
+ * function: receiveFile
+ *******************************************************************************
+ * Answers PUT by putting the data sent by the client on the image.
+ *
+ * The data is read before the image is locked so a slow client only holds up
+ * other writers for as long as the file takes to write.
+ *
+ * @param	int client	socket of the client
+ * @param	FILE *in	buffered reader of the client socket
+ * @param	served_image *image	image to put the file on
+ * @param	char *path	path of the new file on the image
+ * @param	int64_t size	number of bytes of data that follow
+ * @param	time_t mtime	modification time of the new file
+ *
+ * @return	bool		false if the client has gone away
+ *
+ * @see				put_status putFile(fat_volume*, dir_index*, int, int, char*, char*, int64_t, time_t)
+ * @see				void flushFAT(fat_volume*)
+ * @see				void commitJournal(fat_volume*)
+ ******************************************************************************/
+
+bool receiveFile(int client, FILE *in, served_image *image, char *path, int64_t size, time_t mtime) {
+	char *data = (size > 0) ? (char *)malloc(size) : NULL;
+	if(size > 0 && data == NULL) {
+		fprintf(stderr, "ERROR: Failed to allocate file\n");
+		exit(EXIT_FAILURE);
+	}
+
+	if(size > 0 && fread(data, 1, size, in) != (size_t)size) {
+		free(data);
+		return false;
+	}
+
+	char *filename = strrchr(path, '/');
+	char *dir_path = "";
+	if(filename == NULL) {
+		filename = path;
+	} else {
+		*filename++ = '\0';
+		dir_path = path;
+	}
+
+	int lock;
+	char error[GEOMETRY_ERROR];
+	if(!lockImage(image, true, &lock, error)) {
+		free(data);
+		return sendError(client, error);
+	}
+
+	if(!image->writable) {
+		unlockImage(image, lock);
+		free(data);
+		return sendError(client, "Disk image is read only");
+	}
+
+	int parent, dir_cluster;
+	put_status status = PUT_OK;
+	if(!findDirectory(&image->vol, &image->idx, dir_path, &parent, &dir_cluster)) {
+		unlockImage(image, lock);
+		free(data);
+		return sendError(client, "The directory not found");
+	}
+
+	status = putFile(&image->vol, &image->idx, parent, dir_cluster, filename, data, size, mtime);
+	if(status == PUT_OK) {
+		flushFAT(&image->vol);
+		commitJournal(&image->vol);
+
+		//the sidecar of the image no longer matches it so save it again
+		if(useSidecar()) saveIndex(&image->vol, &image->idx, image->path);
+	}
+
+	//the image file has moved on by the daemon's own write, which must not
+	//be taken for a change made by another process
+	uint64_t image_size = 0;
+	statImage(image->path, &image_size, &image->mtime);
+
+	unlockImage(image, lock);
+	free(data);
+
+	if(status == PUT_EXISTS) return sendError(client, "File already exists");
+	if(status == PUT_DIR_FULL) return sendError(client, "No space in directory");
+	if(status == PUT_NO_SPACE) return sendError(client, "Not enough free space in the disk image");
+	if(status == PUT_TOO_LARGE) return sendError(client, "File too large");
+
+	return sendAll(client, "OK 0\n", 5);
+}
+
+
+/*******************************************************************************
+ * function: serveClient
+ *******************************************************************************
+ * Answers every request of one client until it quits or goes away.
+ *
+ * @param	void *arg	pointer to the malloced socket of the client
+ *
+ * @return	void*		always NULL
+ ******************************************************************************/
+
+void *serveClient(void *arg) {
+	int client = *(int *)arg;
+	free(arg);
+
+	FILE *in = fdopen(client, "r");
+	if(in == NULL) {
+		close(client);
+		return NULL;
+	}
+
+	char line[MAX_LINE];
+	bool connected = true;
+	while(connected && fgets(line, sizeof(line), in) != NULL) {
+		line[strcspn(line, "\r\n")] = '\0';
+
+		char command[8], name[PATH_MAX];
+		long long size = 0;
+		int offset = strlen(line);
+		long mtime = 0;
+
+		if(sscanf(line, "%7s %n", command, &offset) < 1) {
+			connected = sendError(client, "Empty request");
+			continue;
+		}
+
+		if(strcmp(command, "QUIT") == 0) break;
+
+		bool get = strcmp(command, "GET") == 0;
+		bool put = strcmp(command, "PUT") == 0;
+
+		//GET and PUT name the file before the image
+		char *args = line + offset;
+		int skip = strlen(args);
+		if(get && sscanf(args, "%4095s %n", name, &skip) < 1) args = NULL;
+		else if(put && sscanf(args, "%lld %ld %4095s %n", &size, &mtime, name, &skip) < 3) args = NULL;
+		else if(!get && !put) skip = 0;
+
+		if(args == NULL || size < 0) {
+			//the data of a PUT can't be told apart from the next
+			//request so the connection has to be dropped
+			connected = sendError(client, "Malformed request");
+			if(put) break;
+			continue;
+		}
+
+		char error[GEOMETRY_ERROR];
+		served_image *image = getImage(args + skip, error);
+		//the size is checked before any of the data is read into memory
+		if(image != NULL && put && !checkPutSize(image, size, error)) image = NULL;
+
+		if(image == NULL) {
+			connected = sendError(client, error);
+			if(put) break;
+			continue;
+		}
+
+		if(strcmp(command, "INFO") == 0) connected = sendReport(client, image, false);
+		else if(strcmp(command, "LIST") == 0) connected = sendReport(client, image, true);
+		else if(get) connected = sendFile(client, image, name);
+		else if(put) connected = receiveFile(client, in, image, name, size, mtime);
+		else connected = sendError(client, "Unknown request");
+	}
+
+	fclose(in);
+	return NULL;
+}
+
+
+/*******************************************************************************
+ * function: stopDaemon
+ *******************************************************************************
+ * Removes the socket when the daemon is interrupted or terminated.
+ *
+ * @param	int sig		signal that stopped the daemon
+ *
+ * @return	void		no return value
+ ******************************************************************************/
+
+void stopDaemon(int sig) {
+	(void)sig;
+	unlink(socket_path);
+	_exit(EXIT_SUCCESS);
+}
+
+
+/*******************************************************************************
+ * function: main
+ *******************************************************************************
+ * Main execution for diskd.
+ *
+ * Listens on the given socket path and starts a thread for every client that
+ * connects.
+ *
+ * @param	int argc	number of arguments passed during execution
+ * @param	char *argv[]	vector of arguments passed during execution
+ *
+ * @return	int		N/A
+ ******************************************************************************/
+
+int main(int argc, char *argv[]) {
+	if(argc < 2) {
+		fprintf(stderr, "ERROR: Usage \"diskd <socket_path>\"\n");
+		exit(EXIT_FAILURE);
+	}
+
+	//images are always mapped, the backends only serve the readers
+	requireMapBackend(stderr, "diskd");
+
+	socket_path = argv[1];
+
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if(strlen(socket_path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "ERROR: Socket path too long\n");
+		exit(EXIT_FAILURE);
+	}
+	strcpy(addr.sun_path, socket_path);
+
+	int server = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(server < 0) {
+		fprintf(stderr, "ERROR: Failed to create socket\n");
+		exit(EXIT_FAILURE);
+	}
+
+	//a socket left behind by an earlier daemon would make bind fail
+	unlink(socket_path);
+	if(bind(server, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(server, SOMAXCONN) < 0) {
+		fprintf(stderr, "ERROR: Failed to listen on socket\n");
+		exit(EXIT_FAILURE);
+	}
+
+	//clients that go away mid response must not kill the daemon
+	signal(SIGPIPE, SIG_IGN);
+	signal(SIGINT, stopDaemon);
+	signal(SIGTERM, stopDaemon);
+
+	pthread_attr_t attr;
+	if(pthread_attr_init(&attr) != 0 || pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED) != 0) {
+		fprintf(stderr, "ERROR: Failed to initialize thread attributes\n");
+		exit(EXIT_FAILURE);
+	}
+
+	while(true) {
+		int client = accept(server, NULL, NULL);
+		if(client < 0) continue;
+
+		int *arg = (int *)malloc(sizeof(int));
+		if(arg == NULL) {
+			fprintf(stderr, "ERROR: Failed to allocate client\n");
+			exit(EXIT_FAILURE);
+		}
+		*arg = client;
+
+		pthread_t thread;
+		if(pthread_create(&thread, &attr, serveClient, arg) != 0) {
+			fprintf(stderr, "ERROR: Failed to create thread\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+}
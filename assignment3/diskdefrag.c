@@ -0,0 +1,655 @@
+/***** diskdefrag.c ************************************************************
+ * University of Victoria
+ * CSC 360 Fall 2018
+ * Italo Borrelli
+ * V00884840
+ *******************************************************************************
+ * diskdefrag.c is a source file that rewrites a FAT disk image so every file
+ * and directory is stored in one run of clusters.
+ *
+ * The new layout is planned from the decoded FAT before anything moves. The
+ * directory tree is walked once and the chains are laid out one after the
+ * other from the start of the data region, each directory followed by its
+ * files, then whatever chains no directory owns. Bad clusters are stepped
+ * over. The clusters are then put in place in order of where they go: the
+ * run of clusters that belongs at the next place is swapped with what is
+ * there, as many clusters as fit in the copy buffer at a time, so a file that
+ * is in a few large pieces moves in a few large copies. Last the chains are
+ * written to the FAT and every directory entry is pointed at the new first
+ * cluster of its file.
+ *
+ * A journaled run keeps every moved cluster in the journal, since the old
+ * clusters are overwritten in place, so a crash leaves the old layout or the
+ * new one but nothing in between.
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <string.h>
+
+#include "diskhelpers.h"
+#include "diskblock.h"
+#include "diskindex.h"
+#include "diskjournal.h"
+
+#define DEFRAG_BLOCK_BYTES 1048576	//most bytes moved by one copy
+
+
+/*******************************************************************************
+ * DEFRAG CHAIN
+ *******************************************************************************
+ * The chain of one file or directory found by the plan.
+ ******************************************************************************/
+
+typedef struct defrag_chain {
+	int first;			//first cluster of the chain before moving
+	int length;			//number of clusters of the chain
+} defrag_chain;
+
+
+/*******************************************************************************
+ * DEFRAG STATE
+ *******************************************************************************
+ * The plan of the new layout and where every cluster is while it is carried
+ * out. Clusters are named by where they were before anything moved.
+ ******************************************************************************/
+
+typedef struct defrag_state {
+	fat_volume *vol;		//volume being defragmented
+
+	int *order;			//every cluster in use, in the new order
+	int count;			//number of clusters in order
+	int *dest;			//where each cluster goes, -1 if not in use
+	int *loc;			//where each cluster is now
+	int *at;			//which cluster is now at each place, -1 if
+					//nothing is
+
+	uint64_t *scanned;		//one bit per cluster of a directory read
+
+	defrag_chain *chains;		//every file and directory chain
+	int chain_count;		//number of chains
+	int chain_capacity;		//number of chains allocated
+
+	int *stack;			//directories waiting to be walked
+	int stack_count;		//number of directories waiting
+	int stack_capacity;		//number of directories allocated
+
+	int64_t moved;			//number of clusters moved
+	int copies;			//number of copies made
+} defrag_state;
+
+
+/*******************************************************************************
+ * function: isLink
+ *******************************************************************************
+ * Checks if a FAT entry links to a cluster in use.
+ *
+ * @param	fat_volume *vol	volume context
+ * @param	int value	value of the FAT entry
+ *
+ * @return	bool		true if the value is a cluster in use
+ ******************************************************************************/
+
+static bool isLink(fat_volume *vol, int value) {
+	return value >= 2 && value < vol->num_entries && vol->fat[value] != 0x000 && vol->fat[value] != FAT_BAD;
+}
+
+
+/*******************************************************************************
+ * function: placeChain
+ *******************************************************************************
+ * Adds the clusters of a chain not yet placed to the end of the new order.
+ *
+ * A cluster is placed only once, so a cross-linked or cyclic chain stops at
+ * the first cluster already placed and keeps its links as they are.
+ *
+ * @param	defrag_state *state	plan being built
+ * @param	int cluster	first cluster of the chain
+ * @param	bool file	true to count the chain as a file or directory
+ *
+ * @return	void		no return value
+ ******************************************************************************/
+
+static void placeChain(defrag_state *state, int cluster, bool file) {
+	fat_volume *vol = state->vol;
+	int first = cluster, length = 0;
+
+	while(isLink(vol, cluster) && state->dest[cluster] == -1) {
+		state->dest[cluster] = state->count;
+		state->order[state->count++] = cluster;
+		length++;
+
+		cluster = vol->fat[cluster];
+	}
+
+	if(!file || length == 0) return;
+
+	if(state->chain_count == state->chain_capacity) {
+		state->chain_capacity *= 2;
+		state->chains = (defrag_chain *)realloc(state->chains, state->chain_capacity * sizeof(defrag_chain));
+		if(state->chains == NULL) {
+			printf("ERROR: Failed to allocate chains\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	state->chains[state->chain_count].first = first;
+	state->chains[state->chain_count].length = length;
+	state->chain_count++;
+}
+
+
+/*******************************************************************************
+ * function: pushDirectory
+ *******************************************************************************
+ * Leaves a directory on the stack to be walked.
+ *
+ * @param	defrag_state *state	state of the walk
+ * @param	int cluster	first cluster of the directory
+ *
+ * @return	void		no return value
+ ******************************************************************************/
+
+static void pushDirectory(defrag_state *state, int cluster) {
+	if(state->stack_count == state->stack_capacity) {
+		state->stack_capacity *= 2;
+		state->stack = (int *)realloc(state->stack, state->stack_capacity * sizeof(int));
+		if(state->stack == NULL) {
+			printf("ERROR: Failed to allocate directories\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	state->stack[state->stack_count++] = cluster;
+}
+
+
+/*******************************************************************************
+ * function: visitRange
+ *******************************************************************************
+ * Visits every entry in a byte range of a directory.
+ *
+ * While planning, the chain of every file is placed. Once the clusters have
+ * moved, every entry is pointed at the new first cluster of its file instead,
+ * the . and .. entries included. Either way the subdirectories are left on
+ * the stack.
+ *
+ * @param	defrag_state *state	state of the walk
+ * @param	int64_t offset	byte offset of the first entry of the range
+ * @param	int64_t end	byte offset right after the range
+ * @param	bool fix	true to point the entries at the new clusters
+ *
+ * @return	bool		false once the end of the directory is reached
+ ******************************************************************************/
+
+static bool visitRange(defrag_state *state, int64_t offset, int64_t end, bool fix) {
+	fat_volume *vol = state->vol;
+
+	for(; offset < end; offset += 0x20) {
+		char *entry = vol->ptr + offset;
+		int attr = entry[11] & 0xff;
+
+		//0x00 marks the end of the directory
+		if(entry[0] == 0x00) return false;
+
+		//skip deleted entries, long file names and volume labels
+		if((entry[0] & 0xff) == 0xe5 || attr == 0x0f || (attr & 0x08) != 0) continue;
+
+		int cluster = getEntryCluster(entry);
+		if(cluster < 2 || cluster >= vol->num_entries) continue;
+
+		//an entry pointing at a cluster that isn't in use is left alone
+		if(fix && state->dest[cluster] == -1) continue;
+
+		if(fix) {
+			cluster = state->dest[cluster];
+			setEntryCluster(entry, cluster);
+			markWritten(vol, offset, 0x20, true);
+		}
+
+		if(entry[0] == '.') continue;
+
+		if((attr & 0x10) != 0) pushDirectory(state, cluster);
+		else if(!fix) placeChain(state, cluster, true);
+	}
+
+	return true;
+}
+
+
+/*******************************************************************************
+ * function: walkDirectories
+ *******************************************************************************
+ * Walks every directory of the disk image, starting at the root.
+ *
+ * The chain of a directory is placed right before its files. Every cluster of
+ * a directory is read once at most, which ends a cyclic chain and a directory
+ * that contains its own ancestor.
+ *
+ * @param	defrag_state *state	state of the walk
+ * @param	bool fix	true to point the entries at the new clusters
+ *
+ * @return	void		no return value
+ *
+ * @see				bool visitRange(defrag_state*, int64_t, int64_t, bool)
+ ******************************************************************************/
+
+static void walkDirectories(defrag_state *state, bool fix) {
+	fat_volume *vol = state->vol;
+	int i;
+
+	memset(state->scanned, 0, ((vol->num_entries + 63) / 64) * sizeof(uint64_t));
+
+	if(vol->root_cluster == 0) {
+		int64_t offset = vol->root_sector_start * vol->bytes_per_sector;
+		visitRange(state, offset, offset + (int64_t)vol->sectors_for_root * vol->bytes_per_sector, fix);
+	} else {
+		pushDirectory(state, vol->root_cluster);
+	}
+
+	//the subdirectories of each directory are put on the stack in reverse
+	//so they are walked in the order of their entries
+	int mark = 0;
+	for(i = 0; i < state->stack_count / 2; i++) {
+		int swap = state->stack[i];
+		state->stack[i] = state->stack[state->stack_count - 1 - i];
+		state->stack[state->stack_count - 1 - i] = swap;
+	}
+
+	while(state->stack_count > 0) {
+		int cluster = state->stack[--state->stack_count];
+		if(!fix) placeChain(state, cluster, true);
+
+		mark = state->stack_count;
+
+		while(isLink(vol, cluster) && ((state->scanned[cluster / 64] >> (cluster % 64)) & 1) == 0) {
+			state->scanned[cluster / 64] |= (uint64_t)1 << (cluster % 64);
+
+			int64_t offset = getClusterOffset(vol, cluster);
+			if(!visitRange(state, offset, offset + vol->cluster_size, fix)) break;
+
+			cluster = vol->fat[cluster];
+		}
+
+		for(i = 0; i < (state->stack_count - mark) / 2; i++) {
+			int swap = state->stack[mark + i];
+			state->stack[mark + i] = state->stack[state->stack_count - 1 - i];
+			state->stack[state->stack_count - 1 - i] = swap;
+		}
+	}
+}
+
+
+/*******************************************************************************
+ * function: planLayout
+ *******************************************************************************
+ * Plans where every cluster in use goes.
+ *
+ * The chains are placed in the order of the walk, then every chain no
+ * directory owns in the order of the FAT. The clusters in that order are
+ * given the places from the start of the data region, stepping over bad
+ * clusters.
+ *
+ * @param	defrag_state *state	plan to build
+ *
+ * @return	void		no return value
+ ******************************************************************************/
+
+static void planLayout(defrag_state *state) {
+	fat_volume *vol = state->vol;
+	int n, i;
+
+	walkDirectories(state, false);
+
+	for(n = 2; n < vol->num_entries; n++) {
+		if(state->dest[n] == -1) placeChain(state, n, false);
+	}
+
+	//turn the order into places
+	n = 2;
+	for(i = 0; i < state->count; i++) {
+		while(vol->fat[n] == FAT_BAD) n++;
+		state->dest[state->order[i]] = n++;
+	}
+}
+
+
+/*******************************************************************************
+ * function: countExtents
+ *******************************************************************************
+ * Counts the runs of consecutive clusters in every chain, before or after the
+ * planned move.
+ *
+ * @param	defrag_state *state	plan of the new layout
+ * @param	bool after	true to count them in the new layout
+ * @param	int *fragmented	set to the number of chains of more than one run
+ *
+ * @return	int64_t		number of runs in every chain
+ ******************************************************************************/
+
+static int64_t countExtents(defrag_state *state, bool after, int *fragmented) {
+	fat_volume *vol = state->vol;
+	int64_t extents = 0;
+	int i, j;
+
+	*fragmented = 0;
+
+	for(i = 0; i < state->chain_count; i++) {
+		int cluster = state->chains[i].first, runs = 1;
+
+		for(j = 1; j < state->chains[i].length; j++) {
+			int next = vol->fat[cluster];
+			if(after ? state->dest[next] != state->dest[cluster] + 1 : next != cluster + 1) runs++;
+			cluster = next;
+		}
+
+		extents += runs;
+		if(runs > 1) (*fragmented)++;
+	}
+
+	return extents;
+}
+
+
+/*******************************************************************************
+ * function: moveClusters
+ *******************************************************************************
+ * Puts every cluster in the place planned for it.
+ *
+ * The places are filled in order. The longest run of clusters that belongs at
+ * the next place and sits together somewhere further on is swapped with what
+ * is at the place, through a buffer of DEFRAG_BLOCK_BYTES. Whatever was at the
+ * place goes to where the run was, to be moved again when its own place comes.
+ * A run that lands on free clusters is only copied.
+ *
+ * @param	defrag_state *state	plan of the new layout
+ *
+ * @return	void		no return value
+ ******************************************************************************/
+
+static void moveClusters(defrag_state *state) {
+	fat_volume *vol = state->vol;
+	int cs = vol->cluster_size;
+	int max_run = DEFRAG_BLOCK_BYTES / cs;
+	int i, j;
+
+	if(max_run < 1) max_run = 1;
+
+	char *buffer = (char *)malloc((size_t)max_run * cs);
+	if(buffer == NULL) {
+		printf("ERROR: Failed to allocate copy buffer\n");
+		exit(EXIT_FAILURE);
+	}
+
+	for(i = 0; i < state->count; i++) {
+		int cluster = state->order[i];
+		int place = state->dest[cluster];
+		int from = state->loc[cluster];
+		if(from == place) continue;
+
+		//everything before place is done so the run can only be further on
+		int run = 1;
+		while(run < max_run && i + run < state->count && place + run < from) {
+			int next = state->order[i + run];
+			if(state->dest[next] != place + run || state->loc[next] != from + run) break;
+			run++;
+		}
+
+		bool swap = false;
+		for(j = 0; j < run; j++) swap = swap || state->at[place + j] != -1;
+
+		char *dest = vol->ptr + getClusterOffset(vol, place);
+		char *src = vol->ptr + getClusterOffset(vol, from);
+		if(swap) memcpy(buffer, dest, (size_t)run * cs);
+		memcpy(dest, src, (size_t)run * cs);
+		if(swap) memcpy(src, buffer, (size_t)run * cs);
+
+		//the data moves in place so a journal has to hold all of it
+		markWritten(vol, getClusterOffset(vol, place), (int64_t)run * cs, true);
+		if(swap) markWritten(vol, getClusterOffset(vol, from), (int64_t)run * cs, true);
+
+		for(j = 0; j < run; j++) {
+			int displaced = state->at[place + j];
+			int moving = state->order[i + j];
+
+			state->at[place + j] = moving;
+			state->loc[moving] = place + j;
+
+			state->at[from + j] = displaced;
+			if(displaced != -1) state->loc[displaced] = from + j;
+		}
+
+		state->moved += run;
+		state->copies++;
+		i += run - 1;
+	}
+
+	free(buffer);
+}
+
+
+/*******************************************************************************
+ * function: writeChains
+ *******************************************************************************
+ * Writes every chain to the FAT in the new layout. A link to a cluster that
+ * isn't in use has nowhere to go and ends its chain instead.
+ *
+ * @param	defrag_state *state	plan of the new layout
+ *
+ * @return	void		no return value
+ ******************************************************************************/
+
+static void writeChains(defrag_state *state) {
+	fat_volume *vol = state->vol;
+	int n;
+
+	fat_entry_t *fat = (fat_entry_t *)calloc(vol->num_entries, sizeof(fat_entry_t));
+	if(fat == NULL) {
+		printf("ERROR: Failed to allocate FAT\n");
+		exit(EXIT_FAILURE);
+	}
+
+	for(n = 2; n < vol->num_entries; n++) {
+		int value = vol->fat[n];
+
+		if(value == FAT_BAD) fat[n] = FAT_BAD;
+		else if(state->dest[n] == -1) continue;
+		else if(isLink(vol, value)) fat[state->dest[n]] = state->dest[value];
+		else if(isEndOfChain(value)) fat[state->dest[n]] = value;
+		else fat[state->dest[n]] = FAT_EOC;
+	}
+
+	for(n = 2; n < vol->num_entries; n++) {
+		if(vol->fat[n] != fat[n]) setFAT(vol, n, fat[n]);
+	}
+
+	free(fat);
+}
+
+
+/*******************************************************************************
+ * function: moveRoot
+ *******************************************************************************
+ * Points the boot sector, and its backup, at the new first cluster of a
+ * FAT32 root directory.
+ *
+ * @param	defrag_state *state	plan of the new layout
+ *
+ * @return	void		no return value
+ ******************************************************************************/
+
+static void moveRoot(defrag_state *state) {
+	fat_volume *vol = state->vol;
+	if(vol->root_cluster == 0 || state->dest[vol->root_cluster] == vol->root_cluster) return;
+
+	int root = state->dest[vol->root_cluster];
+	int backup = (vol->ptr[50] & 0xff) | (vol->ptr[51] & 0xff) << 8;
+	int64_t offsets[2] = {44, (int64_t)backup * vol->bytes_per_sector + 44};
+	int i;
+
+	//a backup boot sector is only kept when its sector is given
+	for(i = 0; i < ((backup != 0 && backup != 0xffff && backup < vol->num_reserved_sectors) ? 2 : 1); i++) {
+		vol->ptr[offsets[i]] = root & 0xff;
+		vol->ptr[offsets[i]+1] = (root >> 8) & 0xff;
+		vol->ptr[offsets[i]+2] = (root >> 16) & 0xff;
+		vol->ptr[offsets[i]+3] = (root >> 24) & 0xff;
+		markWritten(vol, offsets[i], 4, true);
+	}
+
+	vol->root_cluster = root;
+}
+
+
+/*******************************************************************************
+ * function: main
+ *******************************************************************************
+ * Main execution for diskdefrag.
+ *
+ * Plans the new layout and prints how fragmented the image is before and
+ * after it. Unless -n is given the layout is then carried out and committed
+ * like diskput commits a batch.
+ *
+ * @param	int argc	number of arguments passed during execution
+ * @param	char *argv[]	vector of arguments passed during execution
+ *
+ * @return	int		N/A
+ *
+ * @see				diskhelpers.h
+ * @see				void planLayout(defrag_state*)
+ * @see				void moveClusters(defrag_state*)
+ * @see				void writeChains(defrag_state*)
+ ******************************************************************************/
+
+int main(int argc, char *argv[]) {
+	bool dry_run = false;
+	int opt;
+	while((opt = getopt(argc, argv, "n")) != -1) {
+		if(opt == 'n') dry_run = true;
+		else {
+			//an unknown option falls through to the usage
+			optind = argc;
+			break;
+		}
+	}
+
+	if(optind >= argc) {
+		printf("ERROR: Usage \"diskdefrag [-n] <disk_image>\"\n");
+		exit(EXIT_FAILURE);
+	}
+
+	char *image_path = argv[optind];
+
+	//the image is always mapped, the backends only serve the readers
+	requireMapBackend(stdout, "diskdefrag");
+
+	//finish a batch a writer committed but did not get to apply, the image
+	//stays locked until the tool is done with it, exclusively if it writes
+	int lock = replayJournal(image_path, !dry_run);
+
+	int fd = open(image_path, dry_run ? O_RDONLY : O_RDWR);
+	if(fd < 0) {
+		printf("ERROR: Open failed\n");
+		exit(EXIT_FAILURE);
+	}
+
+	//create buffer for file statistics
+	struct stat buff;
+	fstat(fd, &buff);
+
+	//copy on write when journaled so nothing reaches the image before it is
+	//committed
+	bool journaled = !dry_run && useJournal();
+	char *ptr = mmap(0, buff.st_size, dry_run ? PROT_READ : PROT_READ|PROT_WRITE, journaled ? MAP_PRIVATE : MAP_SHARED, fd, 0);
+
+	if(ptr == MAP_FAILED) {
+		printf("ERROR: Failed to map file\n");
+		exit(EXIT_FAILURE);
+	}
+
+	//the FAT is always decoded from the image, never taken from a sidecar
+	fat_volume vol;
+	getBasicInfo(&vol, ptr);
+	if(journaled) openJournal(&vol, fd, image_path);
+
+	defrag_state state;
+	memset(&state, 0, sizeof(state));
+	state.vol = &vol;
+	state.chain_capacity = 1024;
+	state.stack_capacity = 64;
+	state.order = (int *)malloc(vol.num_entries * sizeof(int));
+	state.dest = (int *)malloc(vol.num_entries * sizeof(int));
+	state.scanned = (uint64_t *)calloc((vol.num_entries + 63) / 64, sizeof(uint64_t));
+	state.chains = (defrag_chain *)malloc(state.chain_capacity * sizeof(defrag_chain));
+	state.stack = (int *)malloc(state.stack_capacity * sizeof(int));
+
+	if(state.order == NULL || state.dest == NULL || state.scanned == NULL || state.chains == NULL || state.stack == NULL) {
+		printf("ERROR: Failed to allocate plan\n");
+		exit(EXIT_FAILURE);
+	}
+
+	int n;
+	for(n = 0; n < vol.num_entries; n++) state.dest[n] = -1;
+
+	planLayout(&state);
+
+	int before_fragmented, after_fragmented;
+	int64_t before = countExtents(&state, false, &before_fragmented);
+	int64_t after = countExtents(&state, true, &after_fragmented);
+
+	printf("Before: %d of %d files and directories fragmented, %lld extents\n", before_fragmented, state.chain_count, (long long)before);
+	printf("After:  %d of %d files and directories fragmented, %lld extents\n", after_fragmented, state.chain_count, (long long)after);
+
+	if(!dry_run) {
+		state.loc = (int *)malloc(vol.num_entries * sizeof(int));
+		state.at = (int *)malloc(vol.num_entries * sizeof(int));
+		if(state.loc == NULL || state.at == NULL) {
+			printf("ERROR: Failed to allocate plan\n");
+			exit(EXIT_FAILURE);
+		}
+
+		for(n = 0; n < vol.num_entries; n++) {
+			state.loc[n] = n;
+			state.at[n] = (state.dest[n] == -1) ? -1 : n;
+		}
+
+		moveClusters(&state);
+		writeChains(&state);
+		moveRoot(&state);
+
+		//the directories are read through the new FAT from here on, and
+		//their entries still name the old clusters
+		walkDirectories(&state, true);
+
+		flushFAT(&vol);
+		commitJournal(&vol);
+
+		printf("Moved %lld clusters in %d copies\n", (long long)state.moved, state.copies);
+
+		//the sidecar of the image no longer matches it so save it again
+		if(useSidecar()) {
+			dir_index idx;
+			buildIndex(&vol, &idx);
+			saveIndex(&vol, &idx, image_path);
+			freeIndex(&idx);
+		}
+	}
+
+	free(state.order);
+	free(state.dest);
+	free(state.loc);
+	free(state.at);
+	free(state.scanned);
+	free(state.chains);
+	free(state.stack);
+	closeJournal(&vol);
+	freeVolume(&vol);
+	munmap(ptr, buff.st_size);
+	close(fd);
+	close(lock);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,786 @@
+/***** diskformat.c ************************************************************
+ * University of Victoria
+ * CSC 360 Fall 2018
+ * Italo Borrelli
+ * V00884840
+ *******************************************************************************
+ * diskformat.c is a source file that contains the reports printed about a
+ * FAT disk image: the general information printed by diskinfo and the
+ * directory listing printed by disklist.
+ *
+ * Every report is printed to a given stream so diskd can send the same output
+ * to its clients that the tools print to stdout.
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "diskformat.h"
+
+
+/*******************************************************************************
+ * function: getOSName
+ *******************************************************************************
+ * Modifies os_name to the OS name in disk image.
+ *
+ * Copies the OS name from the boot sector to os_name.
+ *
+ * @param	char *ptr	a pointer to the first byte of the fs image
+ * @param	char *os_name	pointer to char array to modify
+ *
+ * @return	void		no return value
+ ******************************************************************************/
+
+void getOSName(char *ptr, char *os_name) {
+	int i;
+
+	for(i = 0; i < 8; i++) {
+		os_name[i] = ptr[i+3];
+	}
+}
+
+
+/*******************************************************************************
+ * function: getDiskLabel
+ *******************************************************************************
+ * Modifies label to the disk label in disk image.
+ *
+ * Copies the disk label from the boot sector to the label char array. If the
+ * label is not in the boot sector it is searched for in the root directory.
+ *
+ * @param	fat_volume *vol	volume context
+ * @param	char *label	pointer to char array to modify
+ *
+ * @return	void		no return value
+ *
+ * @see				diskhelpers.h
+ ******************************************************************************/
+
+void getDiskLabel(fat_volume *vol, char *label) {
+	char buf[512];
+	char *ptr = readImage(vol, 0, sizeof(buf), buf);
+
+	//try to get label from boot sector at offset 43 for 8 bytes, FAT32
+	//moves it to offset 71
+	int i, label_start = (vol->root_cluster == 0) ? 43 : 71;
+	for(i = 0; i < 8; i++) {
+		label[i] = ptr[i+label_start];
+	}
+
+	//if label not found try to find it in the root sector, the first
+	//cluster of a FAT32 root
+	if(label[0] == ' ') {
+		int64_t directory_start = vol->root_sector_start * vol->bytes_per_sector;
+		int64_t root_end = (vol->root_cluster == 0) ?
+			(int64_t)vol->data_sector_start * vol->bytes_per_sector :
+			directory_start + vol->cluster_size;
+		char *entry;
+		while(directory_start < root_end && (entry = readImage(vol, directory_start, 0x20, buf))[0] != 0x00) {
+			//0x08 at position 11 in directory identifies a label
+			if(entry[11] == 0x08) {
+				for(i = 0; i < 8; i++) {
+					label[i] = entry[i];
+				}
+
+				break;
+			}
+
+			//go to start of next directory entry
+			directory_start += 0x20;
+		}
+	}
+}
+
+
+/*******************************************************************************
+ * function: getFileCount
+ *******************************************************************************
+ * Number of files on the disk.
+ *
+ * Counts the entries of the directory index that are neither subdirectories
+ * nor volume labels.
+ *
+ * @param	dir_index *idx	directory index of the disk image
+ *
+ * @return	int		number of files on the disk
+ *
+ * @see				diskindex.h
+ ******************************************************************************/
+
+int getFileCount(dir_index *idx) {
+	int count = 0, r;
+
+	for(r = 0; r < idx->count; r++) {
+		if((idx->records[r].attr & 0x18) == 0) count++;
+	}
+
+	return count;
+}
+
+
+/*******************************************************************************
+ * function: flushListing
+ *******************************************************************************
+ * Writes out everything in the listing buffer.
+ *
+ * @param	list_output *list	listing being printed
+ *
+ * @return	void		no return value
+ ******************************************************************************/
+
+static void flushListing(list_output *list) {
+	fwrite(list->buf, 1, list->length, list->out);
+	list->length = 0;
+}
+
+
+/*******************************************************************************
+ * function: putNumber
+ *******************************************************************************
+ * Writes a number in decimal.
+ *
+ * @param	char *dest	where to write the digits
+ * @param	uint64_t value	number to write
+ *
+ * @return	char*		the byte after the last digit
+ ******************************************************************************/
+
+static char *putNumber(char *dest, uint64_t value) {
+	char digits[20];
+	int length = 0;
+
+	do {
+		digits[length++] = '0' + value % 10;
+		value /= 10;
+	} while(value > 0);
+
+	while(length > 0) *dest++ = digits[--length];
+	return dest;
+}
+
+
+/*******************************************************************************
+ * function: putTwoDigits
+ *******************************************************************************
+ * Writes a number below 100 as two digits, e.g. 07.
+ *
+ * @param	char *dest	where to write the digits
+ * @param	int value	number to write
+ *
+ * @return	char*		the byte after the last digit
+ ******************************************************************************/
+
+static char *putTwoDigits(char *dest, int value) {
+	dest[0] = '0' + (value / 10) % 10;
+	dest[1] = '0' + value % 10;
+	return dest + 2;
+}
+
+
+/*******************************************************************************
+ * function: putTimestamp
+ *******************************************************************************
+ * Writes a FAT date and time as YYYY-MM-DD, the separator and HH:MM:SS.
+ *
+ * @param	char *dest	where to write the timestamp
+ * @param	unsigned char *stamp	time, the two bytes before the date in a
+ * 				directory entry
+ * @param	char separator	put between the date and the time
+ *
+ * @return	char*		the byte after the timestamp
+ ******************************************************************************/
+
+static char *putTimestamp(char *dest, unsigned char *stamp, char separator) {
+	int time = stamp[0] + (stamp[1] << 8);
+	int date = stamp[2] + (stamp[3] << 8);
+
+	dest = putNumber(dest, ((date & 0xfe00) >> 9) + 1980);
+	*dest++ = '-';
+	dest = putTwoDigits(dest, (date & 0x01e0) >> 5);
+	*dest++ = '-';
+	dest = putTwoDigits(dest, date & 0x001f);
+	*dest++ = separator;
+	dest = putTwoDigits(dest, (time & 0xf800) >> 11);
+	*dest++ = ':';
+	dest = putTwoDigits(dest, (time & 0x07e0) >> 5);
+	*dest++ = ':';
+	return putTwoDigits(dest, (time & 0x001f) * 2);
+}
+
+
+/*******************************************************************************
+ * function: putJSONString
+ *******************************************************************************
+ * Writes bytes as a quoted JSON string.
+ *
+ * Bytes above 0x7f are taken to be Latin-1 so the output is always valid
+ * UTF-8 whatever code page the names on the disk were written in.
+ *
+ * @param	char *dest	where to write the string
+ * @param	char *src	bytes to write
+ * @param	int length	number of bytes to write
+ *
+ * @return	char*		the byte after the closing quote
+ ******************************************************************************/
+
+static char *putJSONString(char *dest, char *src, int length) {
+	static const char hex[] = "0123456789abcdef";
+	int i;
+
+	*dest++ = '"';
+	for(i = 0; i < length; i++) {
+		unsigned char c = src[i];
+
+		if(c == '"' || c == '\\') {
+			*dest++ = '\\';
+			*dest++ = c;
+		} else if(c < 0x20 || c > 0x7e) {
+			memcpy(dest, "\\u00", 4);
+			dest[4] = hex[c >> 4];
+			dest[5] = hex[c & 0xf];
+			dest += 6;
+		} else {
+			*dest++ = c;
+		}
+	}
+	*dest++ = '"';
+
+	return dest;
+}
+
+
+/*******************************************************************************
+ * function: printDirectory
+ *******************************************************************************
+ * Prints all values of the given directory entry
+ *
+ * The line is formatted straight into the listing buffer without printf or any
+ * allocation. As text it is the type, size, name and creation time in a human
+ * readable format. As NDJSON it is one object with the full path, type, size,
+ * first cluster and the creation, modification and access times.
+ *
+ * @param	list_output *list	listing being printed
+ * @param	char *entry	pointer to the first byte of the directory entry
+ *
+ * @return	void		no return value
+ *
+ * @see				void formatName(char*, char*)
+ ******************************************************************************/
+
+void printDirectory(list_output *list, char *entry) {
+	unsigned char *bytes = (unsigned char *)entry;
+	bool directory = (entry[11] & 0x10) != 0;
+	uint32_t size = bytes[28] + (bytes[29] << 8) + (bytes[30] << 16) + ((uint32_t)bytes[31] << 24);
+
+	if(list->length + LIST_LINE_MAX > LIST_BUFFER_SIZE) flushListing(list);
+	char *dest = list->buf + list->length;
+	int i;
+
+	if(list->format == LIST_NDJSON) {
+		char name[13];
+		formatName(entry, name);
+
+		char path[LIST_PATH_MAX + 14];
+		int path_length = list->path_length;
+		memcpy(path, list->path, path_length);
+		if(path_length > 0) path[path_length++] = '/';
+		strcpy(path + path_length, name);
+
+		dest = putJSONString((char *)memcpy(dest, "{\"path\":", 8) + 8, path, strlen(path));
+		dest = (char *)memcpy(dest, ",\"type\":", 8) + 8;
+		dest = putJSONString(dest, directory ? "directory" : "file", directory ? 9 : 4);
+		dest = putNumber((char *)memcpy(dest, ",\"size\":", 8) + 8, size);
+		dest = putNumber((char *)memcpy(dest, ",\"first_cluster\":", 17) + 17, getEntryCluster(entry));
+		dest = (char *)memcpy(dest, ",\"created\":\"", 12) + 12;
+		dest = putTimestamp(dest, bytes + 14, 'T');
+		dest = (char *)memcpy(dest, "\",\"modified\":\"", 14) + 14;
+		dest = putTimestamp(dest, bytes + 22, 'T');
+		dest = (char *)memcpy(dest, "\",\"accessed\":\"", 14) + 14;
+
+		//only a date is kept for the last access
+		int date = bytes[18] + (bytes[19] << 8);
+		dest = putNumber(dest, ((date & 0xfe00) >> 9) + 1980);
+		*dest++ = '-';
+		dest = putTwoDigits(dest, (date & 0x01e0) >> 5);
+		*dest++ = '-';
+		dest = putTwoDigits(dest, date & 0x001f);
+		dest = (char *)memcpy(dest, "\"}\n", 3) + 3;
+	} else {
+		//F for file, D for directory
+		*dest++ = directory ? 'D' : 'F';
+		*dest++ = ' ';
+
+		char *start = dest;
+		dest = putNumber(dest, size);
+		while(dest - start < 10) *dest++ = ' ';
+		*dest++ = ' ';
+
+		//the name and extension without padding, joined by a period for
+		//files, padded to 20 characters
+		start = dest;
+		for(i = 0; i < 8 && entry[i] != ' '; i++) *dest++ = entry[i];
+		if(!directory || entry[8] != ' ') *dest++ = '.';
+		for(i = 8; i < 11 && entry[i] != ' '; i++) *dest++ = entry[i];
+		while(dest - start < 20) *dest++ = ' ';
+		*dest++ = ' ';
+
+		dest = putTimestamp(dest, bytes + 14, ' ');
+		*dest++ = '\n';
+	}
+
+	list->length = dest - list->buf;
+}
+
+
+/*******************************************************************************
+ * function: listChain
+ *******************************************************************************
+ * Lists a directory stored in a cluster chain, sector by sector, until the
+ * rest of the directory is free or the chain ends.
+ *
+ * The chain is merged into extents so the clusters further down it can be
+ * read ahead of the sector being listed.
+ *
+ * @param	list_output *list	listing being printed
+ * @param	fat_volume *vol	volume context
+ * @param	int fat_entry	first cluster of the directory
+ *
+ * @return	void		no return value
+ *
+ * @see				int getExtents(fat_volume*, int, fat_extent**)
+ * @see				int readAhead(fat_volume*, fat_extent*, int, int, int)
+ * @see				void listFiles(list_output*, fat_volume*, int64_t, bool*)
+ ******************************************************************************/
+
+void listChain(list_output *list, fat_volume *vol, int fat_entry) {
+	bool rest_free = false;
+	int64_t i, last;
+
+	fat_extent *extents;
+	int count = getExtents(vol, fat_entry, &extents);
+	int e, advised = 0;
+
+	for(e = 0; e < count && !rest_free; e++) {
+		advised = readAhead(vol, extents, count, e, advised);
+
+		i = getSectorNum(vol, extents[e].start);
+		last = i + (int64_t)extents[e].length * vol->sectors_per_cluster;
+		for(; i < last && !rest_free; i++) listFiles(list, vol, i, &rest_free);
+	}
+
+	free(extents);
+}
+
+
+/*******************************************************************************
+ * function: listFiles
+ *******************************************************************************
+ * Finds all files and directories in the directory and all sub-directories.
+ *
+ * Finds all directories and prints them then hands every sub-directory to the
+ * walk to be explored. Volume labels, long name entries and deleted entries
+ * are skipped.
+ *
+ * @param	list_output *list	listing being printed
+ * @param	fat_volume *vol	volume context
+ * @param	int64_t sector_num	sector number of directory
+ * @param	bool *rest_free	ptr identifying if free directory is reached
+ *
+ * @return	void		no return value
+ *
+ * @see				diskhelpers.h
+ * @see				void printDirectory(list_output*, char*)
+ * @see				tree_dir *treeChild(tree_walk*, tree_dir*, char*, int)
+ ******************************************************************************/
+
+void listFiles(list_output *list, fat_volume *vol, int64_t sector_num, bool *rest_free) {
+	char buf[MAX_SECTOR_SIZE];
+	unsigned char *ptr = (unsigned char *)readImage(vol, sector_num * vol->bytes_per_sector, vol->bytes_per_sector, buf);
+
+	//offsets are from the start of the sector
+	int directory_start = 0;
+	int sector_end = vol->bytes_per_sector;
+
+	//loop until not an empty directory and not out of current sector
+	while(directory_start < sector_end && ptr[directory_start] != 0x00) {
+		int attr = ptr[directory_start + 11];
+		int fat_entry = getEntryCluster((char *)ptr + directory_start);
+
+		//a volume label, deleted entry or a directory pointing at the
+		//root or a reserved entry isn't listed, an empty file is
+		bool listed = (attr & 0x08) == 0 && ptr[directory_start] != 0xe5 &&
+			(fat_entry > 1 || ((attr & 0x10) == 0 && fat_entry == 0));
+
+		//the dot entries are left out of NDJSON, every line is a real
+		//file or directory
+		if(listed && !(list->format == LIST_NDJSON && ptr[directory_start] == '.')) {
+			printDirectory(list, (char *)ptr + directory_start);
+		}
+
+		directory_start += 0x20;
+	}
+
+	//identify that the end of the directory entries has been reached
+	if(directory_start < sector_end) *rest_free = true;
+
+	//reset directory_start value to start of directory sector
+	directory_start = 0;
+
+	while(directory_start < sector_end && ptr[directory_start] != 0x00) {
+		int attr = ptr[directory_start+11];
+		int fat_entry = getEntryCluster((char *)ptr + directory_start);
+
+		//explore if a directory that doesn't start with a . and isn't
+		//deleted
+		if((attr & 0x10) != 0 && (attr & 0x08) == 0 && ptr[directory_start] != '.' && ptr[directory_start] != 0xe5 && fat_entry > 1) {
+			//a directory nested deeper than a path can hold is not
+			//explored, which also ends a loop of directories
+			if(list->dir->depth + 1 > list->walk->max_depth) {
+				directory_start += 0x20;
+				continue;
+			}
+
+			//print the name of the directory as it is in the entry
+			if(list->format == LIST_TEXT) {
+				if(list->length + LIST_LINE_MAX > LIST_BUFFER_SIZE) flushListing(list);
+				char *dest = list->buf + list->length;
+				*dest++ = '\n';
+				dest = (char *)memcpy(dest, ptr + directory_start, 8) + 8;
+				dest = (char *)memcpy(dest, "\n==================\n", 20) + 20;
+				list->length = dest - list->buf;
+			}
+
+			//the sub-directory is listed by whichever thread gets
+			//to it and merged in here once the walk is over
+			flushListing(list);
+			treeChild(list->walk, list->dir, (char *)ptr + directory_start, list->worker);
+		}
+
+		//go to start of next directory entry
+		directory_start += 0x20;
+	}
+}
+
+
+/*******************************************************************************
+ * function: printInfo
+ *******************************************************************************
+ * Prints general information about the disk image.
+ *
+ * @param	FILE *out	stream to print to
+ * @param	fat_volume *vol	volume context
+ * @param	dir_index *idx	directory index of the disk image
+ *
+ * @return	void		no return value
+ *
+ * @see				diskformat.h
+ * @see				void getOSName(char*, char*)
+ * @see				void getDiskLabel(fat_volume*, char*)
+ * @see				int getFileCount(dir_index*)
+ * @see				int64_t getFreeSpace(fat_volume*)
+ ******************************************************************************/
+
+void printInfo(FILE *out, fat_volume *vol, dir_index *idx) {
+	char boot[512];
+	char os_name[9] = {0};
+	getOSName(readImage(vol, 0, sizeof(boot), boot), os_name);
+
+	char label[9] = {0};
+	getDiskLabel(vol, label);
+
+	int file_count = getFileCount(idx);
+
+	//print all info
+	fprintf(out, "OS name:                    %s\n", os_name);
+	fprintf(out, "Disk label:                 %s\n", label);
+	fprintf(out, "Size of disk:               %lld bytes\n", (long long)vol->sector_count * vol->bytes_per_sector);
+	fprintf(out, "Free size of disk:          %lld bytes\n\n", (long long)getFreeSpace(vol));
+	fprintf(out, "============================================\n");
+	fprintf(out, "Number of files on disk:    %d\n\n", file_count);
+	fprintf(out, "============================================\n");
+	fprintf(out, "Number of FAT copies:       %d\n", vol->num_fats);
+	fprintf(out, "Sectors per FAT:            %d\n", vol->sectors_per_fat);
+}
+
+
+/*******************************************************************************
+ * function: getBucket
+ *******************************************************************************
+ * Finds the histogram bucket of an extent, the power of two at or below its
+ * length.
+ *
+ * @param	int length	number of clusters in the extent
+ *
+ * @return	int		bucket of the extent
+ ******************************************************************************/
+
+static int getBucket(int length) {
+	int bucket = 0;
+
+	while(length > 1 && bucket < LAYOUT_BUCKETS - 1) {
+		length >>= 1;
+		bucket++;
+	}
+
+	return bucket;
+}
+
+
+/*******************************************************************************
+ * function: formatBucket
+ *******************************************************************************
+ * Writes the range of extent lengths of a histogram bucket, e.g. "4-7".
+ *
+ * @param	int bucket	bucket to write
+ * @param	char *range	char array of at least 32 bytes to modify
+ *
+ * @return	void		no return value
+ ******************************************************************************/
+
+static void formatBucket(int bucket, char *range) {
+	if(bucket == 0) strcpy(range, "1");
+	else if(bucket == LAYOUT_BUCKETS - 1) sprintf(range, "%lld+", 1LL << bucket);
+	else sprintf(range, "%lld-%lld", 1LL << bucket, (1LL << (bucket + 1)) - 1);
+}
+
+
+/*******************************************************************************
+ * function: printLayout
+ *******************************************************************************
+ * Prints how the files and the free space of the disk image are laid out.
+ *
+ * The chain of every file and directory in the index is split into extents,
+ * runs of consecutive clusters, and the FAT is read once for the free
+ * extents. The extent lengths of both are counted in a histogram with a
+ * bucket per power of two. The free space fragmentation is the part of the
+ * free space outside the largest free extent, 0% when all of it is in one
+ * piece. The files in the most extents are printed last with a histogram of
+ * their own. Empty files have no clusters and are left out.
+ *
+ * @param	FILE *out	stream to print to
+ * @param	fat_volume *vol	volume context
+ * @param	dir_index *idx	directory index of the disk image
+ *
+ * @return	void		no return value
+ *
+ * @see				diskformat.h
+ * @see				int getExtents(fat_volume*, int, fat_extent**)
+ ******************************************************************************/
+
+void printLayout(FILE *out, fat_volume *vol, dir_index *idx) {
+	int64_t used[LAYOUT_BUCKETS] = {0}, used_clusters[LAYOUT_BUCKETS] = {0};
+	int64_t free_extents[LAYOUT_BUCKETS] = {0}, free_clusters[LAYOUT_BUCKETS] = {0};
+	int top[LAYOUT_TOP], top_extents[LAYOUT_TOP], top_count = 0;
+	int64_t extents = 0;
+	int chains = 0, fragmented = 0;
+	int r, i, n;
+
+	for(r = 0; r < idx->count; r++) {
+		if(idx->records[r].first_cluster < 2) continue;
+
+		fat_extent *list;
+		int count = getExtents(vol, idx->records[r].first_cluster, &list);
+
+		for(i = 0; i < count; i++) {
+			used[getBucket(list[i].length)]++;
+			used_clusters[getBucket(list[i].length)] += list[i].length;
+		}
+
+		free(list);
+
+		chains++;
+		extents += count;
+		if(count < 2) continue;
+
+		fragmented++;
+
+		//keep the most fragmented files in order, the first found first
+		//among files in as many extents
+		for(i = top_count; i > 0 && top_extents[i-1] < count; i--) {
+			if(i < LAYOUT_TOP) {
+				top[i] = top[i-1];
+				top_extents[i] = top_extents[i-1];
+			}
+		}
+
+		if(i < LAYOUT_TOP) {
+			top[i] = r;
+			top_extents[i] = count;
+			if(top_count < LAYOUT_TOP) top_count++;
+		}
+	}
+
+	//one pass over the FAT for the runs of free clusters
+	int largest = 0, run = 0, free_count = 0;
+	for(n = 2; n <= vol->num_entries; n++) {
+		if(n < vol->num_entries && vol->fat[n] == 0x000) {
+			run++;
+			continue;
+		}
+
+		if(run == 0) continue;
+
+		free_extents[getBucket(run)]++;
+		free_clusters[getBucket(run)] += run;
+		free_count += run;
+		if(run > largest) largest = run;
+		run = 0;
+	}
+
+	int64_t free_runs = 0;
+	for(i = 0; i < LAYOUT_BUCKETS; i++) free_runs += free_extents[i];
+
+	fprintf(out, "\n============================================\n");
+	fprintf(out, "Files and directories:      %d\n", chains);
+	fprintf(out, "Fragmented:                 %d\n", fragmented);
+	fprintf(out, "Extents:                    %lld\n", (long long)extents);
+	fprintf(out, "Free extents:               %lld\n", (long long)free_runs);
+	fprintf(out, "Largest free extent:        %lld bytes\n", (long long)largest * vol->cluster_size);
+	fprintf(out, "Free space fragmentation:   %d%%\n\n", (free_count == 0) ? 0 : (int)(100 - (int64_t)largest * 100 / free_count));
+
+	//the histogram goes up to the longest extent of either kind
+	int last = 0;
+	for(i = 0; i < LAYOUT_BUCKETS; i++) {
+		if(used[i] != 0 || free_extents[i] != 0) last = i;
+	}
+
+	char range[32];
+	fprintf(out, "Extent length   Extents   Clusters   Free extents   Free clusters\n");
+	for(i = 0; i <= last; i++) {
+		formatBucket(i, range);
+		fprintf(out, "%-15s %-9lld %-10lld %-14lld %lld\n", range, (long long)used[i], (long long)used_clusters[i], (long long)free_extents[i], (long long)free_clusters[i]);
+	}
+
+	if(top_count == 0) return;
+
+	fprintf(out, "\nMost fragmented (extents, size, path, extent lengths):\n");
+	for(i = 0; i < top_count; i++) {
+		int64_t counts[LAYOUT_BUCKETS] = {0};
+		fat_extent *list;
+		int count = getExtents(vol, idx->records[top[i]].first_cluster, &list);
+
+		for(n = 0; n < count; n++) counts[getBucket(list[n].length)]++;
+		free(list);
+
+		fprintf(out, "%-9d %-10u %s", top_extents[i], idx->records[top[i]].size, recordPath(idx, top[i]));
+
+		//the histogram of the file, only the lengths it has
+		for(n = 0; n < LAYOUT_BUCKETS; n++) {
+			if(counts[n] == 0) continue;
+			formatBucket(n, range);
+			fprintf(out, " %s:%lld", range, (long long)counts[n]);
+		}
+
+		fprintf(out, "\n");
+	}
+}
+
+
+/*******************************************************************************
+ * function: listDirectory
+ *******************************************************************************
+ * Lists one directory of a walk, without the directories in it.
+ *
+ * @param	tree_walk *walk	walk of the disk image
+ * @param	tree_dir *dir	directory to list
+ * @param	int worker	thread listing the directory
+ *
+ * @return	void		no return value
+ *
+ * @see				void listFiles(list_output*, fat_volume*, int64_t, bool*)
+ * @see				void listChain(list_output*, fat_volume*, int)
+ ******************************************************************************/
+
+static void listDirectory(tree_walk *walk, tree_dir *dir, int worker) {
+	fat_volume *vol = walk->vol;
+	list_output *list = (list_output *)walk->arg + worker;
+
+	list->out = dir->out;
+	list->walk = walk;
+	list->dir = dir;
+	list->worker = worker;
+	list->path_length = treePath(dir, list->path, LIST_PATH_MAX);
+	list->length = 0;
+
+	//rest_free tells us if there are no further directory entries to stop
+	//loop
+	bool rest_free = false;
+	int i;
+
+	//a FAT32 root is listed like any other directory
+	if(dir->first_cluster != 0) {
+		listChain(list, vol, dir->first_cluster);
+	} else if(vol->root_cluster != 0) {
+		listChain(list, vol, vol->root_cluster);
+	} else {
+		for(i = 0; i < vol->sectors_for_root && !rest_free; i++) {
+			listFiles(list, vol, vol->root_sector_start+i, &rest_free);
+		}
+	}
+
+	flushListing(list);
+}
+
+
+/*******************************************************************************
+ * function: writeListing
+ *******************************************************************************
+ * Writes out a piece of the merged listing.
+ *
+ * @param	tree_dir *dir	directory the piece is from
+ * @param	char *bytes	piece of the listing
+ * @param	size_t length	number of bytes in the piece
+ * @param	void *arg	stream to print to
+ *
+ * @return	void		no return value
+ ******************************************************************************/
+
+static void writeListing(tree_dir *dir, char *bytes, size_t length, void *arg) {
+	(void)dir;
+	fwrite(bytes, 1, length, (FILE *)arg);
+}
+
+
+/*******************************************************************************
+ * function: printListing
+ *******************************************************************************
+ * Prints every file and directory of the disk image.
+ *
+ * Lists the root directory and every sub-directory. The directories are
+ * listed by several threads at once and put back together in the order they
+ * are found in, so the listing is the same whatever the number of threads.
+ *
+ * @param	FILE *out	stream to print to
+ * @param	fat_volume *vol	volume context
+ * @param	list_format format	LIST_TEXT or LIST_NDJSON
+ *
+ * @return	void		no return value
+ *
+ * @see				diskformat.h
+ * @see				tree_dir *walkTree(fat_volume*, tree_scan, void*, int)
+ * @see				void mergeTree(tree_dir*, tree_emit, tree_enter, void*)
+ ******************************************************************************/
+
+void printListing(FILE *out, fat_volume *vol, list_format format) {
+	int threads = getTreeThreads();
+	list_output *lists = (list_output *)malloc(threads * sizeof(list_output));
+	if(lists == NULL) {
+		printf("ERROR: Failed to allocate listing\n");
+		exit(EXIT_FAILURE);
+	}
+
+	int i;
+	for(i = 0; i < threads; i++) {
+		lists[i].format = format;
+	}
+
+	if(format == LIST_TEXT) fwrite("ROOT\n==================\n", 1, 24, out);
+
+	//every name in a path takes at most 13 bytes with its slash
+	tree_dir *root = walkTree(vol, listDirectory, lists, (LIST_PATH_MAX - 14) / 13);
+	mergeTree(root, writeListing, NULL, out);
+
+	freeTree(root);
+	free(lists);
+}
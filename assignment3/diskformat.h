@@ -0,0 +1,70 @@
+/***** diskformat.h ************************************************************
+ * University of Victoria
+ * CSC 360 Fall 2018
+ * Italo Borrelli
+ * V00884840
+ *******************************************************************************
+ * This header file declares the mehods defined in diskformat.c.
+ ******************************************************************************/
+
+#ifndef DISK_FORMAT_H_
+#define DISK_FORMAT_H_
+
+#include <stdio.h>
+
+#include "diskhelpers.h"
+#include "diskindex.h"
+#include "disktree.h"
+
+#define LIST_BUFFER_SIZE 262144	//bytes of listing written out at a time
+#define LIST_PATH_MAX 4096	//longest directory path listed
+#define LIST_LINE_MAX 32768	//longest line of any listing
+#define LAYOUT_BUCKETS 32	//extent lengths are counted in powers of two
+#define LAYOUT_TOP 10		//most fragmented files printed
+
+
+/*******************************************************************************
+ * LISTING
+ *******************************************************************************
+ * A directory listing being printed, in the format asked for. Lines are built
+ * in the buffer and written to the stream a buffer at a time. Each thread of
+ * a walk has its own, pointed at the directory it is listing.
+ ******************************************************************************/
+
+typedef enum list_format {
+	LIST_TEXT,			//the human readable listing
+	LIST_NDJSON			//one JSON object per file or directory
+} list_format;
+
+typedef struct list_output {
+	FILE *out;			//stream the listing is printed to
+	list_format format;		//format of every line
+
+	char path[LIST_PATH_MAX];	//path of the directory being listed
+	int path_length;		//length of path, 0 for root
+
+	char buf[LIST_BUFFER_SIZE];	//lines not yet written to out
+	int length;			//number of bytes in buf
+
+	tree_walk *walk;		//walk the listing is part of
+	tree_dir *dir;			//directory being listed
+	int worker;			//thread listing the directory
+} list_output;
+
+
+/*******************************************************************************
+ * FUNCTION DECLARATIONS
+ ******************************************************************************/
+
+void getOSName(char *ptr, char *os_name);
+void getDiskLabel(fat_volume *vol, char *label);
+int getFileCount(dir_index *idx);
+void printDirectory(list_output *list, char *entry);
+void listChain(list_output *list, fat_volume *vol, int fat_entry);
+void listFiles(list_output *list, fat_volume *vol, int64_t sector_num, bool *rest_free);
+void printInfo(FILE *out, fat_volume *vol, dir_index *idx);
+void printLayout(FILE *out, fat_volume *vol, dir_index *idx);
+void printListing(FILE *out, fat_volume *vol, list_format format);
+
+
+#endif //DISK_FORMAT_H_
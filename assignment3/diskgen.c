@@ -0,0 +1,813 @@
+/***** diskgen.c ***************************************************************
+ * University of Victoria
+ * CSC 360 Fall 2018
+ * Italo Borrelli
+ * V00884840
+ *******************************************************************************
+ * diskgen.c is a source file that creates a synthetic FAT disk image to test
+ * and benchmark the other tools on.
+ *
+ * The image is formatted for the FAT width the tools are built for and filled
+ * with directories and files whose number, depth, sizes and fragmentation are
+ * chosen on the command line. Everything is drawn from a seeded generator so
+ * the same arguments always give the same image.
+ *
+ * Directories are named Dnnnnn and files Fnnnnn.TXT. The first -D directories
+ * are nested in each other so the tree is as deep as asked, the rest go in any
+ * directory that isn't at that depth yet. Each cluster of a chain is put right
+ * after the one before it, or with the chance given by -f at a random place on
+ * the disk, which leaves the chain in that many more pieces.
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <string.h>
+#include <math.h>
+#include <limits.h>
+
+#include "diskhelpers.h"
+
+#define GEN_SECTOR_SIZE 512	//bytes per sector of every generated image
+#define GEN_ROOT_SPARE 16	//entries of a fixed root left free for diskput
+#define GEN_MAX_COUNT 99999	//most files or directories, their numbers
+				//have to fit the five digits of a short name
+
+
+/*******************************************************************************
+ * SIZE DISTRIBUTION
+ *******************************************************************************
+ * How the sizes of the generated files are drawn.
+ ******************************************************************************/
+
+typedef enum gen_dist {
+	DIST_FIXED,			//every file is a bytes long
+	DIST_UNIFORM,			//uniform between a and b bytes
+	DIST_LOGNORMAL			//log normal with median a and sigma b
+} gen_dist;
+
+typedef struct gen_sizes {
+	gen_dist dist;			//shape of the distribution
+	double a;			//first parameter
+	double b;			//second parameter
+} gen_sizes;
+
+
+/*******************************************************************************
+ * GENERATED DIRECTORY
+ *******************************************************************************
+ * A directory being filled, and where its next entry goes.
+ ******************************************************************************/
+
+typedef struct gen_dir {
+	int first_cluster;		//first cluster, 0 for the fixed root
+	int cluster;			//cluster the next entry goes in, 0 for the
+					//fixed root
+	int used;			//entries used in that cluster, or in the
+					//whole fixed root
+	int depth;			//0 for root
+	int index;			//number in the name, 0 for root
+	int parent;			//directory this one is in, -1 for root
+} gen_dir;
+
+
+/*******************************************************************************
+ * GENERATOR STATE
+ *******************************************************************************
+ * Everything the generator needs while it fills the image.
+ ******************************************************************************/
+
+typedef struct gen_state {
+	fat_volume *vol;		//volume being filled
+	uint64_t rng;			//state of the random number generator
+	int frag;			//percent chance a cluster is put elsewhere
+	int cursor;			//cluster after the last one allocated
+	int root_capacity;		//entries in a fixed root, 0 for FAT32
+
+	gen_dir *dirs;			//every directory, the root first
+	int dir_count;			//number of directories made
+
+	int64_t data_bytes;		//bytes of file data written
+	int64_t extents;		//extents of every chain written
+	int fragmented;			//files in more than one extent
+} gen_state;
+
+
+
+/*******************************************************************************
+ * function: nextRandom
+ *******************************************************************************
+ * Draws the next number from a xorshift64* generator.
+ *
+ * @param	uint64_t *state	state of the generator, never 0
+ *
+ * @return	uint64_t	the next random number
+ ******************************************************************************/
+
+static uint64_t nextRandom(uint64_t *state) {
+	*state ^= *state >> 12;
+	*state ^= *state << 25;
+	*state ^= *state >> 27;
+	return *state * 0x2545f4914f6cdd1dULL;
+}
+
+
+/*******************************************************************************
+ * function: randomBelow
+ *******************************************************************************
+ * Draws a random number from 0 up to but not including n.
+ *
+ * @param	gen_state *gen	generator state
+ * @param	int n		number of possible values, more than 0
+ *
+ * @return	int		the number drawn
+ ******************************************************************************/
+
+static int randomBelow(gen_state *gen, int n) {
+	return (int)(nextRandom(&gen->rng) % (uint64_t)n);
+}
+
+
+/*******************************************************************************
+ * function: parseBytes
+ *******************************************************************************
+ * Reads a number of bytes with an optional K, M or G suffix.
+ *
+ * @param	char *arg	number as given on the command line
+ *
+ * @return	double		the number of bytes, -1 if arg isn't one
+ ******************************************************************************/
+
+static double parseBytes(char *arg) {
+	char *end;
+	double bytes = strtod(arg, &end);
+	if(end == arg || bytes < 0) return -1;
+
+	if(*end == 'K' || *end == 'k') { bytes *= 1024; end++; }
+	else if(*end == 'M' || *end == 'm') { bytes *= 1024 * 1024; end++; }
+	else if(*end == 'G' || *end == 'g') { bytes *= 1024 * 1024 * 1024; end++; }
+
+	return (*end == '\0') ? bytes : -1;
+}
+
+
+/*******************************************************************************
+ * function: parseSizes
+ *******************************************************************************
+ * Reads a file size distribution, one of fixed:<bytes>,
+ * uniform:<min>:<max> or lognormal:<median>:<sigma>.
+ *
+ * @param	char *arg	distribution as given on the command line
+ * @param	gen_sizes *sizes
+ * 				set to the distribution
+ *
+ * @return	bool		false if arg isn't a distribution
+ ******************************************************************************/
+
+static bool parseSizes(char *arg, gen_sizes *sizes) {
+	char *first = strchr(arg, ':');
+	if(first == NULL) return false;
+	*first++ = '\0';
+
+	char *second = strchr(first, ':');
+	if(second != NULL) *second++ = '\0';
+
+	if(strcmp(arg, "fixed") == 0 && second == NULL) {
+		sizes->dist = DIST_FIXED;
+		sizes->a = parseBytes(first);
+		sizes->b = 0;
+		return sizes->a >= 0;
+	}
+
+	if(second == NULL) return false;
+
+	if(strcmp(arg, "uniform") == 0) {
+		sizes->dist = DIST_UNIFORM;
+		sizes->a = parseBytes(first);
+		sizes->b = parseBytes(second);
+		return sizes->a >= 0 && sizes->b >= sizes->a;
+	}
+
+	if(strcmp(arg, "lognormal") == 0) {
+		sizes->dist = DIST_LOGNORMAL;
+		sizes->a = parseBytes(first);
+		sizes->b = atof(second);
+		return sizes->a > 0 && sizes->b >= 0;
+	}
+
+	return false;
+}
+
+
+/*******************************************************************************
+ * function: drawSize
+ *******************************************************************************
+ * Draws the size of the next file. A log normal size is drawn with the Box
+ * Muller transform, so most files are small and a few are very large, like on
+ * a real disk.
+ *
+ * @param	gen_state *gen	generator state
+ * @param	gen_sizes *sizes
+ * 				distribution to draw from
+ *
+ * @return	int64_t		size of the file in bytes
+ ******************************************************************************/
+
+static int64_t drawSize(gen_state *gen, gen_sizes *sizes) {
+	double size;
+
+	if(sizes->dist == DIST_FIXED) {
+		size = sizes->a;
+	} else if(sizes->dist == DIST_UNIFORM) {
+		size = sizes->a + (sizes->b - sizes->a) * ((nextRandom(&gen->rng) >> 11) / 9007199254740992.0);
+	} else {
+		double u1 = ((nextRandom(&gen->rng) >> 11) + 1) / 9007199254740993.0;
+		double u2 = (nextRandom(&gen->rng) >> 11) / 9007199254740992.0;
+		size = sizes->a * exp(sizes->b * sqrt(-2 * log(u1)) * cos(2 * M_PI * u2));
+	}
+
+	//a directory entry can't hold more than 32 bits of size
+	return (size > 4294967295.0) ? 4294967295LL : (int64_t)size;
+}
+
+
+/*******************************************************************************
+ * function: putLittleEndian
+ *******************************************************************************
+ * Writes a little endian number of the given number of bytes.
+ *
+ * @param	char *dest	where to write the number
+ * @param	uint32_t value	number to write
+ * @param	int bytes	number of bytes to write it in
+ *
+ * @return	void		no return value
+ ******************************************************************************/
+
+static void putLittleEndian(char *dest, uint32_t value, int bytes) {
+	int i;
+	for(i = 0; i < bytes; i++) dest[i] = (value >> (8*i)) & 0xff;
+}
+
+
+/*******************************************************************************
+ * function: formatImage
+ *******************************************************************************
+ * Writes the boot sector and the reserved FAT entries of an empty image.
+ *
+ * The geometry is worked out for 512 byte sectors. The cluster size is the
+ * smallest power of two sectors that keeps the number of clusters inside the
+ * range of the FAT width, and the FAT size is recalculated until it is just
+ * large enough for the clusters that are left beside it.
+ *
+ * @param	char *ptr	mapping of the zeroed image
+ * @param	int64_t sectors	number of sectors in the image
+ * @param	char *label	volume label, at most 11 characters
+ * @param	uint32_t serial	volume serial number
+ *
+ * @return	void		no return value
+ ******************************************************************************/
+
+static void formatImage(char *ptr, int64_t sectors, char *label, uint32_t serial) {
+#if FAT_BITS == 12
+	int reserved = 1, root_entries = (sectors <= 2880) ? 224 : 512;
+	int64_t min_clusters = 1, max_clusters = 4084;
+	int media = 0xf0;
+#elif FAT_BITS == 16
+	int reserved = 1, root_entries = 512;
+	int64_t min_clusters = 4085, max_clusters = 65524;
+	int media = 0xf8;
+#else
+	int reserved = 32, root_entries = 0;
+	int64_t min_clusters = 65525, max_clusters = 0x0ffffff5;
+	int media = 0xf8;
+#endif
+	int root_sectors = root_entries * 32 / GEN_SECTOR_SIZE;
+	int spc;
+	int64_t clusters = 0, spf = 1;
+
+	for(spc = 1; spc <= 128; spc *= 2) {
+		spf = 1;
+		while(true) {
+			clusters = (sectors - reserved - 2 * spf - root_sectors) / spc;
+			int64_t need = ((clusters + 2) * FAT_BITS / 8 + GEN_SECTOR_SIZE - 1) / GEN_SECTOR_SIZE;
+			if(need <= spf) break;
+			spf = need;
+		}
+
+		if(clusters <= max_clusters) break;
+	}
+
+	if(spc > 128) {
+		printf("ERROR: Image too large for FAT%d\n", FAT_BITS);
+		exit(EXIT_FAILURE);
+	}
+
+	if(clusters < min_clusters) {
+		printf("ERROR: Image too small for FAT%d, it needs at least %lld bytes\n", FAT_BITS,
+			(long long)((min_clusters + 2) * GEN_SECTOR_SIZE * 2));
+		exit(EXIT_FAILURE);
+	}
+
+	ptr[0] = (char)0xeb;
+	ptr[1] = (FAT_BITS == 32) ? 0x58 : 0x3c;
+	ptr[2] = (char)0x90;
+	memcpy(ptr + 3, "DISKGEN ", 8);
+	putLittleEndian(ptr + 11, GEN_SECTOR_SIZE, 2);
+	ptr[13] = spc;
+	putLittleEndian(ptr + 14, reserved, 2);
+	ptr[16] = 2;
+	putLittleEndian(ptr + 17, root_entries, 2);
+	if(sectors < 65536) putLittleEndian(ptr + 19, sectors, 2);
+	else putLittleEndian(ptr + 32, sectors, 4);
+	ptr[21] = media;
+	putLittleEndian(ptr + 24, 18, 2);
+	putLittleEndian(ptr + 26, 2, 2);
+
+	//the label is padded with spaces to 11 characters
+	char padded[11];
+	memset(padded, ' ', 11);
+	memcpy(padded, label, strlen(label) < 11 ? strlen(label) : 11);
+
+#if FAT_BITS == 32
+	putLittleEndian(ptr + 36, spf, 4);
+	putLittleEndian(ptr + 44, 2, 4);
+	putLittleEndian(ptr + 48, 1, 2);
+	putLittleEndian(ptr + 50, 6, 2);
+	ptr[64] = (char)0x80;
+	ptr[66] = 0x29;
+	putLittleEndian(ptr + 67, serial, 4);
+	memcpy(ptr + 71, padded, 11);
+	memcpy(ptr + 82, "FAT32   ", 8);
+#else
+	putLittleEndian(ptr + 22, spf, 2);
+	ptr[36] = (FAT_BITS == 12) ? 0x00 : (char)0x80;
+	ptr[38] = 0x29;
+	putLittleEndian(ptr + 39, serial, 4);
+	memcpy(ptr + 43, padded, 11);
+	memcpy(ptr + 54, (FAT_BITS == 12) ? "FAT12   " : "FAT16   ", 8);
+#endif
+
+	ptr[510] = 0x55;
+	ptr[511] = (char)0xaa;
+
+	//entry 0 holds the media byte and entry 1 ends a chain, in every FAT
+	int i;
+	for(i = 0; i < 2; i++) {
+		char *fat = ptr + ((int64_t)reserved + i * spf) * GEN_SECTOR_SIZE;
+#if FAT_BITS == 12
+		putLittleEndian(fat, 0xffff00 | media, 3);
+#elif FAT_BITS == 16
+		putLittleEndian(fat, 0xffff00 | media, 4);
+#else
+		putLittleEndian(fat, 0x0fffff00 | media, 4);
+		putLittleEndian(fat + 4, 0x0fffffff, 4);
+#endif
+	}
+}
+
+
+/*******************************************************************************
+ * function: allocCluster
+ *******************************************************************************
+ * Allocates one cluster and links it to the end of a chain.
+ *
+ * The cluster is the first free one after prev, or after the last cluster
+ * allocated for a new chain, unless the fragmentation roll sends it to a
+ * random place on the disk instead.
+ *
+ * @param	gen_state *gen	generator state
+ * @param	int prev	last cluster of the chain, -1 to start one
+ *
+ * @return	int		the cluster, -1 if the disk is full
+ *
+ * @see				int findFreeCluster(fat_volume*, int)
+ ******************************************************************************/
+
+static int allocCluster(gen_state *gen, int prev) {
+	fat_volume *vol = gen->vol;
+
+	int start = (prev < 0) ? gen->cursor : prev + 1;
+	if(gen->frag > 0 && randomBelow(gen, 100) < gen->frag) start = 2 + randomBelow(gen, vol->num_entries - 2);
+
+	int cluster = findFreeCluster(vol, start);
+	if(cluster == -1) return -1;
+
+	setFAT(vol, cluster, FAT_EOC);
+	if(prev >= 0) setFAT(vol, prev, cluster);
+	if(prev < 0 || cluster != prev + 1) gen->extents++;
+
+	gen->cursor = cluster + 1;
+	return cluster;
+}
+
+
+/*******************************************************************************
+ * function: newEntry
+ *******************************************************************************
+ * Finds the place of the next entry of a directory, growing the directory by
+ * a zeroed cluster when its last one is full.
+ *
+ * @param	gen_state *gen	generator state
+ * @param	gen_dir *dir	directory to add an entry to
+ *
+ * @return	int64_t		byte offset of the entry, -1 if the fixed root
+ * 				or the disk is full
+ ******************************************************************************/
+
+static int64_t newEntry(gen_state *gen, gen_dir *dir) {
+	fat_volume *vol = gen->vol;
+
+	if(dir->cluster == 0) {
+		if(dir->used == gen->root_capacity) return -1;
+		return vol->root_sector_start * vol->bytes_per_sector + 32 * dir->used++;
+	}
+
+	if(dir->used == vol->cluster_size / 32) {
+		int cluster = allocCluster(gen, dir->cluster);
+		if(cluster == -1) return -1;
+
+		memset(vol->ptr + getClusterOffset(vol, cluster), 0, vol->cluster_size);
+		dir->cluster = cluster;
+		dir->used = 0;
+	}
+
+	return getClusterOffset(vol, dir->cluster) + 32 * dir->used++;
+}
+
+
+/*******************************************************************************
+ * function: writeEntry
+ *******************************************************************************
+ * Writes a directory entry with a timestamp drawn from the year 2018.
+ *
+ * @param	gen_state *gen	generator state
+ * @param	char *entry	pointer to the 32 byte directory entry
+ * @param	char *name	name padded to 11 characters, without a period
+ * @param	int attr	attribute byte
+ * @param	int cluster	first cluster of the entry
+ * @param	uint32_t size	size of the file, 0 for a directory
+ *
+ * @return	void		no return value
+ ******************************************************************************/
+
+static void writeEntry(gen_state *gen, char *entry, char *name, int attr, int cluster, uint32_t size) {
+	memset(entry, 0, 32);
+	memcpy(entry, name, 11);
+	entry[11] = attr;
+
+	int month = 1 + randomBelow(gen, 12), day = 1 + randomBelow(gen, 28);
+	int time = (randomBelow(gen, 24) << 11) | (randomBelow(gen, 60) << 5) | randomBelow(gen, 30);
+	int date = ((2018 - 1980) << 9) | (month << 5) | day;
+
+	putLittleEndian(entry + 14, time, 2);
+	putLittleEndian(entry + 16, date, 2);
+	putLittleEndian(entry + 18, date, 2);
+	putLittleEndian(entry + 22, time, 2);
+	putLittleEndian(entry + 24, date, 2);
+
+	setEntryCluster(entry, cluster);
+	putLittleEndian(entry + 28, size, 4);
+}
+
+
+/*******************************************************************************
+ * function: pickDirectory
+ *******************************************************************************
+ * Picks a random directory to put an entry in.
+ *
+ * A fixed root with only the spare entries left is passed over, and so are
+ * directories already at max_depth when picking the parent of a directory.
+ *
+ * @param	gen_state *gen	generator state
+ * @param	int max_depth	deepest directory that can be picked
+ *
+ * @return	int		the directory, -1 if none can be picked
+ ******************************************************************************/
+
+static int pickDirectory(gen_state *gen, int max_depth) {
+	int tries;
+
+	//a random pick almost always works, a full scan finds the rest
+	for(tries = 0; tries < 64; tries++) {
+		int d = randomBelow(gen, gen->dir_count);
+		gen_dir *dir = &gen->dirs[d];
+		if(dir->depth > max_depth) continue;
+		if(dir->cluster == 0 && dir->used >= gen->root_capacity - GEN_ROOT_SPARE) continue;
+		return d;
+	}
+
+	int d;
+	for(d = 0; d < gen->dir_count; d++) {
+		gen_dir *dir = &gen->dirs[d];
+		if(dir->depth > max_depth) continue;
+		if(dir->cluster == 0 && dir->used >= gen->root_capacity - GEN_ROOT_SPARE) continue;
+		return d;
+	}
+
+	return -1;
+}
+
+
+/*******************************************************************************
+ * function: writePath
+ *******************************************************************************
+ * Writes the path of an entry of a directory, as diskget takes it.
+ *
+ * @param	gen_state *gen	generator state
+ * @param	int d		directory the entry is in
+ * @param	char *name	name of the entry
+ * @param	FILE *out	stream to write the path to
+ *
+ * @return	void		no return value
+ ******************************************************************************/
+
+static void writePath(gen_state *gen, int d, char *name, FILE *out) {
+	if(d > 0) {
+		writePath(gen, gen->dirs[d].parent, "", out);
+		fprintf(out, "D%05d/", gen->dirs[d].index);
+	}
+
+	fputs(name, out);
+}
+
+
+/*******************************************************************************
+ * function: makeDirectory
+ *******************************************************************************
+ * Makes a new directory with its . and .. entries in the given directory.
+ *
+ * @param	gen_state *gen	generator state
+ * @param	int parent	directory to make it in
+ *
+ * @return	void		no return value
+ ******************************************************************************/
+
+static void makeDirectory(gen_state *gen, int parent) {
+	fat_volume *vol = gen->vol;
+	gen_dir *dir = &gen->dirs[gen->dir_count];
+
+	dir->index = gen->dir_count;
+	dir->parent = parent;
+	dir->depth = gen->dirs[parent].depth + 1;
+
+	int64_t offset = newEntry(gen, &gen->dirs[parent]);
+	int cluster = (offset == -1) ? -1 : allocCluster(gen, -1);
+	if(cluster == -1) {
+		printf("ERROR: Not enough space for %d directories\n", gen->dir_count);
+		exit(EXIT_FAILURE);
+	}
+
+	//room for any int, the counts are limited so it is always 11 bytes
+	char name[24];
+	snprintf(name, sizeof(name), "D%05d     ", dir->index);
+	writeEntry(gen, vol->ptr + offset, name, 0x10, cluster, 0);
+
+	char *first = vol->ptr + getClusterOffset(vol, cluster);
+	memset(first, 0, vol->cluster_size);
+	writeEntry(gen, first, ".          ", 0x10, cluster, 0);
+	writeEntry(gen, first + 32, "..         ", 0x10, (parent == 0) ? 0 : gen->dirs[parent].first_cluster, 0);
+
+	dir->first_cluster = dir->cluster = cluster;
+	dir->used = 2;
+	gen->dir_count++;
+}
+
+
+/*******************************************************************************
+ * function: makeFile
+ *******************************************************************************
+ * Makes a file of the given size filled with random bytes.
+ *
+ * @param	gen_state *gen	generator state
+ * @param	int number	number of the file, used in its name
+ * @param	int64_t size	size of the file in bytes
+ * @param	FILE *manifest	stream to list the file in, may be NULL
+ *
+ * @return	void		no return value
+ ******************************************************************************/
+
+static void makeFile(gen_state *gen, int number, int64_t size, FILE *manifest) {
+	fat_volume *vol = gen->vol;
+
+	int d = pickDirectory(gen, INT_MAX);
+	int64_t offset = (d == -1) ? -1 : newEntry(gen, &gen->dirs[d]);
+	if(offset == -1) {
+		printf("ERROR: No directory has room for file %d, add directories with -d\n", number);
+		exit(EXIT_FAILURE);
+	}
+
+	int64_t clusters = (size + vol->cluster_size - 1) / vol->cluster_size;
+	if(clusters > vol->free_count) {
+		printf("ERROR: Not enough space for file %d, make the image larger with -s\n", number);
+		exit(EXIT_FAILURE);
+	}
+
+	uint64_t data_rng = gen->rng ^ ((uint64_t)number * 0x9e3779b97f4a7c15ULL);
+	if(data_rng == 0) data_rng = 1;
+
+	int first = 0, prev = -1;
+	int64_t written = 0;
+	int64_t before = gen->extents;
+	for(; clusters > 0; clusters--) {
+		int cluster = allocCluster(gen, prev);
+		if(first == 0) first = cluster;
+
+		uint64_t *dest = (uint64_t *)(vol->ptr + getClusterOffset(vol, cluster));
+		int words = vol->cluster_size / 8, i;
+		for(i = 0; i < words; i++) dest[i] = nextRandom(&data_rng);
+
+		//the end of the last cluster is left zeroed
+		int64_t bytes = size - written;
+		if(bytes < vol->cluster_size) memset((char *)dest + bytes, 0, vol->cluster_size - bytes);
+
+		written += vol->cluster_size;
+		prev = cluster;
+	}
+
+	if(gen->extents - before > 1) gen->fragmented++;
+	gen->data_bytes += size;
+
+	//room for any int, the counts are limited so it is always 11 bytes
+	char name[24];
+	snprintf(name, sizeof(name), "F%05d  TXT", number);
+	writeEntry(gen, vol->ptr + offset, name, 0x00, first, size);
+
+	if(manifest != NULL) {
+		char path_name[16];
+		snprintf(path_name, sizeof(path_name), "F%05d.TXT", number);
+		writePath(gen, d, path_name, manifest);
+		fprintf(manifest, " %lld\n", (long long)size);
+	}
+}
+
+
+/*******************************************************************************
+ * function: writeFSInfo
+ *******************************************************************************
+ * Writes the FSInfo sector of a FAT32 image and the backup boot sector and
+ * FSInfo sector at sectors 6 and 7.
+ *
+ * @param	fat_volume *vol	volume context of the filled image
+ *
+ * @return	void		no return value
+ ******************************************************************************/
+
+static void writeFSInfo(fat_volume *vol) {
+#if FAT_BITS == 32
+	char *info = vol->ptr + vol->bytes_per_sector;
+
+	//the counts are left unknown until the signatures are there for
+	//writeFreeHint to find
+	putLittleEndian(info, 0x41615252, 4);
+	putLittleEndian(info + 484, 0x61417272, 4);
+	putLittleEndian(info + 488, 0xffffffff, 4);
+	putLittleEndian(info + 492, 0xffffffff, 4);
+	putLittleEndian(info + 508, 0xaa550000, 4);
+	writeFreeHint(vol);
+
+	memcpy(vol->ptr + 6 * vol->bytes_per_sector, vol->ptr, 2 * vol->bytes_per_sector);
+#else
+	(void)vol;
+#endif
+}
+
+
+/*******************************************************************************
+ * function: main
+ *******************************************************************************
+ * Main execution for diskgen.
+ *
+ * Creates the image, formats it, makes the directories and then the files,
+ * writes the FAT to both copies and prints a summary of what was made.
+ *
+ * @param	int argc	number of arguments passed during execution
+ * @param	char *argv[]	vector of arguments passed during execution
+ *
+ * @return	int		N/A
+ ******************************************************************************/
+
+int main(int argc, char *argv[]) {
+	double size = 1474560;
+	int files = 100, dirs = 10, depth = 3, frag = 0, opt;
+	uint64_t seed = 1;
+	char *label = "DISKGEN", *manifest_path = NULL;
+	gen_sizes sizes = {DIST_LOGNORMAL, 4096, 1.0};
+
+	while((opt = getopt(argc, argv, "s:n:d:D:z:f:S:l:m:")) != -1) {
+		if(opt == 's') size = parseBytes(optarg);
+		else if(opt == 'n') files = atoi(optarg);
+		else if(opt == 'd') dirs = atoi(optarg);
+		else if(opt == 'D') depth = atoi(optarg);
+		else if(opt == 'f') frag = atoi(optarg);
+		else if(opt == 'S') seed = strtoull(optarg, NULL, 0);
+		else if(opt == 'l') label = optarg;
+		else if(opt == 'm') manifest_path = optarg;
+		else if(opt == 'z' && parseSizes(optarg, &sizes)) continue;
+		else {
+			//an unknown option or size spec falls through to the usage
+			optind = argc;
+			break;
+		}
+	}
+
+	if(optind != argc - 1 || size < 0 || files < 0 || files > GEN_MAX_COUNT || dirs < 0 || dirs > GEN_MAX_COUNT || depth < 0 || frag < 0 || frag > 100 || (dirs > 0 && depth == 0)) {
+		printf("ERROR: Usage \"diskgen [-s size] [-n files] [-d directories] [-D depth]\n");
+		printf("                      [-z fixed:<bytes>|uniform:<min>:<max>|lognormal:<median>:<sigma>]\n");
+		printf("                      [-f fragmentation%%] [-S seed] [-l label] [-m manifest] <disk_image>\"\n");
+		exit(EXIT_FAILURE);
+	}
+
+	char *image_path = argv[optind];
+	int64_t sectors = (int64_t)size / GEN_SECTOR_SIZE;
+
+	int fd = open(image_path, O_RDWR|O_CREAT|O_TRUNC, 0644);
+	if(fd < 0 || ftruncate(fd, sectors * GEN_SECTOR_SIZE) != 0) {
+		printf("ERROR: Creating disk image failed\n");
+		exit(EXIT_FAILURE);
+	}
+
+	char *ptr = mmap(0, sectors * GEN_SECTOR_SIZE, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+	if(ptr == MAP_FAILED) {
+		printf("ERROR: Failed to map disk image\n");
+		exit(EXIT_FAILURE);
+	}
+
+	gen_state gen;
+	memset(&gen, 0, sizeof(gen));
+	gen.rng = seed ? seed : 1;
+	gen.frag = frag;
+
+	formatImage(ptr, sectors, label, (uint32_t)nextRandom(&gen.rng));
+
+	fat_volume vol;
+	getBasicInfo(&vol, ptr);
+	buildFreeMap(&vol);
+	gen.vol = &vol;
+	gen.cursor = 2;
+	gen.root_capacity = vol.sectors_for_root * vol.bytes_per_sector / 32;
+
+	gen.dirs = (gen_dir *)calloc(dirs + 1, sizeof(gen_dir));
+	if(gen.dirs == NULL) {
+		printf("ERROR: Failed to allocate directories\n");
+		exit(EXIT_FAILURE);
+	}
+
+	//a FAT32 root is a chain of its own, starting at the cluster the boot
+	//sector names
+	gen.dirs[0].parent = -1;
+	if(vol.root_cluster != 0) {
+		setFAT(&vol, vol.root_cluster, FAT_EOC);
+		memset(ptr + getClusterOffset(&vol, vol.root_cluster), 0, vol.cluster_size);
+		gen.dirs[0].first_cluster = gen.dirs[0].cluster = vol.root_cluster;
+		gen.cursor = vol.root_cluster + 1;
+		gen.extents++;
+	}
+	gen.dir_count = 1;
+
+	//the first directories nest to the full depth, the rest go anywhere
+	//above it
+	int i;
+	for(i = 1; i <= dirs; i++) {
+		int parent = (i <= depth) ? i - 1 : pickDirectory(&gen, depth - 1);
+		if(parent == -1) {
+			printf("ERROR: No directory has room for directory %d\n", i);
+			exit(EXIT_FAILURE);
+		}
+
+		makeDirectory(&gen, parent);
+	}
+
+	FILE *manifest = NULL;
+	if(manifest_path != NULL && (manifest = fopen(manifest_path, "w")) == NULL) {
+		printf("ERROR: Opening manifest failed\n");
+		exit(EXIT_FAILURE);
+	}
+
+	for(i = 1; i <= files; i++) {
+		makeFile(&gen, i, drawSize(&gen, &sizes), manifest);
+	}
+
+	if(manifest != NULL) fclose(manifest);
+
+	flushFAT(&vol);
+	writeFSInfo(&vol);
+
+	printf("Image:                      %s\n", image_path);
+	printf("Size of disk:               %lld bytes\n", (long long)vol.sector_count * vol.bytes_per_sector);
+	printf("Cluster size:               %d bytes\n", vol.cluster_size);
+	printf("Directories:                %d\n", dirs);
+	printf("Files:                      %d\n", files);
+	printf("File data:                  %lld bytes\n", (long long)gen.data_bytes);
+	printf("Fragmented chains:          %d\n", gen.fragmented);
+	printf("Extents:                    %lld\n", (long long)gen.extents);
+
+	free(gen.dirs);
+	freeVolume(&vol);
+	munmap(ptr, sectors * GEN_SECTOR_SIZE);
+	close(fd);
+
+	return EXIT_SUCCESS;
+}
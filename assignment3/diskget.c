@@ -5,265 +5,605 @@
  * V00884840
  *******************************************************************************
  * diskget.c is a source code that gets a file from a system file image.
+ *
+ * With -r it gets a whole directory instead, recreating its subtree in the
+ * current directory. The files are copied by a pool of worker threads that all
+ * read from the same read only mapping of the image.
+ *
+ * Given - as the output a single file is streamed to stdout instead of being
+ * written to a file, so it can be piped straight into another program.
  ******************************************************************************/
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <fcntl.h>
-#include <sys/mman.h>
 #include <sys/stat.h>
 #include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/sendfile.h>
 
 #include "diskhelpers.h"
+#include "diskblock.h"
+#include "diskindex.h"
+#include "diskjournal.h"
+
+#define MAX_THREADS 64		//max number of extraction threads
+#define COPY_BUFFER 1048576	//bytes read at a time from an image that
+				//isn't mapped
 
 
 /*******************************************************************************
- * function: copyToNew
+ * EXTRACT QUEUE
  *******************************************************************************
- * Copies from a file image to a file.
+ * Files waiting to be extracted by the worker threads of diskget -r.
+ ******************************************************************************/
+
+typedef struct extract_queue {
+	fat_volume *vol;		//volume context of the fs image
+	dir_index *idx;			//directory index of the fs image
+	int fd;				//file descriptor of the fs image
+	int prefix;			//path bytes dropped to get the host path
+
+	int *files;			//records of the files, largest first
+	int count;			//number of files
+	int next;			//next file to hand out
+	bool failed;			//set if any file failed to copy
+	pthread_mutex_t mutex;		//protects next and failed
+} extract_queue;
+
+
+/*******************************************************************************
+ * function: allocCopyBuffer
+ *******************************************************************************
+ * Allocates the buffer extents are copied through when the image isn't mapped.
+ *
+ * @param	fat_volume *vol	volume context of the fs image
+ *
+ * @return	char*		malloced buffer of COPY_BUFFER bytes, NULL if the
+ * 				image is mapped
+ ******************************************************************************/
+
+static char *allocCopyBuffer(fat_volume *vol) {
+	if(vol->ptr != NULL) return NULL;
+
+	char *buf = (char *)malloc(COPY_BUFFER);
+	if(buf == NULL) {
+		fprintf(stderr, "ERROR: Failed to allocate copy buffer\n");
+		exit(EXIT_FAILURE);
+	}
+
+	return buf;
+}
+
+
+/*******************************************************************************
+ * function: copyExtent
+ *******************************************************************************
+ * Copies a byte range of the file image to the same range of a file.
+ *
+ * The copy is done by the kernel with copy_file_range so the data never passes
+ * through user space. If the kernel or the filesystems involved can't do that
+ * the range is written out of the image mapping with pwrite instead, and the
+ * flag given is cleared so every later extent of the file goes straight to
+ * pwrite. The flag belongs to the caller so the threads of diskget -r never
+ * share it. An image read with O_DIRECT always
+ * takes that way, through a buffer read from the block device, so its data
+ * never goes through the page cache.
  *
- * @param	char *ptr_from	a pointer to the first byte of fs image being
- * 					copied from
- * @param	char *ptr_to	a pointer to the first byte of fs image being
- * 					copied to
- * @param	int index	index of the first byte of the file
- * @param	int file_size	total size of file being copied
+ * @param	fat_volume *vol	volume context of the fs image
+ * @param	int fd_from	file descriptor of the fs image
+ * @param	int fd_to	file descriptor of the file being written
+ * @param	off_t from	byte offset in the fs image
+ * @param	off_t to	byte offset in the file being written
+ * @param	size_t bytes	number of bytes to copy
+ * @param	bool *use_copy_range
+ * 				true if copy_file_range may still be tried
  *
- * @return	void		no return value
+ * @return	bool		true if the whole range was copied
  ******************************************************************************/
 
-void copyToNew(char *ptr_from, char *ptr_to, int index, int file_size) {
-	int i, remaining = file_size, address;
-	int fat_entry = ptr_from[index+26] + (ptr_from[index+27] << 8);
+bool copyExtent(fat_volume *vol, int fd_from, int fd_to, off_t from, off_t to, size_t bytes, bool *use_copy_range) {
+	ssize_t done;
 
-	//do this until the FAT entry is -1 or 0xfff
-	do {
-		address = BYTES_PER_SECTOR * (31 + fat_entry);
+	if(vol->dev != NULL && vol->dev->backend == BLOCK_DIRECT) *use_copy_range = false;
 
-		for(i = 0; i < BYTES_PER_SECTOR; i++) {
-			if(remaining == 0) break;
-			ptr_to[file_size-remaining] = ptr_from[i+address];
-			remaining--;
+	while(*use_copy_range && bytes > 0) {
+		done = copy_file_range(fd_from, &from, fd_to, &to, bytes, 0);
+		if(done > 0) {
+			bytes -= done;
+		} else if(done == 0) {
+			return false;
+		} else if(errno == ENOSYS || errno == EXDEV || errno == EINVAL || errno == EOPNOTSUPP) {
+			*use_copy_range = false;
+		} else {
+			return false;
 		}
+	}
+
+	char *buf = allocCopyBuffer(vol);
+	while(bytes > 0) {
+		size_t chunk = (vol->ptr == NULL && bytes > COPY_BUFFER) ? COPY_BUFFER : bytes;
+		done = pwrite(fd_to, readImage(vol, from, chunk, buf), chunk, to);
+		if(done <= 0) break;
+
+		from += done;
+		to += done;
+		bytes -= done;
+	}
 
-		fat_entry = getFATEntry(ptr_from, fat_entry);
-	} while(fat_entry != 0xfff);
+	free(buf);
+	return bytes == 0;
 }
 
 
 /*******************************************************************************
- * function: nameCompare
+ * function: copyToNew
  *******************************************************************************
- * Checks if the directory at the given location agrees with the filename
+ * Copies from a file image to a file.
+ *
+ * The chain of the file is merged into extents of consecutive clusters and each
+ * extent is copied in one go, with the extents after it advised so they are
+ * already being read when their turn comes.
  *
- * @param	char *ptr	a pointer to the first byte of the fs image
- * @param	int directory_start
- * 				byte value of start of directory to list
- * @param	char *filename	filename to compare directory to
+ * @param	fat_volume *vol	volume context of the fs image being copied from
+ * @param	int fd_from	file descriptor of the fs image
+ * @param	int fd_to	file descriptor of the file being written
+ * @param	int fat_entry	first FAT entry of the file
+ * @param	int64_t file_size	total size of file being copied
  *
- * @return	bool		false if filename doesn't agree with directory
- * 				true otherwise
+ * @return	bool		true if the whole file was copied
+ *
+ * @see				diskhelpers.h
+ * @see				int getExtents(fat_volume*, int, fat_extent**)
+ * @see				int readAhead(fat_volume*, fat_extent*, int, int, int)
+ * @see				bool copyExtent(fat_volume*, int, int, off_t, off_t, size_t, bool*)
  ******************************************************************************/
 
-bool nameCompare(char *ptr, int directory_start, char *filename) {
+bool copyToNew(fat_volume *vol, int fd_from, int fd_to, int fat_entry, int64_t file_size) {
+	off_t copied = 0;
+
+	fat_extent *extents;
+	int count = getExtents(vol, fat_entry, &extents);
+	int advised = 0;
+	bool use_copy_range = true;
+
 	int i;
-	for(i = 0; i < 11; i++) {
-		if(filename[i] != ptr[directory_start+i]) return false;
+	for(i = 0; i < count && copied < file_size; i++) {
+		advised = readAhead(vol, extents, count, i, advised);
+
+		off_t from = getClusterOffset(vol, extents[i].start);
+		size_t bytes = (size_t)extents[i].length * vol->cluster_size;
+		if(bytes > (size_t)(file_size - copied)) bytes = file_size - copied;
+
+		if(!copyExtent(vol, fd_from, fd_to, from, copied, bytes, &use_copy_range)) break;
+		copied += bytes;
 	}
-	return true;
+
+	free(extents);
+	return copied == file_size;
 }
 
 
 /*******************************************************************************
- * function: findFile
+ * function: streamExtent
  *******************************************************************************
- * Recursively searches for the given file.
+ * Streams a byte range of the file image to the end of a pipe or file.
  *
- * Searches through all directories and subdirectories for the given filename
- * until it is found and gives the byte address in the file_index pointer.
+ * A pipe is filled with splice, which hands the pipe references to the page
+ * cache pages of the image rather than copies of them. Anything else gets
+ * sendfile, and if neither works the range is written out of the image
+ * mapping. Whichever one fails has its flag cleared so it is not tried again
+ * for later extents of the file; the flags belong to the caller, like the one
+ * of copyExtent. An image read with O_DIRECT is always written out of a buffer
+ * read from the block device.
  *
- * @param	char *ptr	a pointer to the first byte of the fs image
- * @param	int sector_num	sector number of directory
- * @param	bool *rest_free	ptr identifying if free directory is reached
- * @param	int *file_index	ptr that pointing to the byte address of the
- * 					file being searched for if found or -1
- * @param	char *filename	name of file being searched for
+ * @param	fat_volume *vol	volume context of the fs image
+ * @param	int fd_from	file descriptor of the fs image
+ * @param	int fd_to	file descriptor being streamed to
+ * @param	off_t from	byte offset in the fs image
+ * @param	size_t bytes	number of bytes to stream
+ * @param	bool *use_splice	true if splice may still be tried
+ * @param	bool *use_sendfile	true if sendfile may still be tried
  *
- * @return	void		no return value
+ * @return	bool		true if the whole range was streamed
  ******************************************************************************/
 
-void findFile(char *ptr, int sector_num, bool *rest_free, int *file_index, char *filename) {
-	//get number of the first value of the given sector
-	int directory_start = sector_num * BYTES_PER_SECTOR;
-
-	//loop until not an empty directory and not out of current sector and
-	//checks the file hasn't been found yet
-	while(ptr[directory_start] != 0x00 && directory_start < (sector_num + 1) * BYTES_PER_SECTOR && *file_index == -1) {
-		int attr = ptr[directory_start + 11];
-		int fat_entry = ptr[directory_start+26] + (ptr[directory_start+27] << 8);
-
-		//if not a volume label, sub-directory and not fat entry 0 or 1
-		//checks if the file is of the same name
-		if((attr & 0x08) == 0 && (attr & 0x10) == 0 && fat_entry != 0 && fat_entry != 1) {
-			if(nameCompare(ptr, directory_start, filename)) {
-				*file_index = directory_start;
-				return;
-			}
-		}
+bool streamExtent(fat_volume *vol, int fd_from, int fd_to, off_t from, size_t bytes, bool *use_splice, bool *use_sendfile) {
+	ssize_t done;
 
-		//if the directory is a subdirectory search it for the file of
-		//the given name
-		if((attr & 0x10) != 0 && ptr[directory_start] != '.') {
-			int fat_entry = ptr[directory_start+26] + (ptr[directory_start+27] << 8);
-			bool rest_sub_free = false;
+	if(vol->dev != NULL && vol->dev->backend == BLOCK_DIRECT) *use_splice = *use_sendfile = false;
 
-			//continue until there are no more directory listings
-			//or the file index has a value
-			while(!rest_sub_free && *file_index == -1) {
-				findFile(ptr, getSectorNum(fat_entry), &rest_sub_free, file_index, filename);
+	while(*use_splice && bytes > 0) {
+		done = splice(fd_from, &from, fd_to, NULL, bytes, SPLICE_F_MORE);
+		if(done > 0) {
+			bytes -= done;
+		} else if(done == 0) {
+			return false;
+		} else if(errno == EINVAL || errno == ENOSYS) {
+			*use_splice = false;
+		} else {
+			return false;
+		}
+	}
 
-				fat_entry = getFATEntry(ptr, fat_entry);
-				if(fat_entry == 0xfff) break;
-			}
+	while(*use_sendfile && bytes > 0) {
+		done = sendfile(fd_to, fd_from, &from, bytes);
+		if(done > 0) {
+			bytes -= done;
+		} else if(done == 0) {
+			return false;
+		} else if(errno == EINVAL || errno == ENOSYS) {
+			*use_sendfile = false;
+		} else {
+			return false;
 		}
+	}
+
+	char *buf = allocCopyBuffer(vol);
+	while(bytes > 0) {
+		size_t chunk = (vol->ptr == NULL && bytes > COPY_BUFFER) ? COPY_BUFFER : bytes;
+		done = write(fd_to, readImage(vol, from, chunk, buf), chunk);
+		if(done <= 0) break;
 
-		//increment to next directory start
-		directory_start += 0x20;
+		from += done;
+		bytes -= done;
 	}
 
-	//if 0x00 there are no more directories in this subdirectory
-	if(ptr[directory_start] == 0x00) *rest_free == true;
+	free(buf);
+	return bytes == 0;
 }
 
 
 /*******************************************************************************
- * function: main
+ * function: streamFile
  *******************************************************************************
- * Main execution for diskget.
+ * Streams a file of the fs image, in chain order, to a pipe or file that may
+ * not be seekable.
  *
- * @param	int argc	number of arguments passed during execution
- * @param	char *argv[]	vector of arguments passed during execution
+ * @param	fat_volume *vol	volume context of the fs image being copied from
+ * @param	int fd_from	file descriptor of the fs image
+ * @param	int fd_to	file descriptor being streamed to
+ * @param	int fat_entry	first FAT entry of the file
+ * @param	int64_t file_size	total size of file being copied
  *
- * @return	int		N/A
+ * @return	bool		true if the whole file was streamed
+ *
+ * @see				int getExtents(fat_volume*, int, fat_extent**)
+ * @see				int readAhead(fat_volume*, fat_extent*, int, int, int)
+ * @see				bool streamExtent(fat_volume*, int, int, off_t, size_t, bool*, bool*)
  ******************************************************************************/
 
-int main(int argc, char *argv[]) {
-	if(argc < 3) {
-		printf("ERROR: Usage \"diskget <disk_image> <file_name>\"\n");
-		exit(EXIT_FAILURE);
-	}
+bool streamFile(fat_volume *vol, int fd_from, int fd_to, int fat_entry, int64_t file_size) {
+	off_t copied = 0;
 
-	//opens the file as read only
-	int fd = open(argv[1], O_RDONLY);
-	if(fd < 0) {
-		printf("ERROR: Open failed\n");
-		EXIT_FAILURE;
+	fat_extent *extents;
+	int count = getExtents(vol, fat_entry, &extents);
+	int advised = 0;
+	bool use_splice = true, use_sendfile = true;
+
+	int i;
+	for(i = 0; i < count && copied < file_size; i++) {
+		advised = readAhead(vol, extents, count, i, advised);
+
+		off_t from = getClusterOffset(vol, extents[i].start);
+		size_t bytes = (size_t)extents[i].length * vol->cluster_size;
+		if(bytes > (size_t)(file_size - copied)) bytes = file_size - copied;
+
+		if(!streamExtent(vol, fd_from, fd_to, from, bytes, &use_splice, &use_sendfile)) break;
+		copied += bytes;
 	}
 
-	//create buffer for file statistics
-	struct stat buff;
-	fstat(fd, &buff);
+	free(extents);
+	return copied == file_size;
+}
 
-	//map ptr to file system image
-	char *ptr = mmap(0, buff.st_size, PROT_READ, MAP_SHARED, fd, 0);
 
-	if(ptr == MAP_FAILED) {
-		printf("ERROR: Failed to map file\n");
-		exit(EXIT_FAILURE);
+/*******************************************************************************
+ * function: extractFile
+ *******************************************************************************
+ * Copies one file of the fs image to the same path under the current
+ * directory.
+ *
+ * @param	extract_queue *queue	queue the file came from
+ * @param	int r		index record of the file
+ *
+ * @return	bool		true if the whole file was copied
+ *
+ * @see				bool copyToNew(fat_volume*, int, int, int, int64_t)
+ ******************************************************************************/
+
+bool extractFile(extract_queue *queue, int r) {
+	dir_record *record = &queue->idx->records[r];
+	char *path = recordPath(queue->idx, r) + queue->prefix;
+
+	int fd_new = open(path, O_WRONLY|O_CREAT|O_TRUNC, 0666);
+	if(fd_new < 0) {
+		printf("ERROR: Failed to open new file %s\n", path);
+		return false;
 	}
 
-	char *name = malloc(sizeof(char)), *ext = malloc(sizeof(char));
-	int i, name_count=0, ext_count=0;
-	bool found_period = false;
+	bool copied = copyToNew(queue->vol, queue->fd, fd_new, record->first_cluster, record->size);
+	if(!copied) printf("ERROR: Failed to copy file %s\n", path);
 
-	for(i = 0; i < strlen(argv[2]); i++) {
-		if(argv[2][i] == '.') {
-			found_period = true;
-		} else if(!found_period) {
-			name[name_count++] = argv[2][i];
-		} else {
-			ext[ext_count++] = argv[2][i];
+	close(fd_new);
+	return copied;
+}
+
+
+/*******************************************************************************
+ * function: extractWorker
+ *******************************************************************************
+ * Main execution of an extraction thread.
+ *
+ * Takes the next file off the shared queue and copies it until the queue is
+ * empty.
+ *
+ * @param	void *arg	the extract_queue shared by all workers
+ *
+ * @return	void*		NULL
+ *
+ * @see				bool extractFile(extract_queue*, int)
+ ******************************************************************************/
+
+void *extractWorker(void *arg) {
+	extract_queue *queue = (extract_queue *)arg;
+
+	while(true) {
+		if(pthread_mutex_lock(&queue->mutex) != 0) {
+			printf("ERROR: Failed to lock mutex\n");
+			exit(EXIT_FAILURE);
+		}
+
+		int next = queue->next < queue->count ? queue->files[queue->next++] : -1;
+
+		if(pthread_mutex_unlock(&queue->mutex) != 0) {
+			printf("ERROR: Failed to unlock mutex\n");
+			exit(EXIT_FAILURE);
+		}
+
+		if(next == -1) break;
+
+		if(!extractFile(queue, next)) {
+			pthread_mutex_lock(&queue->mutex);
+			queue->failed = true;
+			pthread_mutex_unlock(&queue->mutex);
 		}
 	}
 
-	if(name_count > 8) {
-		printf("ERROR: Too many characters for file name (>8)\n");
+	return NULL;
+}
+
+
+/*******************************************************************************
+ * function: compareSize
+ *******************************************************************************
+ * qsort comparison putting the records of larger files first.
+ *
+ * @param	const void *a	pointer to the first record number
+ * @param	const void *b	pointer to the second record number
+ *
+ * @return	int		negative if a is larger, positive if b is larger
+ ******************************************************************************/
+
+static dir_index *sort_idx;
+
+int compareSize(const void *a, const void *b) {
+	uint32_t size_a = sort_idx->records[*(int *)a].size;
+	uint32_t size_b = sort_idx->records[*(int *)b].size;
+
+	return (size_a < size_b) - (size_a > size_b);
+}
+
+
+/*******************************************************************************
+ * function: extractTree
+ *******************************************************************************
+ * Recreates a directory of the fs image and everything below it under the
+ * current directory.
+ *
+ * All directories are made first, then the files are handed out largest first
+ * so the last file to finish is a small one.
+ *
+ * @param	fat_volume *vol	volume context of the fs image
+ * @param	dir_index *idx	directory index of the fs image
+ * @param	int fd		file descriptor of the fs image
+ * @param	int dir		index record of the directory, -1 for root
+ * @param	int threads	number of worker threads
+ *
+ * @return	bool		true if every file was copied
+ *
+ * @see				void *extractWorker(void*)
+ ******************************************************************************/
+
+bool extractTree(fat_volume *vol, dir_index *idx, int fd, int dir, int threads) {
+	extract_queue queue;
+	queue.vol = vol;
+	queue.idx = idx;
+	queue.fd = fd;
+	queue.count = 0;
+	queue.next = 0;
+	queue.failed = false;
+
+	//the subtree keeps the name of the directory but not of its parents
+	char *dir_path = (dir == -1) ? "" : recordPath(idx, dir);
+	int dir_length = strlen(dir_path);
+	queue.prefix = (dir == -1) ? 0 : recordName(idx, dir) - dir_path;
+
+	queue.files = (int *)malloc((idx->count + 1) * sizeof(int));
+	if(queue.files == NULL) {
+		printf("ERROR: Failed to allocate extract queue\n");
 		exit(EXIT_FAILURE);
 	}
-	if(ext_count > 3) {
-		printf("ERROR: Too many characters for file extension (>3)\n");
-		exit(EXIT_FAILURE);
+
+	if(dir != -1 && mkdir(dir_path + queue.prefix, 0777) != 0 && errno != EEXIST) {
+		printf("ERROR: Failed to make directory %s\n", dir_path + queue.prefix);
+		return false;
+	}
+
+	//records come in traversal order so parents are made before children
+	int r;
+	for(r = 0; r < idx->count; r++) {
+		char *path = recordPath(idx, r);
+		if(dir != -1 && (strncmp(path, dir_path, dir_length) != 0 || path[dir_length] != '/')) continue;
+
+		if((idx->records[r].attr & 0x10) != 0) {
+			if(mkdir(path + queue.prefix, 0777) != 0 && errno != EEXIST) {
+				printf("ERROR: Failed to make directory %s\n", path + queue.prefix);
+				queue.failed = true;
+			}
+		} else if((idx->records[r].attr & 0x08) == 0) {
+			queue.files[queue.count++] = r;
+		}
 	}
-	if(name_count < 1) {
-		printf("ERROR: File name and extension must each have at least one character\n");
+
+	sort_idx = idx;
+	qsort(queue.files, queue.count, sizeof(int), compareSize);
+
+	if(pthread_mutex_init(&queue.mutex, NULL) != 0) {
+		printf("ERROR: Failed to initialize mutex\n");
 		exit(EXIT_FAILURE);
 	}
 
-	char *filename = (char *)malloc(11);
-	for(i = 0; i < 8; i++) {
-		if(i < name_count) filename[i] = name[i];
-		else filename[i] = ' ';
+	if(threads > queue.count) threads = queue.count;
+
+	pthread_t workers[MAX_THREADS];
+	int i;
+	for(i = 0; i < threads; i++) {
+		if(pthread_create(&workers[i], NULL, extractWorker, &queue) != 0) {
+			printf("ERROR: Failed to create pthread\n");
+			exit(EXIT_FAILURE);
+		}
 	}
-	for(i = 0; i < 3; i++) {
-		if(i < ext_count) filename[i+8] = ext[i];
-		else filename[i+8] = ' ';
+
+	for(i = 0; i < threads; i++) {
+		if(pthread_join(workers[i], NULL) != 0) {
+			printf("ERROR: Failed to join pthread\n");
+			exit(EXIT_FAILURE);
+		}
 	}
 
-	//initialize values provided in the header
-	getBasicInfo(ptr);
+	pthread_mutex_destroy(&queue.mutex);
+	free(queue.files);
+
+	return !queue.failed;
+}
 
-	int file_index = -1;
-	bool rest_free = false;
-	for(i = 0; i < SECTORS_FOR_ROOT; i++) {
-		findFile(ptr, ROOT_SECTOR_START+i, &rest_free, &file_index, filename);
 
-		if(file_index != -1 || rest_free) break;
+/*******************************************************************************
+ * function: main
+ *******************************************************************************
+ * Main execution for diskget.
+ *
+ * @param	int argc	number of arguments passed during execution
+ * @param	char *argv[]	vector of arguments passed during execution
+ *
+ * @return	int		N/A
+ ******************************************************************************/
+
+int main(int argc, char *argv[]) {
+	//-r extracts a directory and -t sets the number of threads it uses
+	bool recursive = false;
+	int threads = sysconf(_SC_NPROCESSORS_ONLN), opt;
+
+	while((opt = getopt(argc, argv, "rt:")) != -1) {
+		if(opt == 'r') recursive = true;
+		else if(opt == 't') threads = atoi(optarg);
+		else argc = 0;
 	}
 
-	if(file_index == -1) {
-		printf("File not found\n");
+	if(argc - optind < (recursive ? 1 : 2)) {
+		printf("ERROR: Usage \"diskget <disk_image> <file_name|path/to/file> [-]\"\n");
+		printf("       or    \"diskget -r [-t threads] <disk_image> [directory]\"\n");
 		exit(EXIT_FAILURE);
-	} else {
-		int file_size =
-			(ptr[file_index+28] & 0xff) +
-			((ptr[file_index+29] & 0xff) << 8) +
-			((ptr[file_index+30] & 0xff) << 16) +
-			((ptr[file_index+31] & 0xff) << 24);
+	}
 
-		int fd_new = open(argv[2], O_RDWR|O_CREAT, 0666);
-		if(fd_new < 0) {
-			printf("ERROR: Failed to open new file\n");
-			EXIT_FAILURE;
+	if(threads < 1) threads = 1;
+	if(threads > MAX_THREADS) threads = MAX_THREADS;
+
+	char *image_path = argv[optind];
+	char *name = (optind + 1 < argc) ? argv[optind + 1] : "/";
+
+	//finish a batch a writer committed but did not get to apply, the image
+	//stays locked shared until the tool is done with it
+	int lock = replayJournal(image_path, false);
+
+	//opens the file as read only through the backend picked for the run
+	block_device dev;
+	if(!openBlockDevice(&dev, image_path, getBackend())) {
+		printf("ERROR: Open failed\n");
+		exit(EXIT_FAILURE);
+	}
+	int fd = dev.fd;
+
+	//build the volume context and directory index for the image
+	fat_volume vol;
+	dir_index idx;
+	openDevice(&vol, &idx, &dev, image_path);
+
+	if(recursive) {
+		//an empty path or / is the root directory
+		int dir = -1;
+		while(*name == '/') name++;
+		if(*name != '\0') {
+			dir = findPath(&idx, name);
+			if(dir == -1 || (idx.records[dir].attr & 0x10) == 0) {
+				printf("Directory not found\n");
+				exit(EXIT_FAILURE);
+			}
 		}
 
-		int ret_val = lseek(fd_new, file_size-1, SEEK_SET);
-		if(ret_val == -1) {
-			printf("Failed to seek to end of new file\n");
+		if(!extractTree(&vol, &idx, fd, dir, threads)) exit(EXIT_FAILURE);
+	} else {
+		//a path is looked up from the root, a plain name anywhere in the
+		//tree
+		int r;
+		if(strchr(name, '/') != NULL) r = findPath(&idx, name);
+		else r = findName(&idx, name);
+
+		if(r == -1 || (idx.records[r].attr & 0x10) != 0) {
+			printf("File not found\n");
 			exit(EXIT_FAILURE);
 		}
 
-		ret_val = write(fd_new, "", 1);
-		if(ret_val !=  1) {
-			printf("Failed to write end of file byte\n");
-			exit(EXIT_FAILURE);
+		//- streams the file to stdout instead, where any error has to be
+		//kept out of the data
+		if(optind + 2 < argc && strcmp(argv[optind + 2], "-") == 0) {
+			if(!streamFile(&vol, fd, STDOUT_FILENO, idx.records[r].first_cluster, idx.records[r].size)) {
+				fprintf(stderr, "ERROR: Failed to copy file\n");
+				exit(EXIT_FAILURE);
+			}
+
+			freeIndex(&idx);
+			freeVolume(&vol);
+			closeBlockDevice(&dev);
+			close(lock);
+			return EXIT_SUCCESS;
 		}
 
-		char *ptr_new = mmap(NULL, file_size, PROT_WRITE, MAP_SHARED, fd_new, 0);
-		if(ptr_new == MAP_FAILED) {
-			printf("Failed to map new file\n");
+		//the file is written to the current directory under its own name
+		char *new_name = strrchr(name, '/');
+		new_name = (new_name == NULL) ? name : new_name + 1;
+
+		int fd_new = open(new_name, O_WRONLY|O_CREAT|O_TRUNC, 0666);
+		if(fd_new < 0) {
+			printf("ERROR: Failed to open new file\n");
 			exit(EXIT_FAILURE);
 		}
 
-		copyToNew(ptr, ptr_new, file_index, file_size);
+		if(!copyToNew(&vol, fd, fd_new, idx.records[r].first_cluster, idx.records[r].size)) {
+			printf("ERROR: Failed to copy file\n");
+			exit(EXIT_FAILURE);
+		}
 
-		munmap(ptr_new, file_size);
 		close(fd_new);
 	}
 
-	free(filename);
-	free(name);
-	free(ext);
-	munmap(ptr, buff.st_size);
-	close(fd);
+	freeIndex(&idx);
+	freeVolume(&vol);
+	closeBlockDevice(&dev);
+	close(lock);
 }
@@ -6,7 +6,10 @@
  *******************************************************************************
  * diskhelpers.c is a source file that contains certain data and methods that
  * are important to diskinfo, disklist, diskget and diskput for accessing
- * information about a FAT12 disk image.
+ * information about a FAT disk image.
+ *
+ * The FAT width is fixed when compiling by FAT_BITS, see diskhelpers.h, and
+ * the tools refuse images of any other width.
  *
  * These are specifically data and methods that will be used by more than one
  * of the above listed executables.
@@ -15,14 +18,21 @@
  * using any of this code.
  *
  * If using any methods in this file it is critical that getBasicInfo is called
- * first to initialize all critical data about the file system image that may be
- * necessary to other methods.
+ * first to build the fat_volume that every other method reads the disk geometry
+ * and the decoded FAT from, and that freeVolume is called once it is no longer
+ * needed.
  ******************************************************************************/
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
 
 #include "diskhelpers.h"
+#include "diskblock.h"
+#include "diskscan.h"
+#include "diskjournal.h"
 
 
 /*******************************************************************************
@@ -31,62 +41,336 @@
  * Get and calculate all critical data about the file system.
  *
  * Given a pointer to the start of the file system image this function explores
- * the boot sector for some of its basic disk geometry.
+ * the boot sector for some of its basic disk geometry and decodes every entry
+ * of the first FAT table so that later lookups are a plain array read.
  *
+ * @param	fat_volume *vol	volume context to initialize
  * @param	char *ptr	a pointer to the first byte of the fs image
  *
  * @return	void		no return value
  *
  * @see				diskhelpers.h
+ * @see				void getGeometry(fat_volume*, char*)
+ * @see				void decodeFAT(fat_volume*)
+ * @see				void freeVolume(fat_volume*)
  ******************************************************************************/
 
-void getBasicInfo(char *ptr) {
-	BYTES_PER_SECTOR = ptr[11] + ((ptr[12] & 0xff) << 8);
-	NUM_RESERVED_SECTORS = ptr[14] + ((ptr[15] & 0xff) << 8);
-	NUM_FATS = ptr[16];
-	SECTOR_COUNT = ptr[19] + ((ptr[20] & 0xff) << 8);
-	SECTORS_PER_FAT = ptr[22] + ((ptr[23] & 0xff) << 8);
+void getBasicInfo(fat_volume *vol, char *ptr) {
+	getGeometry(vol, ptr);
+	decodeFAT(vol);
+}
+
 
-	SECTORS_FOR_ROOT = ((ptr[17] & 0x000000ff) + ((ptr[18] & 0x000000ff) << 8)) * 32 / BYTES_PER_SECTOR;
+/*******************************************************************************
+ * function: getGeometry
+ *******************************************************************************
+ * Get the disk geometry from the boot sector without touching the FAT.
+ *
+ * Leaves the volume without a decoded FAT, which has to come from decodeFAT or
+ * from a sidecar index before any other method is used. Exits if the image
+ * isn't one the tools can read.
+ *
+ * @param	fat_volume *vol	volume context to initialize
+ * @param	char *ptr	a pointer to the first byte of the fs image
+ *
+ * @return	void		no return value
+ *
+ * @see				diskhelpers.h
+ * @see				bool checkGeometry(fat_volume*, char*, char*)
+ ******************************************************************************/
 
-	ROOT_SECTOR_START = NUM_RESERVED_SECTORS + (NUM_FATS * SECTORS_PER_FAT);
-	DATA_SECTOR_START =
-		NUM_RESERVED_SECTORS +
-		NUM_FATS * SECTORS_PER_FAT +
-		SECTORS_FOR_ROOT;
+void getGeometry(fat_volume *vol, char *ptr) {
+	char error[GEOMETRY_ERROR];
+	if(!checkGeometry(vol, ptr, error)) {
+		printf("ERROR: %s\n", error);
+		exit(EXIT_FAILURE);
+	}
 }
 
 
 /*******************************************************************************
- * function: getFATEntry
+ * function: checkGeometry
  *******************************************************************************
- * Get a 12 bit FAT entry.
+ * Get the disk geometry from the boot sector without touching the FAT, or say
+ * why the image can't be read.
  *
- * Given a value n, this method finds the value of the n-th FAT entry in the FAT
- * table.
+ * The same as getGeometry but it never exits, for the daemon, which has to
+ * carry on serving other images when one it is asked for is bad.
  *
+ * @param	fat_volume *vol	volume context to initialize
  * @param	char *ptr	a pointer to the first byte of the fs image
- * @param	int n		the entry to find
+ * @param	char *error	set to why the image can't be read, must hold
+ * 				GEOMETRY_ERROR bytes
  *
- * @return	int		the value of the n-th FAT entry
+ * @return	bool		false if the image can't be read
  *
  * @see				diskhelpers.h
  ******************************************************************************/
 
-int getFATEntry(char *ptr, int n) {
-	//get location of the start of the first FAT table
-	int fat_start = NUM_RESERVED_SECTORS * BYTES_PER_SECTOR;
+bool checkGeometry(fat_volume *vol, char *ptr, char *error) {
+	vol->ptr = ptr;
+	vol->dev = NULL;
 
-	int entry=0, first, second;
-	if((n%2) == 0) {
-		entry += (ptr[BYTES_PER_SECTOR + ((3*n) / 2) + 1] & 0x0f) << 8;
-		entry += ptr[BYTES_PER_SECTOR + ((3*n) / 2)] & 0xff;
-	} else {
-		entry += (ptr[BYTES_PER_SECTOR + (int)((3*n) / 2)] & 0xf0) >> 4;
-		entry += (ptr[BYTES_PER_SECTOR + (int)((3*n) / 2) + 1] & 0xff) << 4;
+	vol->bytes_per_sector = (ptr[11] & 0xff) + ((ptr[12] & 0xff) << 8);
+	vol->sectors_per_cluster = ptr[13] & 0xff;
+	vol->num_reserved_sectors = (ptr[14] & 0xff) + ((ptr[15] & 0xff) << 8);
+	vol->num_fats = ptr[16] & 0xff;
+	vol->sector_count = (ptr[19] & 0xff) + ((ptr[20] & 0xff) << 8);
+	vol->sectors_per_fat = (ptr[22] & 0xff) + ((ptr[23] & 0xff) << 8);
+
+	if(vol->bytes_per_sector == 0 || vol->bytes_per_sector > MAX_SECTOR_SIZE || vol->sectors_per_cluster == 0 || vol->num_fats == 0) {
+		snprintf(error, GEOMETRY_ERROR, "Not a FAT disk image");
+		return false;
 	}
 
-	return entry;
+	//large volumes keep their sector count, and FAT32 its FAT size, in
+	//32 bit fields instead
+	if(vol->sector_count == 0) {
+		vol->sector_count =
+			(ptr[32] & 0xff) +
+			((ptr[33] & 0xff) << 8) +
+			((ptr[34] & 0xff) << 16) +
+			((int64_t)(ptr[35] & 0xff) << 24);
+	}
+	if(vol->sectors_per_fat == 0) {
+		vol->sectors_per_fat =
+			(ptr[36] & 0xff) +
+			((ptr[37] & 0xff) << 8) +
+			((ptr[38] & 0xff) << 16) +
+			((ptr[39] & 0x7f) << 24);
+	}
+
+	vol->cluster_size = vol->sectors_per_cluster * vol->bytes_per_sector;
+
+	int root_entries = (ptr[17] & 0xff) + ((ptr[18] & 0xff) << 8);
+	vol->sectors_for_root = (root_entries * 32 + vol->bytes_per_sector - 1) / vol->bytes_per_sector;
+
+	vol->root_sector_start = vol->num_reserved_sectors + (int64_t)vol->num_fats * vol->sectors_per_fat;
+	vol->data_sector_start =
+		vol->num_reserved_sectors +
+		vol->num_fats * vol->sectors_per_fat +
+		vol->sectors_for_root;
+
+	vol->fat_start = vol->num_reserved_sectors * vol->bytes_per_sector;
+
+	//a boot sector that leaves no room for the FAT or the data region
+	//isn't one
+	if(vol->sectors_per_fat == 0 || vol->sector_count <= vol->data_sector_start) {
+		snprintf(error, GEOMETRY_ERROR, "Not a FAT disk image");
+		return false;
+	}
+
+	//one entry for each data cluster plus the two reserved entries, but
+	//never more than the FAT table can actually hold
+	int64_t clusters = (vol->sector_count - vol->data_sector_start) / vol->sectors_per_cluster;
+	int64_t fat_capacity = (int64_t)vol->sectors_per_fat * vol->bytes_per_sector * 8 / FAT_BITS;
+	vol->num_entries = (clusters + 2 < fat_capacity) ? clusters + 2 : fat_capacity;
+
+	//the number of clusters is what decides the FAT width of a volume
+	int bits = (clusters < 4085) ? 12 : (clusters < 65525) ? 16 : 32;
+	if(bits != FAT_BITS) {
+		snprintf(error, GEOMETRY_ERROR, "Disk image is FAT%d but the tools were built for FAT%d", bits, FAT_BITS);
+		return false;
+	}
+
+	//a FAT32 root directory is a cluster chain like any other directory
+	vol->root_cluster = 0;
+#if FAT_BITS == 32
+	vol->root_cluster =
+		(ptr[44] & 0xff) +
+		((ptr[45] & 0xff) << 8) +
+		((ptr[46] & 0xff) << 16) +
+		((ptr[47] & 0x0f) << 24);
+	vol->root_sector_start = getSectorNum(vol, vol->root_cluster);
+#endif
+
+	vol->fat = NULL;
+	vol->sidecar = NULL;
+	vol->sidecar_size = 0;
+
+	vol->free_map = NULL;
+	vol->free_count = -1;
+	vol->next_free = 2;
+
+	vol->dirty_low = vol->num_entries;
+	vol->dirty_high = -1;
+	vol->dirty_map = NULL;
+
+	vol->slot_cache = NULL;
+	vol->slot_cache_size = 0;
+	vol->slot_cache_count = 0;
+
+	vol->journal = NULL;
+
+	char *readahead = getenv("DISK_READAHEAD");
+	vol->readahead = (readahead == NULL) ? READAHEAD_DEFAULT : atoi(readahead);
+	if(vol->readahead < 0) vol->readahead = 0;
+
+	return true;
+}
+
+
+/*******************************************************************************
+ * function: readImage
+ *******************************************************************************
+ * Get the bytes of a range of the image.
+ *
+ * A mapped image is read in place and the buffer isn't touched. Otherwise the
+ * range is read through the block device of the volume into the buffer, which
+ * must hold length bytes.
+ *
+ * @param	fat_volume *vol	volume context
+ * @param	int64_t offset	byte offset of the range in the image
+ * @param	size_t length	number of bytes in the range
+ * @param	char *buf	buffer to read into if the image isn't mapped
+ *
+ * @return	char*		pointer to the first byte of the range
+ *
+ * @see				diskhelpers.h
+ * @see				diskblock.h
+ ******************************************************************************/
+
+char *readImage(fat_volume *vol, int64_t offset, size_t length, char *buf) {
+	if(vol->ptr != NULL) return vol->ptr + offset;
+
+	if(!readBlocks(vol->dev, offset, buf, length)) {
+		fprintf(stderr, "ERROR: Failed to read disk image\n");
+		exit(EXIT_FAILURE);
+	}
+
+	return buf;
+}
+
+
+/*******************************************************************************
+ * function: adviseImage
+ *******************************************************************************
+ * Tell the kernel a range of the image will be read soon.
+ *
+ * Only a hint, the range is read in the background while the caller carries on
+ * and nothing is reported if the kernel doesn't take it.
+ *
+ * @param	fat_volume *vol	volume context
+ * @param	int64_t offset	byte offset of the range in the image
+ * @param	size_t length	number of bytes in the range
+ *
+ * @return	void		no return value
+ *
+ * @see				diskhelpers.h
+ * @see				diskblock.h
+ ******************************************************************************/
+
+void adviseImage(fat_volume *vol, int64_t offset, size_t length) {
+	if(vol->ptr == NULL) {
+		adviseBlocks(vol->dev, offset, length);
+		return;
+	}
+
+	//madvise takes a range starting on a page
+	int64_t start = offset - offset % sysconf(_SC_PAGESIZE);
+	madvise(vol->ptr + start, length + (offset - start), MADV_WILLNEED);
+}
+
+
+/*******************************************************************************
+ * function: decodeFAT
+ *******************************************************************************
+ * Decode every entry of the first FAT table into the volume.
+ *
+ * The table is unpacked by the decoder for the width the tools are built for,
+ * which also counts the free entries for the volume. The free count stored in
+ * the FSInfo sector of a FAT32 image is taken instead when it is valid.
+ *
+ * @param	fat_volume *vol	volume context with its geometry
+ *
+ * @return	void		no return value
+ *
+ * @see				diskhelpers.h
+ * @see				diskscan.h
+ * @see				bool readFreeHint(fat_volume*, int*, int*)
+ ******************************************************************************/
+
+void decodeFAT(fat_volume *vol) {
+	vol->fat = (fat_entry_t *)malloc(vol->num_entries * sizeof(fat_entry_t));
+	if(vol->fat == NULL) {
+		printf("ERROR: Failed to allocate FAT cache\n");
+		exit(EXIT_FAILURE);
+	}
+
+	//an image that isn't mapped has its FAT read in one go
+	size_t fat_size = (size_t)vol->sectors_per_fat * vol->bytes_per_sector;
+	char *buf = NULL;
+	if(vol->ptr == NULL && (buf = (char *)malloc(fat_size)) == NULL) {
+		printf("ERROR: Failed to allocate FAT cache\n");
+		exit(EXIT_FAILURE);
+	}
+
+	//the free entries are counted on the way so getFreeSpace never has to
+	fat_counts counts;
+	unpackFAT((unsigned char *)readImage(vol, vol->fat_start, fat_size, buf), vol->num_entries, vol->fat, &counts);
+	vol->free_count = counts.free;
+
+	//a valid FSInfo count is trusted over it, the way other FAT drivers
+	//trust it, and diskcheck is what finds one that is wrong
+	int hint, next;
+	if(readFreeHint(vol, &hint, &next) && hint >= 0) vol->free_count = hint;
+
+	free(buf);
+}
+
+
+/*******************************************************************************
+ * function: freeVolume
+ *******************************************************************************
+ * Release everything getBasicInfo allocated for the volume.
+ *
+ * The disk image mapping itself belongs to the caller and is left untouched.
+ * If the FAT was mapped from a sidecar index that mapping is released, so any
+ * index loaded with it must not be used afterwards.
+ *
+ * @param	fat_volume *vol	volume context to release
+ *
+ * @return	void		no return value
+ *
+ * @see				diskhelpers.h
+ ******************************************************************************/
+
+void freeVolume(fat_volume *vol) {
+	if(vol->sidecar != NULL) munmap(vol->sidecar, vol->sidecar_size);
+	else free(vol->fat);
+	free(vol->free_map);
+	free(vol->dirty_map);
+	free(vol->slot_cache);
+	vol->fat = NULL;
+	vol->sidecar = NULL;
+	vol->free_map = NULL;
+	vol->dirty_map = NULL;
+	vol->slot_cache = NULL;
+	vol->num_entries = 0;
+}
+
+
+/*******************************************************************************
+ * function: getFATEntry
+ *******************************************************************************
+ * Get a FAT entry.
+ *
+ * Given a value n, this method finds the value of the n-th FAT entry in the
+ * decoded FAT. Entries outside of the table read as end of chain so a corrupt
+ * chain can never walk off the end of it.
+ *
+ * @param	fat_volume *vol	volume context
+ * @param	int n		the entry to find
+ *
+ * @return	int		the value of the n-th FAT entry
+ *
+ * @see				diskhelpers.h
+ ******************************************************************************/
+
+int getFATEntry(fat_volume *vol, int n) {
+	if(n < 0 || n >= vol->num_entries) return FAT_EOC;
+
+	return vol->fat[n];
 }
 
 
@@ -95,28 +379,39 @@ int getFATEntry(char *ptr, int n) {
  *******************************************************************************
  * Calculate the number of free bytes in the file image.
  *
- * Check all FAT entries and count the number of free sectors in the file
- * image. Multiplied by the number of bytes per sector we calculate the total
- * amount of free space available.
+ * Check all FAT entries and count the number of free clusters in the file
+ * image. Multiplied by the number of bytes per cluster we calculate the total
+ * amount of free space available. The count is remembered in the volume and
+ * kept up to date by setFAT so it is only ever counted once.
  *
- * @param	char *ptr	a pointer to the first byte of the fs image
+ * @param	fat_volume *vol	volume context
  *
- * @return	int		number of bytes of free space in the image
+ * @return	int64_t		number of bytes of free space in the image
  *
  * @see				diskhelpers.h
- * @see				int getFATEntry(char*, int)
  ******************************************************************************/
 
-int getFreeSpace(char *ptr) {
-	int free_sectors = 0, i;
+int64_t getFreeSpace(fat_volume *vol) {
+	if(vol->free_count >= 0) return (int64_t)vol->free_count * vol->cluster_size;
+
+	int free_clusters = 0, i;
 
-	//in FAT12 should be entry 2 through 2848
-	//check each of those to see if they are free i.e. 0x000
-	for(i = 2; i < SECTOR_COUNT - DATA_SECTOR_START + 2; i++) {
-		if(getFATEntry(ptr, i) == 0x000) free_sectors++;
+	if(vol->dirty_low > vol->dirty_high && vol->ptr != NULL) {
+		//the table in the image matches the decoded FAT so it can be
+		//counted straight from the packed entries
+		fat_counts counts;
+		unpackFAT((unsigned char *)vol->ptr + vol->fat_start, vol->num_entries, NULL, &counts);
+		free_clusters = counts.free;
+	} else {
+		//check every entry after the two reserved ones to see if it is
+		//free i.e. 0x000
+		for(i = 2; i < vol->num_entries; i++) {
+			if(vol->fat[i] == 0x000) free_clusters++;
+		}
 	}
 
-	return free_sectors * BYTES_PER_SECTOR;
+	vol->free_count = free_clusters;
+	return (int64_t)free_clusters * vol->cluster_size;
 }
 
 
@@ -125,16 +420,720 @@ int getFreeSpace(char *ptr) {
  *******************************************************************************
  * Get the physical sector location.
  *
- * Given the FAT entry value calculate the sector number associated with the
- * value.
+ * Given the FAT entry value calculate the number of the first sector of the
+ * cluster associated with the value.
+ *
+ * @param	fat_volume *vol	volume context
+ * @param	int fat_entry	FAT entry value
+ *
+ * @return	int64_t		the sector number
+ *
+ * @see				diskhelpers.h
+ ******************************************************************************/
+
+int64_t getSectorNum(fat_volume *vol, int fat_entry) {
+	return (int64_t)(fat_entry - 2) * vol->sectors_per_cluster + vol->data_sector_start;
+}
+
+
+/*******************************************************************************
+ * function: getClusterOffset
+ *******************************************************************************
+ * Get the byte offset of a cluster in the image.
  *
+ * @param	fat_volume *vol	volume context
  * @param	int fat_entry	FAT entry value
  *
- * @return	int		the sector number
+ * @return	int64_t		byte offset of the first byte of the cluster
+ *
+ * @see				diskhelpers.h
+ * @see				int64_t getSectorNum(fat_volume*, int)
+ ******************************************************************************/
+
+int64_t getClusterOffset(fat_volume *vol, int fat_entry) {
+	return getSectorNum(vol, fat_entry) * vol->bytes_per_sector;
+}
+
+
+/*******************************************************************************
+ * function: getEntryCluster
+ *******************************************************************************
+ * Get the first cluster of a directory entry.
+ *
+ * FAT32 keeps the high 16 bits of the cluster at offset 20 of the entry, which
+ * FAT12 and FAT16 don't use.
+ *
+ * @param	char *entry	pointer to the 32 byte directory entry
+ *
+ * @return	int		the first cluster of the entry
+ ******************************************************************************/
+
+int getEntryCluster(char *entry) {
+	int cluster = (entry[26] & 0xff) + ((entry[27] & 0xff) << 8);
+
+#if FAT_BITS == 32
+	cluster += ((entry[20] & 0xff) << 16) + ((entry[21] & 0x0f) << 24);
+#endif
+
+	return cluster;
+}
+
+
+/*******************************************************************************
+ * function: setEntryCluster
+ *******************************************************************************
+ * Set the first cluster of a directory entry.
+ *
+ * @param	char *entry	pointer to the 32 byte directory entry
+ * @param	int cluster	the first cluster of the entry
+ *
+ * @return	void		no return value
+ ******************************************************************************/
+
+void setEntryCluster(char *entry, int cluster) {
+	entry[26] = cluster & 0xff;
+	entry[27] = (cluster >> 8) & 0xff;
+
+#if FAT_BITS == 32
+	entry[20] = (cluster >> 16) & 0xff;
+	entry[21] = (cluster >> 24) & 0x0f;
+#endif
+}
+
+
+/*******************************************************************************
+ * function: advanceNextFree
+ *******************************************************************************
+ * Move next_free up past the used entries at it.
+ *
+ * next_free only ever drops to an entry that is freed, so it only has to move
+ * once the entry at it is used, and then only past the used entries that
+ * follow. Nothing below it is free either way.
+ *
+ * @param	fat_volume *vol	volume context
+ *
+ * @return	void		no return value
+ ******************************************************************************/
+
+static void advanceNextFree(fat_volume *vol) {
+	while(vol->next_free < vol->num_entries && vol->fat[vol->next_free] != 0x000) vol->next_free++;
+}
+
+
+/*******************************************************************************
+ * function: setFAT
+ *******************************************************************************
+ * Sets a FAT value.
+ *
+ * Changes the entry in the decoded FAT, keeps the free map, free count and
+ * first free entry of the volume in sync and remembers the entry and the
+ * sectors of the table it is packed into as dirty. Nothing is written to the
+ * image until flushFAT is called, so a whole batch of changes reaches the FAT
+ * table in one pass.
+ *
+ * @param	fat_volume *vol	volume context of a writable diskimage
+ * @param	int fat_entry	fat entry to write
+ * @param	int val		value to write to fat table
+ *
+ * @return	void		no return value
+ *
+ * @see				diskhelpers.h
+ * @see				void flushFAT(fat_volume*)
+ ******************************************************************************/
+
+void setFAT(fat_volume *vol, int fat_entry, int val) {
+	//only when the entry changes between free and used does the free map
+	//and count need to change
+	if((vol->fat[fat_entry] == 0x000) != (val == 0x000)) {
+		if(vol->free_map != NULL) vol->free_map[fat_entry / 64] ^= (uint64_t)1 << (fat_entry % 64);
+		if(vol->free_count >= 0) vol->free_count += (val == 0x000) ? 1 : -1;
+		if(val == 0x000 && fat_entry < vol->next_free) vol->next_free = fat_entry;
+	}
+
+	vol->fat[fat_entry] = val;
+
+	advanceNextFree(vol);
+
+	if(fat_entry < vol->dirty_low) vol->dirty_low = fat_entry;
+	if(fat_entry > vol->dirty_high) vol->dirty_high = fat_entry;
+
+	if(vol->dirty_map == NULL) {
+		vol->dirty_map = (uint64_t *)calloc((vol->sectors_per_fat + 63) / 64, sizeof(uint64_t));
+		if(vol->dirty_map == NULL) {
+			printf("ERROR: Failed to allocate dirty map\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	//a FAT12 entry can straddle two sectors
+	int sector = ((int64_t)fat_entry * FAT_BITS / 8) / vol->bytes_per_sector;
+	int last_sector = (((int64_t)fat_entry * FAT_BITS + FAT_BITS - 1) / 8) / vol->bytes_per_sector;
+	for(; sector <= last_sector; sector++) {
+		vol->dirty_map[sector / 64] |= (uint64_t)1 << (sector % 64);
+	}
+}
+
+
+/*******************************************************************************
+ * function: packEntries
+ *******************************************************************************
+ * Pack a run of decoded entries back into the first FAT table.
+ *
+ * FAT12 entries are packed back into 12 bits two at a time, starting on an
+ * even entry so each pair fills exactly three bytes of the table. FAT16 and
+ * FAT32 entries are written back one at a time.
+ *
+ * @param	fat_volume *vol	volume context of a writable diskimage
+ * @param	int low		first entry to pack
+ * @param	int high	last entry to pack
+ *
+ * @return	void		no return value
+ ******************************************************************************/
+
+static void packEntries(fat_volume *vol, int low, int high) {
+	unsigned char *fat = (unsigned char *)vol->ptr + vol->fat_start;
+	int n;
+
+#if FAT_BITS == 12
+	for(n = low & ~1; n <= high; n += 2) {
+		int even = vol->fat[n];
+		unsigned char *group = fat + (3*n) / 2;
+
+		group[0] = even & 0xff;
+
+		//the last entry may not have a partner in the table
+		if(n + 1 == vol->num_entries) {
+			group[1] = (group[1] & 0xf0) | ((even >> 8) & 0x0f);
+			break;
+		}
+
+		int odd = vol->fat[n+1];
+		group[1] = ((even >> 8) & 0x0f) | ((odd << 4) & 0xf0);
+		group[2] = (odd >> 4) & 0xff;
+	}
+#elif FAT_BITS == 16
+	for(n = low; n <= high; n++) {
+		fat[2*n] = vol->fat[n] & 0xff;
+		fat[2*n+1] = (vol->fat[n] >> 8) & 0xff;
+	}
+#else
+	//the top four bits of a FAT32 entry are reserved and kept as they are
+	for(n = low; n <= high; n++) {
+		fat[4*n] = vol->fat[n] & 0xff;
+		fat[4*n+1] = (vol->fat[n] >> 8) & 0xff;
+		fat[4*n+2] = (vol->fat[n] >> 16) & 0xff;
+		fat[4*n+3] = (fat[4*n+3] & 0xf0) | ((vol->fat[n] >> 24) & 0x0f);
+	}
+#endif
+}
+
+
+/*******************************************************************************
+ * function: isDirtySector
+ *******************************************************************************
+ * Check whether a sector of the FAT has changed since flushFAT.
+ *
+ * @param	fat_volume *vol	volume context
+ * @param	int sector	sector number within the FAT
+ *
+ * @return	bool		true if an entry in the sector changed
+ ******************************************************************************/
+
+static bool isDirtySector(fat_volume *vol, int sector) {
+	return (vol->dirty_map[sector / 64] >> (sector % 64)) & 1;
+}
+
+
+/*******************************************************************************
+ * function: flushFAT
+ *******************************************************************************
+ * Write every entry changed by setFAT back to every FAT table.
+ *
+ * Only runs of sectors marked in the dirty map are touched. The entries of a
+ * run are packed into the first FAT and the run is then copied to the same
+ * place in every mirror FAT, so the copies stay identical while each changed
+ * sector is written just once per table. The sectors changed are marked for
+ * the journal of a journaled volume.
+ *
+ * The free space hint of the volume is brought up to date along with the FAT,
+ * so every tool that writes to an image keeps it right.
+ *
+ * @param	fat_volume *vol	volume context of a writable diskimage
+ *
+ * @return	void		no return value
+ *
+ * @see				diskhelpers.h
+ * @see				void setFAT(fat_volume*, int, int)
+ * @see				void writeFreeHint(fat_volume*)
+ ******************************************************************************/
+
+void flushFAT(fat_volume *vol) {
+	writeFreeHint(vol);
+	if(vol->dirty_low > vol->dirty_high) return;
+
+	int bps = vol->bytes_per_sector;
+	int64_t fat_size = (int64_t)vol->sectors_per_fat * bps;
+	int sector = ((int64_t)vol->dirty_low * FAT_BITS / 8) / bps;
+	int last_sector = (((int64_t)vol->dirty_high * FAT_BITS + FAT_BITS - 1) / 8) / bps;
+
+	while(sector <= last_sector) {
+		if(!isDirtySector(vol, sector)) {
+			sector++;
+			continue;
+		}
+
+		int end = sector;
+		while(end <= last_sector && isDirtySector(vol, end)) end++;
+
+		//every entry with a bit in the run is packed again
+		int low = ((int64_t)sector * bps * 8) / FAT_BITS;
+		int high = ((int64_t)end * bps * 8 - 1) / FAT_BITS;
+		if(high >= vol->num_entries) high = vol->num_entries - 1;
+		packEntries(vol, low, high);
+
+		int64_t offset = vol->fat_start + (int64_t)sector * bps;
+		int64_t length = (int64_t)(end - sector) * bps;
+		markWritten(vol, offset, length, true);
+
+		int i;
+		for(i = 1; i < vol->num_fats; i++) {
+			memcpy(vol->ptr + offset + i * fat_size, vol->ptr + offset, length);
+			markWritten(vol, offset + i * fat_size, length, true);
+		}
+
+		sector = end;
+	}
+
+	memset(vol->dirty_map, 0, ((vol->sectors_per_fat + 63) / 64) * sizeof(uint64_t));
+	vol->dirty_low = vol->num_entries;
+	vol->dirty_high = -1;
+}
+
+
+/*******************************************************************************
+ * function: getInfoField
+ *******************************************************************************
+ * Get a 32 bit little endian field of the FSInfo sector.
+ *
+ * @param	unsigned char *field	pointer to the first byte of the field
+ *
+ * @return	uint32_t	value of the field
+ ******************************************************************************/
+
+static uint32_t getInfoField(unsigned char *field) {
+	return field[0] + (field[1] << 8) + (field[2] << 16) + ((uint32_t)field[3] << 24);
+}
+
+
+/*******************************************************************************
+ * function: getInfo
+ *******************************************************************************
+ * Find the FSInfo sector of a FAT32 image.
+ *
+ * The boot sector gives its sector number, which has to be one of the reserved
+ * sectors, and the sector has to carry all three of its signatures.
+ *
+ * @param	fat_volume *vol	volume context
+ * @param	char *buf	512 bytes to read the sector into if the image
+ * 				isn't mapped
+ * @param	int64_t *offset	set to the byte offset of the sector
+ *
+ * @return	unsigned char*	first byte of the sector, NULL if there is no
+ * 				valid one
+ ******************************************************************************/
+
+static unsigned char *getInfo(fat_volume *vol, char *buf, int64_t *offset) {
+#if FAT_BITS == 32
+	unsigned char *boot = (unsigned char *)readImage(vol, 0, 512, buf);
+	int sector = boot[48] + (boot[49] << 8);
+	if(sector == 0 || sector >= vol->num_reserved_sectors) return NULL;
+
+	*offset = (int64_t)sector * vol->bytes_per_sector;
+	unsigned char *info = (unsigned char *)readImage(vol, *offset, 512, buf);
+
+	if(getInfoField(info) != 0x41615252 ||
+			getInfoField(info + 484) != 0x61417272 ||
+			getInfoField(info + 508) != 0xaa550000) {
+		return NULL;
+	}
+
+	return info;
+#else
+	(void)vol;
+	(void)buf;
+	(void)offset;
+	return NULL;
+#endif
+}
+
+
+/*******************************************************************************
+ * function: readFreeHint
+ *******************************************************************************
+ * Get the free cluster count and next free cluster stored in the image.
+ *
+ * Only FAT32 has a place for them, the FSInfo sector. Either one may be
+ * 0xffffffff when whoever wrote it didn't know, which is given back as -1, and
+ * a count larger than the volume is given back as -1 as well.
+ *
+ * @param	fat_volume *vol	volume context
+ * @param	int *free_count	set to the stored free cluster count
+ * @param	int *next_free	set to the stored next free cluster
+ *
+ * @return	bool		false if the image has no valid FSInfo sector
+ *
+ * @see				diskhelpers.h
+ ******************************************************************************/
+
+bool readFreeHint(fat_volume *vol, int *free_count, int *next_free) {
+	char buf[512];
+	int64_t offset;
+	unsigned char *info = getInfo(vol, buf, &offset);
+	if(info == NULL) return false;
+
+	uint32_t count = getInfoField(info + 488);
+	uint32_t next = getInfoField(info + 492);
+
+	*free_count = (count <= (uint32_t)vol->num_entries - 2) ? (int)count : -1;
+	*next_free = (next >= 2 && next < (uint32_t)vol->num_entries) ? (int)next : -1;
+	return true;
+}
+
+
+/*******************************************************************************
+ * function: writeFreeHint
+ *******************************************************************************
+ * Store the free cluster count and next free cluster of the volume in the
+ * image.
+ *
+ * Only FAT32 has a place for them, the FSInfo sector, and an image without a
+ * valid one is left alone. The next free cluster is next_free as setFAT keeps
+ * it, only moved past the used entries at the start of the FAT if no setFAT
+ * has yet. The sector is only written, and marked for the journal, if either
+ * value changed.
+ *
+ * @param	fat_volume *vol	volume context of a writable diskimage
+ *
+ * @return	void		no return value
+ *
+ * @see				diskhelpers.h
+ * @see				void setFAT(fat_volume*, int, int)
+ ******************************************************************************/
+
+void writeFreeHint(fat_volume *vol) {
+	int64_t offset;
+	unsigned char *info = getInfo(vol, NULL, &offset);
+	if(info == NULL) return;
+
+	advanceNextFree(vol);
+	bool full = vol->free_count == 0 || vol->next_free >= vol->num_entries;
+
+	uint32_t count = (vol->free_count >= 0) ? (uint32_t)vol->free_count : 0xffffffff;
+	uint32_t values[2] = {count, full ? 0xffffffff : (uint32_t)vol->next_free};
+
+	unsigned char *field = info + 488;
+	if(getInfoField(field) == values[0] && getInfoField(field + 4) == values[1]) return;
+
+	int i, b;
+	for(i = 0; i < 2; i++) {
+		for(b = 0; b < 4; b++) field[4*i + b] = (values[i] >> (8*b)) & 0xff;
+	}
+
+	markWritten(vol, offset + 488, 8, true);
+}
+
+
+/*******************************************************************************
+ * function: buildFreeMap
+ *******************************************************************************
+ * Build the free cluster bitmap used by the allocator.
+ *
+ * One bit per FAT entry is set when the entry is free. Entries 0 and 1 are
+ * reserved and never marked free. After this is called setFAT keeps the map
+ * and its free count in sync, so it only has to be built once per volume.
+ *
+ * @param	fat_volume *vol	volume context
+ *
+ * @return	void		no return value
  *
  * @see				diskhelpers.h
  ******************************************************************************/
 
-int getSectorNum(int fat_entry) {
-	return fat_entry + DATA_SECTOR_START - 2;
+void buildFreeMap(fat_volume *vol) {
+	if(vol->free_map != NULL) return;
+
+	int words = (vol->num_entries + 63) / 64;
+	vol->free_map = (uint64_t *)calloc(words, sizeof(uint64_t));
+	if(vol->free_map == NULL) {
+		printf("ERROR: Failed to allocate free cluster map\n");
+		exit(EXIT_FAILURE);
+	}
+
+	int i;
+	vol->free_count = 0;
+	for(i = 2; i < vol->num_entries; i++) {
+		if(vol->fat[i] == 0x000) {
+			vol->free_map[i / 64] |= (uint64_t)1 << (i % 64);
+			vol->free_count++;
+		}
+	}
+}
+
+
+/*******************************************************************************
+ * function: scanFreeMap
+ *******************************************************************************
+ * Find the first entry at or after start whose free bit equals the one given.
+ *
+ * Works a 64 bit word at a time, using find first set on each word so a run of
+ * used (or free) clusters is skipped without looking at its entries.
+ *
+ * @param	fat_volume *vol	volume context with a built free map
+ * @param	int start	first entry to look at
+ * @param	bool free	true to look for a free entry, false for used
+ *
+ * @return	int		the entry found or num_entries if there is none
+ ******************************************************************************/
+
+static int scanFreeMap(fat_volume *vol, int start, bool free) {
+	int words = (vol->num_entries + 63) / 64;
+	int word = start / 64;
+
+	if(start >= vol->num_entries) return vol->num_entries;
+
+	//mask off the bits before start in the first word
+	uint64_t bits = free ? vol->free_map[word] : ~vol->free_map[word];
+	bits &= ~(uint64_t)0 << (start % 64);
+
+	while(bits == 0) {
+		if(++word >= words) return vol->num_entries;
+		bits = free ? vol->free_map[word] : ~vol->free_map[word];
+	}
+
+	int entry = word * 64 + __builtin_ctzll(bits);
+	return (entry < vol->num_entries) ? entry : vol->num_entries;
+}
+
+
+/*******************************************************************************
+ * function: findFreeCluster
+ *******************************************************************************
+ * Finds the next free FAT entry.
+ *
+ * Searches the free map from start to the end of the FAT and then wraps around
+ * to entry 2, building the map first if it does not exist yet.
+ *
+ * @param	fat_volume *vol	volume context
+ * @param	int start	entry to start searching at
+ *
+ * @return	int		a free FAT entry or -1 if the disk is full
+ *
+ * @see				diskhelpers.h
+ ******************************************************************************/
+
+int findFreeCluster(fat_volume *vol, int start) {
+	buildFreeMap(vol);
+	if(vol->free_count == 0) return -1;
+
+	if(start < 2) start = 2;
+
+	int entry = scanFreeMap(vol, start, true);
+	if(entry == vol->num_entries) entry = scanFreeMap(vol, 2, true);
+
+	return (entry == vol->num_entries) ? -1 : entry;
+}
+
+
+/*******************************************************************************
+ * function: findFreeRun
+ *******************************************************************************
+ * Finds the next run of contiguous free FAT entries.
+ *
+ * Searches the free map from start to the end of the FAT without wrapping and
+ * measures how many free entries follow the first one found.
+ *
+ * @param	fat_volume *vol	volume context
+ * @param	int start	entry to start searching at
+ * @param	int *run_length	set to the number of free entries in the run
+ *
+ * @return	int		first entry of the run or -1 if there is none
+ *
+ * @see				diskhelpers.h
+ ******************************************************************************/
+
+int findFreeRun(fat_volume *vol, int start, int *run_length) {
+	buildFreeMap(vol);
+	if(start < 2) start = 2;
+
+	int entry = scanFreeMap(vol, start, true);
+	if(entry == vol->num_entries) {
+		*run_length = 0;
+		return -1;
+	}
+
+	*run_length = scanFreeMap(vol, entry, false) - entry;
+	return entry;
+}
+
+
+/*******************************************************************************
+ * function: reserveExtent
+ *******************************************************************************
+ * Reserve a run of contiguous free FAT entries and chain them together.
+ *
+ * Looks at every free run on the disk. If any run can hold all of the wanted
+ * entries the smallest of those is used so large holes are kept for large
+ * files, otherwise the largest run is used. The entries of the run are linked
+ * to each other in one pass and the last one is marked as end of chain so the
+ * caller only has to link it to whatever extent comes next.
+ *
+ * @param	fat_volume *vol	volume context of a writable diskimage
+ * @param	int want	number of entries still needed
+ * @param	int *length	set to the number of entries reserved
+ *
+ * @return	int		first entry of the extent or -1 if the disk is
+ * 				full
+ *
+ * @see				diskhelpers.h
+ * @see				int findFreeRun(fat_volume*, int, int*)
+ ******************************************************************************/
+
+int reserveExtent(fat_volume *vol, int want, int *length) {
+	int best = -1, best_length = 0;
+	int start = 2, run, run_length;
+
+	while((run = findFreeRun(vol, start, &run_length)) != -1) {
+		if(run_length >= want) {
+			if(best_length < want || run_length < best_length) {
+				best = run;
+				best_length = run_length;
+			}
+
+			if(run_length == want) break;
+		} else if(run_length > best_length && best_length < want) {
+			best = run;
+			best_length = run_length;
+		}
+
+		start = run + run_length;
+	}
+
+	if(best == -1) {
+		*length = 0;
+		return -1;
+	}
+
+	if(best_length > want) best_length = want;
+
+	int i;
+	for(i = best; i < best + best_length - 1; i++) {
+		setFAT(vol, i, i + 1);
+	}
+	setFAT(vol, best + best_length - 1, FAT_EOC);
+
+	*length = best_length;
+	return best;
+}
+
+
+/*******************************************************************************
+ * function: getExtents
+ *******************************************************************************
+ * Follow a FAT chain and merge consecutive entries into extents.
+ *
+ * The chain is followed until end of chain or a free or reserved entry. A
+ * chain can never be longer than the FAT so following stops after that many
+ * links, which keeps a cyclic chain from looping forever.
+ *
+ * @param	fat_volume *vol	volume context
+ * @param	int first_entry	first FAT entry of the chain
+ * @param	fat_extent **extents
+ * 				set to a malloced array of extents that the
+ * 					caller must free
+ *
+ * @return	int		number of extents in the array
+ *
+ * @see				diskhelpers.h
+ ******************************************************************************/
+
+int getExtents(fat_volume *vol, int first_entry, fat_extent **extents) {
+	int count = 0, capacity = 8, links = 0;
+	int fat_entry = first_entry;
+
+	*extents = (fat_extent *)malloc(capacity * sizeof(fat_extent));
+	if(*extents == NULL) {
+		printf("ERROR: Failed to allocate extent list\n");
+		exit(EXIT_FAILURE);
+	}
+
+	while(fat_entry >= 2 && fat_entry < vol->num_entries && links++ < vol->num_entries) {
+		//extend the last extent if this entry directly follows it
+		if(count > 0 && (*extents)[count-1].start + (*extents)[count-1].length == fat_entry) {
+			(*extents)[count-1].length++;
+		} else {
+			if(count == capacity) {
+				capacity *= 2;
+				*extents = (fat_extent *)realloc(*extents, capacity * sizeof(fat_extent));
+				if(*extents == NULL) {
+					printf("ERROR: Failed to allocate extent list\n");
+					exit(EXIT_FAILURE);
+				}
+			}
+
+			(*extents)[count].start = fat_entry;
+			(*extents)[count].length = 1;
+			count++;
+		}
+
+		fat_entry = getFATEntry(vol, fat_entry);
+	}
+
+	return count;
+}
+
+
+/*******************************************************************************
+ * function: readAhead
+ *******************************************************************************
+ * Ask for the extents of a chain that come after the one about to be read.
+ *
+ * The kernel only reads ahead of a file read in order, and a fragmented chain
+ * jumps around the image. Instead the extents are advised in chain order until
+ * the volume's readahead window of links past the current extent has been
+ * asked for, so they are being read while the earlier ones are copied. Called
+ * before reading each extent, only the extents not yet advised are.
+ *
+ * @param	fat_volume *vol	volume context
+ * @param	fat_extent *extents	extents of the chain, from getExtents
+ * @param	int count	number of extents
+ * @param	int current	extent about to be read
+ * @param	int advised	number of extents already advised, 0 at first
+ *
+ * @return	int		number of extents advised so far, to pass back
+ * 				in for the next extent
+ *
+ * @see				diskhelpers.h
+ * @see				void adviseImage(fat_volume*, int64_t, size_t)
+ ******************************************************************************/
+
+int readAhead(fat_volume *vol, fat_extent *extents, int count, int current, int advised) {
+	if(vol->readahead == 0) return count;
+
+	//links already asked for past the start of the current extent
+	int64_t ahead = 0;
+	int i;
+	for(i = current; i < advised; i++) ahead += extents[i].length;
+
+	//a long extent is only asked for up to the end of the window, the
+	//kernel reads ahead of it on its own once it is being read in order
+	while(advised < count && ahead <= vol->readahead) {
+		int length = extents[advised].length;
+		if(length > vol->readahead) length = vol->readahead;
+
+		adviseImage(vol, getClusterOffset(vol, extents[advised].start), (size_t)length * vol->cluster_size);
+		ahead += extents[advised].length;
+		advised++;
+	}
+
+	return advised;
 }
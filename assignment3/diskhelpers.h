@@ -10,34 +10,162 @@
 #ifndef DISK_HELPERS_H_
 #define DISK_HELPERS_H_
 
+#include <stdint.h>
+#include <stddef.h>
+
 //defined for code coherency
 typedef enum {false, true} bool;
 
 
 /*******************************************************************************
- * DISK ATTRIBUTE DECLARATIONS
+ * FAT WIDTH
+ *******************************************************************************
+ * The tools are built for one FAT width, 12, 16 or 32 bits per entry, given as
+ * FAT_BITS when compiling. Everything that depends on the width is settled by
+ * the preprocessor so decoding an entry never has to branch on it.
+ ******************************************************************************/
+
+#ifndef FAT_BITS
+#define FAT_BITS 12
+#endif
+
+#if FAT_BITS == 12
+typedef uint16_t fat_entry_t;
+#define FAT_EOC 0xfff			//value written to end a chain
+#define FAT_EOC_MIN 0xff8		//any entry from here up ends a chain
+#define FAT_BAD 0xff7			//marks a cluster that can't be used
+#elif FAT_BITS == 16
+typedef uint16_t fat_entry_t;
+#define FAT_EOC 0xffff
+#define FAT_EOC_MIN 0xfff8
+#define FAT_BAD 0xfff7
+#elif FAT_BITS == 32
+typedef uint32_t fat_entry_t;
+#define FAT_EOC 0x0fffffff
+#define FAT_EOC_MIN 0x0ffffff8
+#define FAT_BAD 0x0ffffff7
+#else
+#error "FAT_BITS must be 12, 16 or 32"
+#endif
+
+#define isEndOfChain(entry)	((entry) >= FAT_EOC_MIN)
+
+#define MAX_SECTOR_SIZE 4096	//largest sector a FAT boot sector can give
+#define GEOMETRY_ERROR 128	//room for why checkGeometry refused an image
+#define READAHEAD_DEFAULT 1024	//links of a chain read ahead unless
+				//DISK_READAHEAD says
+
+
+/*******************************************************************************
+ * DIRECTORY SLOT
+ *******************************************************************************
+ * Where the search for a free entry in a directory picks up again. Every
+ * entry of the directory before it is known to be in use.
+ ******************************************************************************/
+
+typedef struct dir_slot {
+	int dir_cluster;		//first cluster of the directory, 0 for the
+					//fixed root, -1 if the slot is unused
+	int cluster;			//cluster of the directory the entry is in
+	int entry;			//number of the entry within that cluster
+} dir_slot;
+
+
+/*******************************************************************************
+ * VOLUME CONTEXT
+ *******************************************************************************
+ * Everything known about an open disk image. Built once by getBasicInfo and
+ * passed to every method that needs the disk geometry or the FAT.
  ******************************************************************************/
 
-int BYTES_PER_SECTOR;		//number of bytes in a sector
-int NUM_RESERVED_SECTORS;	//reserved sectors in the disk image
-int NUM_FATS;			//number of copies of the FAT table
-int SECTOR_COUNT;		//total number of sectors
-int SECTORS_PER_FAT;		//number of sectors in each FAT table
+typedef struct fat_volume {
+	char *ptr;			//pointer to the first byte of the fs image,
+					//NULL if it is read through dev
+	struct block_device *dev;	//device the image is read through if it
+					//isn't mapped, see readImage
+
+	int bytes_per_sector;		//number of bytes in a sector
+	int sectors_per_cluster;	//number of sectors in a cluster
+	int cluster_size;		//number of bytes in a cluster
+	int num_reserved_sectors;	//reserved sectors in the disk image
+	int num_fats;			//number of copies of the FAT table
+	int64_t sector_count;		//total number of sectors
+	int sectors_per_fat;		//number of sectors in each FAT table
+
+	int sectors_for_root;		//number of sectors reserved for root directory
+	int root_cluster;		//first cluster of a FAT32 root, 0 otherwise
+
+	int64_t root_sector_start;	//sector number where the root directory starts
+	int data_sector_start;		//sector number of the first non reserved space
+
+	int fat_start;			//byte offset of the first FAT table
+	int num_entries;		//number of FAT entries, including 0 and 1
+	fat_entry_t *fat;		//every entry of the first FAT, decoded
+
+	char *sidecar;			//sidecar index mapping fat points into
+	size_t sidecar_size;		//size of the sidecar index mapping
+
+	uint64_t *free_map;		//one bit per FAT entry, set when free
+	int free_count;			//number of free clusters, -1 if unknown
+	int next_free;			//no entry below this one is free
+
+	int dirty_low;			//lowest entry changed since flushFAT
+	int dirty_high;			//highest entry changed since flushFAT
+	uint64_t *dirty_map;		//one bit per sector of the FAT, set when
+					//an entry in it changed since flushFAT
 
-int SECTORS_FOR_ROOT;		//number of sectors reserved for root directory
+	dir_slot *slot_cache;		//hash table of the directories written to
+	int slot_cache_size;		//number of slots, always a power of two
+	int slot_cache_count;		//number of slots in use
 
-int ROOT_SECTOR_START;		//sector number where the root directory starts
-int DATA_SECTOR_START;		//sector number of the first non reserved space
+	struct disk_journal *journal;	//uncommitted writes, NULL if not journaled
+
+	int readahead;			//links of a chain asked for ahead of the
+					//one being read, 0 for none
+} fat_volume;
+
+
+/*******************************************************************************
+ * EXTENT
+ *******************************************************************************
+ * A run of consecutive FAT entries that follow each other in a chain, which
+ * is also a run of consecutive clusters in the data region.
+ ******************************************************************************/
+
+typedef struct fat_extent {
+	int start;			//first FAT entry of the extent
+	int length;			//number of entries in the extent
+} fat_extent;
 
 
 /*******************************************************************************
  * FUNCTION DECLARATIONS
  ******************************************************************************/
 
-void getBasicInfo(char *ptr);
-int getFATEntry(char *ptr, int n);
-int getFreeSpace(char *ptr);
-int getSectorNum(int entry_num);
+void getBasicInfo(fat_volume *vol, char *ptr);
+void getGeometry(fat_volume *vol, char *ptr);
+bool checkGeometry(fat_volume *vol, char *ptr, char *error);
+char *readImage(fat_volume *vol, int64_t offset, size_t length, char *buf);
+void adviseImage(fat_volume *vol, int64_t offset, size_t length);
+void decodeFAT(fat_volume *vol);
+void freeVolume(fat_volume *vol);
+int getFATEntry(fat_volume *vol, int n);
+int64_t getFreeSpace(fat_volume *vol);
+int64_t getSectorNum(fat_volume *vol, int fat_entry);
+int64_t getClusterOffset(fat_volume *vol, int fat_entry);
+int getEntryCluster(char *entry);
+void setEntryCluster(char *entry, int cluster);
+void setFAT(fat_volume *vol, int fat_entry, int val);
+void flushFAT(fat_volume *vol);
+bool readFreeHint(fat_volume *vol, int *free_count, int *next_free);
+void writeFreeHint(fat_volume *vol);
+
+void buildFreeMap(fat_volume *vol);
+int findFreeCluster(fat_volume *vol, int start);
+int findFreeRun(fat_volume *vol, int start, int *run_length);
+int reserveExtent(fat_volume *vol, int want, int *length);
+int getExtents(fat_volume *vol, int first_entry, fat_extent **extents);
+int readAhead(fat_volume *vol, fat_extent *extents, int count, int current, int advised);
 
 
 #endif //DISK_HELPERS_H_
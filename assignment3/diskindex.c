@@ -0,0 +1,1043 @@
+/***** diskindex.c *************************************************************
+ * University of Victoria
+ * CSC 360 Fall 2018
+ * Italo Borrelli
+ * V00884840
+ *******************************************************************************
+ * diskindex.c is a source file that builds an in-memory index of every file
+ * and subdirectory of a FAT disk image.
+ *
+ * The directory tree is walked once, by several threads, and each entry is
+ * recorded with its byte offset, first cluster, size and attributes. Records
+ * are hashed by their full path, e.g. "SUBLAYER/MSGSEND.C", and by their file
+ * name alone so that a lookup by either takes constant time instead of a walk
+ * of the directories.
+ *
+ * Lookups are not case sensitive since names on the disk are upper case.
+ *
+ * When the DISK_INDEX environment variable is set the decoded FAT, free count
+ * and index are also kept in a sidecar file named after the image with
+ * .fatidx added. The sidecar is mapped back in by later runs as long as the
+ * checksum of the first FAT and the root directory it was built from still
+ * matches the image, and is rebuilt when it doesn't. Tools that write to the
+ * image save a fresh sidecar when they finish.
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+
+#include "diskindex.h"
+#include "disktree.h"
+
+#define MAX_DEPTH 128		//max depth of directories
+#define MIN_BUCKETS 64		//number of buckets in an empty index
+
+#define SIDECAR_MAGIC "FATIDX1"	//first bytes of every sidecar index
+#define SIDECAR_VERSION 3	//bumped whenever the layout below changes
+#define SIDECAR_SUFFIX ".fatidx"	//added to the image path
+
+
+/*******************************************************************************
+ * SIDECAR HEADER
+ *******************************************************************************
+ * Start of a sidecar index file. The sections it points to follow it in the
+ * file, each starting on an 8 byte boundary.
+ ******************************************************************************/
+
+typedef struct sidecar_header {
+	char magic[8];			//SIDECAR_MAGIC
+	uint32_t version;		//SIDECAR_VERSION
+	uint32_t fat_bits;		//FAT_BITS of the tools that wrote it
+	uint32_t bytes_per_sector;	//geometry the index was built for
+	uint32_t sectors_per_cluster;
+	uint32_t sectors_per_fat;
+	uint64_t sector_count;
+	uint64_t checksum;		//checksum of the first FAT and root directory
+	uint64_t image_size;		//size of the image file when it was written
+	int64_t image_mtime;		//its modification time in nanoseconds
+
+	int32_t num_entries;		//number of decoded FAT entries
+	int32_t free_count;		//number of free FAT entries
+	int32_t record_count;		//number of directory index records
+	int32_t num_buckets;		//number of buckets in each bucket array
+	int32_t names_length;		//number of bytes of names
+
+	uint64_t fat_offset;		//byte offset of each section in the file
+	uint64_t records_offset;
+	uint64_t path_buckets_offset;
+	uint64_t name_buckets_offset;
+	uint64_t names_offset;
+	uint64_t total_size;		//size of the whole file
+} sidecar_header;
+
+
+/*******************************************************************************
+ * function: hashName
+ *******************************************************************************
+ * FNV-1a hash of a name or path, ignoring case.
+ *
+ * @param	char *name	nul terminated name to hash
+ *
+ * @return	uint32_t	the hash
+ ******************************************************************************/
+
+static uint32_t hashName(char *name) {
+	uint32_t hash = 2166136261u;
+
+	while(*name != '\0') {
+		hash ^= (unsigned char)toupper((unsigned char)*name++);
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+
+/*******************************************************************************
+ * function: rehashIndex
+ *******************************************************************************
+ * Resize both bucket arrays and put every record back into them.
+ *
+ * @param	dir_index *idx	index to rehash
+ * @param	int num_buckets	new number of buckets, a power of two
+ *
+ * @return	void		no return value
+ ******************************************************************************/
+
+static void rehashIndex(dir_index *idx, int num_buckets) {
+	free(idx->path_buckets);
+	free(idx->name_buckets);
+
+	idx->num_buckets = num_buckets;
+	idx->path_buckets = (int32_t *)malloc(num_buckets * sizeof(int32_t));
+	idx->name_buckets = (int32_t *)malloc(num_buckets * sizeof(int32_t));
+	if(idx->path_buckets == NULL || idx->name_buckets == NULL) {
+		printf("ERROR: Failed to allocate directory index\n");
+		exit(EXIT_FAILURE);
+	}
+
+	memset(idx->path_buckets, 0xff, num_buckets * sizeof(int32_t));
+	memset(idx->name_buckets, 0xff, num_buckets * sizeof(int32_t));
+
+	//insert in reverse so every bucket lists its records in traversal order
+	int r;
+	for(r = idx->count - 1; r >= 0; r--) {
+		uint32_t path_bucket = hashName(recordPath(idx, r)) & (num_buckets - 1);
+		uint32_t name_bucket = hashName(recordName(idx, r)) & (num_buckets - 1);
+
+		idx->records[r].next_path = idx->path_buckets[path_bucket];
+		idx->path_buckets[path_bucket] = r;
+		idx->records[r].next_name = idx->name_buckets[name_bucket];
+		idx->name_buckets[name_bucket] = r;
+	}
+}
+
+
+/*******************************************************************************
+ * function: copyIndex
+ *******************************************************************************
+ * Copy the arrays of an index mapped from a sidecar into memory of its own.
+ *
+ * @param	dir_index *idx	mapped index to copy
+ *
+ * @return	void		no return value
+ ******************************************************************************/
+
+static void copyIndex(dir_index *idx) {
+	dir_record *records = (dir_record *)malloc(idx->capacity * sizeof(dir_record));
+	int32_t *path_buckets = (int32_t *)malloc(idx->num_buckets * sizeof(int32_t));
+	int32_t *name_buckets = (int32_t *)malloc(idx->num_buckets * sizeof(int32_t));
+	char *names = (char *)malloc(idx->names_capacity);
+
+	if(records == NULL || path_buckets == NULL || name_buckets == NULL || names == NULL) {
+		printf("ERROR: Failed to allocate directory index\n");
+		exit(EXIT_FAILURE);
+	}
+
+	memcpy(records, idx->records, idx->count * sizeof(dir_record));
+	memcpy(path_buckets, idx->path_buckets, idx->num_buckets * sizeof(int32_t));
+	memcpy(name_buckets, idx->name_buckets, idx->num_buckets * sizeof(int32_t));
+	memcpy(names, idx->names, idx->names_length);
+
+	idx->records = records;
+	idx->path_buckets = path_buckets;
+	idx->name_buckets = name_buckets;
+	idx->names = names;
+	idx->mapped = false;
+}
+
+
+/*******************************************************************************
+ * function: formatName
+ *******************************************************************************
+ * Turns the 11 byte name of a directory entry into a readable file name.
+ *
+ * Padding is removed from the name and extension and the two are joined by a
+ * period unless there is no extension, e.g. "README  TXT" gives "README.TXT".
+ *
+ * @param	char *entry	pointer to the first byte of the directory entry
+ * @param	char *name	char array of at least 13 bytes to modify
+ *
+ * @return	void		no return value
+ *
+ * @see				diskindex.h
+ ******************************************************************************/
+
+void formatName(char *entry, char *name) {
+	int i, length = 0;
+
+	for(i = 0; i < 8 && entry[i] != ' '; i++) {
+		name[length++] = entry[i];
+	}
+
+	//0x05 stands in for a name that really starts with 0xe5
+	if(length > 0 && (entry[0] & 0xff) == 0x05) name[0] = (char)0xe5;
+
+	if(entry[8] != ' ') {
+		name[length++] = '.';
+		for(i = 8; i < 11 && entry[i] != ' '; i++) {
+			name[length++] = entry[i];
+		}
+	}
+
+	name[length] = '\0';
+}
+
+
+/*******************************************************************************
+ * function: addRecord
+ *******************************************************************************
+ * Add a directory entry to the index.
+ *
+ * The full path of the entry is built from the path of its parent directory.
+ * Used by the traversal in buildIndex and by anything that writes a new
+ * directory entry and wants the index to stay current.
+ *
+ * @param	dir_index *idx	index to add to
+ * @param	int parent	record of the parent directory, -1 for root
+ * @param	char *entry	pointer to the first byte of the directory entry
+ * @param	int64_t offset	byte offset of the directory entry in the image
+ *
+ * @return	int		the new record
+ *
+ * @see				diskindex.h
+ ******************************************************************************/
+
+int addRecord(dir_index *idx, int parent, char *entry, int64_t offset) {
+	char name[13];
+	formatName(entry, name);
+
+	//arrays mapped from a sidecar can't grow so take a copy first
+	if(idx->mapped) copyIndex(idx);
+
+	//make room for the record and its path
+	if(idx->count == idx->capacity) {
+		idx->capacity *= 2;
+		idx->records = (dir_record *)realloc(idx->records, idx->capacity * sizeof(dir_record));
+	}
+
+	int parent_length = (parent == -1) ? 0 : strlen(recordPath(idx, parent)) + 1;
+	int path_length = parent_length + strlen(name) + 1;
+	while(idx->names_length + path_length > idx->names_capacity) {
+		idx->names_capacity *= 2;
+		idx->names = (char *)realloc(idx->names, idx->names_capacity);
+	}
+
+	if(idx->records == NULL || idx->names == NULL) {
+		printf("ERROR: Failed to allocate directory index\n");
+		exit(EXIT_FAILURE);
+	}
+
+	int r = idx->count++;
+	dir_record *record = &idx->records[r];
+	char *path = idx->names + idx->names_length;
+
+	if(parent != -1) {
+		memcpy(path, recordPath(idx, parent), parent_length - 1);
+		path[parent_length - 1] = '/';
+	}
+	strcpy(path + parent_length, name);
+
+	record->offset = offset;
+	record->first_cluster = getEntryCluster(entry);
+	record->size =
+		(entry[28] & 0xff) +
+		((entry[29] & 0xff) << 8) +
+		((entry[30] & 0xff) << 16) +
+		((uint32_t)(entry[31] & 0xff) << 24);
+	record->parent = parent;
+	record->path = idx->names_length;
+	record->name = idx->names_length + parent_length;
+	record->attr = entry[11];
+
+	idx->names_length += path_length;
+
+	//keep the buckets no more than half full, otherwise just chain the new
+	//record onto the end of its buckets
+	if(idx->count * 2 > idx->num_buckets) {
+		rehashIndex(idx, idx->num_buckets * 2);
+		return r;
+	}
+
+	record->next_path = -1;
+	record->next_name = -1;
+
+	int32_t *link = &idx->path_buckets[hashName(path) & (idx->num_buckets - 1)];
+	while(*link != -1) link = &idx->records[*link].next_path;
+	*link = r;
+
+	link = &idx->name_buckets[hashName(name) & (idx->num_buckets - 1)];
+	while(*link != -1) link = &idx->records[*link].next_name;
+	*link = r;
+
+	return r;
+}
+
+
+/*******************************************************************************
+ * INDEX MERGE
+ *******************************************************************************
+ * What the merge of a walk adds the entries it found to.
+ ******************************************************************************/
+
+typedef struct index_merge {
+	fat_volume *vol;		//volume context
+	dir_index *idx;			//index to add to
+} index_merge;
+
+
+/*******************************************************************************
+ * function: isSafeName
+ *******************************************************************************
+ * Check whether the name of a directory entry can be used as a host path
+ * component.
+ *
+ * A damaged or crafted image can hold names that a valid one never does, and
+ * diskget makes files and directories on the host under the names in the
+ * index, so a name that is empty, "." or "..", or that has a slash in it,
+ * is left out of the index.
+ *
+ * @param	char *entry	pointer to the first byte of the directory entry
+ *
+ * @return	bool		true if the name is safe to use on the host
+ ******************************************************************************/
+
+static bool isSafeName(char *entry) {
+	char name[13];
+	formatName(entry, name);
+
+	return name[0] != '\0' && strcmp(name, ".") != 0 && strcmp(name, "..") != 0 && strchr(name, '/') == NULL;
+}
+
+
+/*******************************************************************************
+ * function: indexRange
+ *******************************************************************************
+ * Finds every entry in a byte range of a directory that belongs in the index.
+ *
+ * The offset of each entry and the entry itself are written to the output of
+ * the directory and each subdirectory is handed to the walk right after its
+ * own entry, so the merge adds the entries in the same order a walk on one
+ * thread would without reading the image again.
+ *
+ * @param	tree_walk *walk	walk of the disk image
+ * @param	tree_dir *dir	directory being scanned
+ * @param	int worker	thread scanning the directory
+ * @param	int64_t offset	byte offset of the first entry of the range
+ * @param	int64_t end	byte offset right after the range
+ * @param	char *bytes	the bytes of the range
+ *
+ * @return	bool		false once the end of the directory is reached
+ ******************************************************************************/
+
+static bool indexRange(tree_walk *walk, tree_dir *dir, int worker, int64_t offset, int64_t end, char *bytes) {
+	for(; offset < end; offset += 0x20, bytes += 0x20) {
+		char *entry = bytes;
+		int attr = entry[11] & 0xff;
+
+		//0x00 marks the end of the directory
+		if(entry[0] == 0x00) return false;
+
+		//skip deleted entries, long file names, volume labels and the .
+		//and .. entries
+		if((entry[0] & 0xff) == 0xe5 || attr == 0x0f || (attr & 0x08) != 0 || entry[0] == '.') continue;
+		if(!isSafeName(entry)) continue;
+
+		fwrite(&offset, sizeof(offset), 1, dir->out);
+		fwrite(entry, 0x20, 1, dir->out);
+
+		//a directory that contains one of its ancestors is cut off by the
+		//depth limit of the walk
+		if((attr & 0x10) != 0 && getEntryCluster(entry) >= 2) {
+			treeChild(walk, dir, entry, worker);
+		}
+	}
+
+	return true;
+}
+
+
+/*******************************************************************************
+ * function: allocRange
+ *******************************************************************************
+ * Allocates a buffer for a range of a directory read from an image that isn't
+ * mapped.
+ *
+ * @param	size_t length	number of bytes in the range
+ *
+ * @return	char*		malloced buffer that the caller must free
+ ******************************************************************************/
+
+static char *allocRange(size_t length) {
+	char *buf = (char *)malloc(length);
+	if(buf == NULL) {
+		printf("ERROR: Failed to allocate directory buffer\n");
+		exit(EXIT_FAILURE);
+	}
+
+	return buf;
+}
+
+
+/*******************************************************************************
+ * function: indexDirectory
+ *******************************************************************************
+ * Finds every entry of one directory that belongs in the index.
+ *
+ * The root directory is given as first cluster 0. On FAT12 and FAT16 it is the
+ * fixed region between the FATs and the data region, on FAT32 it is a chain
+ * like any other directory. A chain is read one extent at a time, in one
+ * read if the image isn't mapped, with the extents after it read ahead. The
+ * scan stops at the first entry starting with 0x00.
+ *
+ * @param	tree_walk *walk	walk of the disk image
+ * @param	tree_dir *dir	directory to scan
+ * @param	int worker	thread scanning the directory
+ *
+ * @return	void		no return value
+ ******************************************************************************/
+
+static void indexDirectory(tree_walk *walk, tree_dir *dir, int worker) {
+	fat_volume *vol = walk->vol;
+	int first_cluster = dir->first_cluster;
+	fat_extent *extents;
+	int count, i;
+	char *buf = NULL;
+
+	if(first_cluster == 0) {
+		if(vol->root_cluster == 0) {
+			int64_t offset = vol->root_sector_start * vol->bytes_per_sector;
+			size_t length = (size_t)vol->sectors_for_root * vol->bytes_per_sector;
+
+			if(vol->ptr == NULL) buf = allocRange(length);
+			indexRange(walk, dir, worker, offset, offset + length, readImage(vol, offset, length, buf));
+			free(buf);
+			return;
+		}
+
+		first_cluster = vol->root_cluster;
+	}
+
+	count = getExtents(vol, first_cluster, &extents);
+	int advised = 0;
+
+	for(i = 0; i < count; i++) {
+		advised = readAhead(vol, extents, count, i, advised);
+
+		int64_t offset = getClusterOffset(vol, extents[i].start);
+		size_t length = (size_t)extents[i].length * vol->cluster_size;
+
+		if(vol->ptr == NULL) {
+			free(buf);
+			buf = allocRange(length);
+		}
+
+		if(!indexRange(walk, dir, worker, offset, offset + length, readImage(vol, offset, length, buf))) break;
+	}
+
+	free(buf);
+	free(extents);
+}
+
+
+/*******************************************************************************
+ * function: addEntries
+ *******************************************************************************
+ * Adds the entries found in a piece of a directory to the index.
+ *
+ * @param	tree_dir *dir	directory the entries are in
+ * @param	char *bytes	byte offset of each entry followed by the entry
+ * @param	size_t length	number of bytes of offsets and entries
+ * @param	void *arg	pointer to the index_merge
+ *
+ * @return	void		no return value
+ ******************************************************************************/
+
+static void addEntries(tree_dir *dir, char *bytes, size_t length, void *arg) {
+	index_merge *merge = (index_merge *)arg;
+	size_t i;
+
+	for(i = 0; i + sizeof(int64_t) + 0x20 <= length; i += sizeof(int64_t) + 0x20) {
+		int64_t offset;
+		memcpy(&offset, bytes + i, sizeof(offset));
+		addRecord(merge->idx, dir->record, bytes + i + sizeof(offset), offset);
+	}
+}
+
+
+/*******************************************************************************
+ * function: enterDirectory
+ *******************************************************************************
+ * Gives a subdirectory the record of its entry, which is always the last one
+ * added before the merge reaches it.
+ *
+ * @param	tree_dir *parent	directory the subdirectory is in
+ * @param	tree_dir *child	subdirectory about to be merged
+ * @param	void *arg	pointer to the index_merge
+ *
+ * @return	void		no return value
+ ******************************************************************************/
+
+static void enterDirectory(tree_dir *parent, tree_dir *child, void *arg) {
+	(void)parent;
+	child->record = ((index_merge *)arg)->idx->count - 1;
+}
+
+
+/*******************************************************************************
+ * function: buildIndex
+ *******************************************************************************
+ * Build the index of every file and subdirectory in the disk image.
+ *
+ * @param	fat_volume *vol	volume context
+ * @param	dir_index *idx	index to initialize
+ *
+ * @return	void		no return value
+ *
+ * @see				diskindex.h
+ * @see				void freeIndex(dir_index*)
+ * @see				tree_dir *walkTree(fat_volume*, tree_scan, void*, int)
+ ******************************************************************************/
+
+void buildIndex(fat_volume *vol, dir_index *idx) {
+	idx->count = 0;
+	idx->capacity = MIN_BUCKETS;
+	idx->records = (dir_record *)malloc(idx->capacity * sizeof(dir_record));
+
+	idx->names_length = 0;
+	idx->names_capacity = MIN_BUCKETS * 16;
+	idx->names = (char *)malloc(idx->names_capacity);
+
+	idx->path_buckets = NULL;
+	idx->name_buckets = NULL;
+	idx->mapped = false;
+	rehashIndex(idx, MIN_BUCKETS);
+
+	if(idx->records == NULL || idx->names == NULL) {
+		printf("ERROR: Failed to allocate directory index\n");
+		exit(EXIT_FAILURE);
+	}
+
+	//the directories are scanned on several threads but the records are
+	//only added by this one, in the order of the tree
+	index_merge merge = {vol, idx};
+	tree_dir *root = walkTree(vol, indexDirectory, NULL, MAX_DEPTH);
+	mergeTree(root, addEntries, enterDirectory, &merge);
+	freeTree(root);
+}
+
+
+/*******************************************************************************
+ * function: freeIndex
+ *******************************************************************************
+ * Release everything buildIndex allocated for the index. A mapped index is
+ * released along with its volume by freeVolume instead.
+ *
+ * @param	dir_index *idx	index to release
+ *
+ * @return	void		no return value
+ *
+ * @see				diskindex.h
+ ******************************************************************************/
+
+void freeIndex(dir_index *idx) {
+	if(!idx->mapped) {
+		free(idx->records);
+		free(idx->path_buckets);
+		free(idx->name_buckets);
+		free(idx->names);
+	}
+
+	idx->records = NULL;
+	idx->path_buckets = idx->name_buckets = NULL;
+	idx->names = NULL;
+	idx->count = 0;
+}
+
+
+/*******************************************************************************
+ * function: findPath
+ *******************************************************************************
+ * Look up a file or subdirectory by its full path.
+ *
+ * @param	dir_index *idx	index to search
+ * @param	char *path	path from the root directory, e.g. "SUB/FILE.TXT"
+ *
+ * @return	int		the record of the path or -1 if not found
+ *
+ * @see				diskindex.h
+ ******************************************************************************/
+
+int findPath(dir_index *idx, char *path) {
+	while(*path == '/') path++;
+
+	int r = idx->path_buckets[hashName(path) & (idx->num_buckets - 1)];
+	while(r != -1 && strcasecmp(recordPath(idx, r), path) != 0) {
+		r = idx->records[r].next_path;
+	}
+
+	return r;
+}
+
+
+/*******************************************************************************
+ * function: findName
+ *******************************************************************************
+ * Look up a file or subdirectory by its name anywhere in the directory tree.
+ *
+ * If more than one entry has the name the one found first by the traversal is
+ * given.
+ *
+ * @param	dir_index *idx	index to search
+ * @param	char *name	name to search for, e.g. "FILE.TXT"
+ *
+ * @return	int		the record of the name or -1 if not found
+ *
+ * @see				diskindex.h
+ ******************************************************************************/
+
+int findName(dir_index *idx, char *name) {
+	int r = idx->name_buckets[hashName(name) & (idx->num_buckets - 1)];
+	while(r != -1 && strcasecmp(recordName(idx, r), name) != 0) {
+		r = idx->records[r].next_name;
+	}
+
+	return r;
+}
+
+
+/*******************************************************************************
+ * function: useSidecar
+ *******************************************************************************
+ * Check whether the sidecar index is turned on for this run.
+ *
+ * @return	bool		true if the DISK_INDEX environment variable is set
+ *
+ * @see				diskindex.h
+ ******************************************************************************/
+
+bool useSidecar(void) {
+	return getenv("DISK_INDEX") != NULL;
+}
+
+
+/*******************************************************************************
+ * function: checksumImage
+ *******************************************************************************
+ * FNV-1a style checksum of the first FAT and the root directory of the image.
+ *
+ * The regions are hashed 8 bytes at a time, which is all a staleness check
+ * needs and keeps it far cheaper than decoding the FAT and walking the tree.
+ *
+ * @param	fat_volume *vol	volume context with its geometry
+ *
+ * @return	uint64_t	the checksum
+ ******************************************************************************/
+
+static uint64_t checksumImage(fat_volume *vol) {
+	uint64_t hash = 14695981039346656037ull;
+	int64_t offsets[2];
+	size_t lengths[2];
+	int i;
+
+	offsets[0] = vol->fat_start;
+	lengths[0] = (size_t)vol->sectors_per_fat * vol->bytes_per_sector;
+	offsets[1] = vol->root_sector_start * vol->bytes_per_sector;
+	lengths[1] = (size_t)vol->sectors_for_root * vol->bytes_per_sector;
+
+	//a FAT32 root has no fixed region, its first cluster is used instead
+	if(vol->root_cluster != 0) lengths[1] = vol->cluster_size;
+
+	for(i = 0; i < 2; i++) {
+		size_t j;
+		uint64_t word;
+
+		char *buf = (vol->ptr == NULL) ? allocRange(lengths[i]) : NULL;
+		char *region = readImage(vol, offsets[i], lengths[i], buf);
+
+		for(j = 0; j + 8 <= lengths[i]; j += 8) {
+			memcpy(&word, region + j, 8);
+			hash = (hash ^ word) * 1099511628211ull;
+		}
+		for(; j < lengths[i]; j++) {
+			hash = (hash ^ (unsigned char)region[j]) * 1099511628211ull;
+		}
+
+		free(buf);
+	}
+
+	return hash;
+}
+
+
+/*******************************************************************************
+ * function: statImage
+ *******************************************************************************
+ * Get the size and modification time of an image file.
+ *
+ * A write anywhere in the image moves its modification time, including the
+ * subdirectory clusters checksumImage doesn't look at.
+ *
+ * @param	char *image_path	path of the disk image
+ * @param	uint64_t *size	set to the size of the image in bytes
+ * @param	int64_t *mtime	set to its modification time in nanoseconds
+ *
+ * @return	bool		false if the image could not be looked at
+ *
+ * @see				diskindex.h
+ ******************************************************************************/
+
+bool statImage(char *image_path, uint64_t *size, int64_t *mtime) {
+	struct stat buff;
+	if(stat(image_path, &buff) < 0) return false;
+
+	*size = buff.st_size;
+	*mtime = (int64_t)buff.st_mtim.tv_sec * 1000000000 + buff.st_mtim.tv_nsec;
+	return true;
+}
+
+
+/*******************************************************************************
+ * function: sidecarPath
+ *******************************************************************************
+ * Build the path of the sidecar index of an image.
+ *
+ * @param	char *image_path	path of the disk image
+ *
+ * @return	char*		malloced path that the caller must free
+ ******************************************************************************/
+
+static char *sidecarPath(char *image_path) {
+	char *path = (char *)malloc(strlen(image_path) + strlen(SIDECAR_SUFFIX) + 1);
+	if(path == NULL) {
+		printf("ERROR: Failed to allocate sidecar path\n");
+		exit(EXIT_FAILURE);
+	}
+
+	strcpy(path, image_path);
+	strcat(path, SIDECAR_SUFFIX);
+	return path;
+}
+
+
+/*******************************************************************************
+ * function: loadIndex
+ *******************************************************************************
+ * Map the decoded FAT and directory index from the sidecar of an image.
+ *
+ * The sidecar is mapped copy on write so the volume and index can still be
+ * changed in memory without touching the file. Nothing is loaded if the
+ * sidecar is missing, unreadable, from another layout or geometry, or if the
+ * image file, its first FAT or its root directory changed since it was
+ * written.
+ *
+ * @param	fat_volume *vol	volume context with its geometry but no FAT
+ * @param	dir_index *idx	index to initialize
+ * @param	char *image_path	path of the disk image
+ *
+ * @return	bool		true if the sidecar was valid and loaded
+ *
+ * @see				diskindex.h
+ ******************************************************************************/
+
+bool loadIndex(fat_volume *vol, dir_index *idx, char *image_path) {
+	char *path = sidecarPath(image_path);
+	int fd = open(path, O_RDONLY);
+	free(path);
+	if(fd < 0) return false;
+
+	struct stat buff;
+	if(fstat(fd, &buff) < 0 || buff.st_size < (off_t)sizeof(sidecar_header)) {
+		close(fd);
+		return false;
+	}
+
+	char *map = mmap(0, buff.st_size, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(map == MAP_FAILED) return false;
+
+	uint64_t image_size;
+	int64_t image_mtime;
+	bool found = statImage(image_path, &image_size, &image_mtime);
+
+	sidecar_header *header = (sidecar_header *)map;
+	if(memcmp(header->magic, SIDECAR_MAGIC, 8) != 0 ||
+			header->version != SIDECAR_VERSION ||
+			header->fat_bits != FAT_BITS ||
+			header->total_size != (uint64_t)buff.st_size ||
+			!found ||
+			header->image_size != image_size ||
+			header->image_mtime != image_mtime ||
+			header->bytes_per_sector != (uint32_t)vol->bytes_per_sector ||
+			header->sectors_per_cluster != (uint32_t)vol->sectors_per_cluster ||
+			header->sector_count != (uint64_t)vol->sector_count ||
+			header->sectors_per_fat != (uint32_t)vol->sectors_per_fat ||
+			header->num_entries != vol->num_entries ||
+			header->checksum != checksumImage(vol)) {
+		munmap(map, buff.st_size);
+		return false;
+	}
+
+	vol->fat = (fat_entry_t *)(map + header->fat_offset);
+	vol->free_count = header->free_count;
+	vol->sidecar = map;
+	vol->sidecar_size = buff.st_size;
+
+	//the capacities are what copyIndex allocates if the index ever grows
+	idx->records = (dir_record *)(map + header->records_offset);
+	idx->count = header->record_count;
+	idx->capacity = (idx->count > MIN_BUCKETS) ? idx->count : MIN_BUCKETS;
+	idx->path_buckets = (int32_t *)(map + header->path_buckets_offset);
+	idx->name_buckets = (int32_t *)(map + header->name_buckets_offset);
+	idx->num_buckets = header->num_buckets;
+	idx->names = map + header->names_offset;
+	idx->names_length = header->names_length;
+	idx->names_capacity = (idx->names_length > MIN_BUCKETS * 16) ? idx->names_length : MIN_BUCKETS * 16;
+	idx->mapped = true;
+
+	return true;
+}
+
+
+/*******************************************************************************
+ * function: saveIndex
+ *******************************************************************************
+ * Write the decoded FAT and directory index to the sidecar of an image.
+ *
+ * The sidecar is written to a temporary file first and renamed over the old
+ * one so a reader never maps a half written index. Failing to write it is not
+ * an error since the index can always be rebuilt from the image.
+ *
+ * @param	fat_volume *vol	volume context
+ * @param	dir_index *idx	index to save
+ * @param	char *image_path	path of the disk image
+ *
+ * @return	void		no return value
+ *
+ * @see				diskindex.h
+ ******************************************************************************/
+
+void saveIndex(fat_volume *vol, dir_index *idx, char *image_path) {
+	sidecar_header header;
+	memset(&header, 0, sizeof(header));
+
+	memcpy(header.magic, SIDECAR_MAGIC, 8);
+	header.version = SIDECAR_VERSION;
+	header.fat_bits = FAT_BITS;
+	header.bytes_per_sector = vol->bytes_per_sector;
+	header.sectors_per_cluster = vol->sectors_per_cluster;
+	header.sector_count = vol->sector_count;
+	header.sectors_per_fat = vol->sectors_per_fat;
+	header.checksum = checksumImage(vol);
+	if(!statImage(image_path, &header.image_size, &header.image_mtime)) return;
+
+	header.num_entries = vol->num_entries;
+	getFreeSpace(vol);
+	header.free_count = vol->free_count;
+	header.record_count = idx->count;
+	header.num_buckets = idx->num_buckets;
+	header.names_length = idx->names_length;
+
+	//lay the sections out one after the other on 8 byte boundaries
+	uint64_t end = sizeof(header);
+	header.fat_offset = end;
+	end = (end + vol->num_entries * sizeof(fat_entry_t) + 7) & ~7ull;
+	header.records_offset = end;
+	end = (end + idx->count * sizeof(dir_record) + 7) & ~7ull;
+	header.path_buckets_offset = end;
+	end = (end + idx->num_buckets * sizeof(int32_t) + 7) & ~7ull;
+	header.name_buckets_offset = end;
+	end = (end + idx->num_buckets * sizeof(int32_t) + 7) & ~7ull;
+	header.names_offset = end;
+	header.total_size = end + idx->names_length;
+
+	char *path = sidecarPath(image_path);
+	char *tmp_path = (char *)malloc(strlen(path) + 5);
+	if(tmp_path == NULL) {
+		printf("ERROR: Failed to allocate sidecar path\n");
+		exit(EXIT_FAILURE);
+	}
+	sprintf(tmp_path, "%s.tmp", path);
+
+	int fd = open(tmp_path, O_WRONLY|O_CREAT|O_TRUNC, 0666);
+	if(fd >= 0) {
+		bool ok =
+			ftruncate(fd, header.total_size) == 0 &&
+			pwrite(fd, &header, sizeof(header), 0) == sizeof(header) &&
+			pwrite(fd, vol->fat, vol->num_entries * sizeof(fat_entry_t), header.fat_offset) == (ssize_t)(vol->num_entries * sizeof(fat_entry_t)) &&
+			pwrite(fd, idx->records, idx->count * sizeof(dir_record), header.records_offset) == (ssize_t)(idx->count * sizeof(dir_record)) &&
+			pwrite(fd, idx->path_buckets, idx->num_buckets * sizeof(int32_t), header.path_buckets_offset) == (ssize_t)(idx->num_buckets * sizeof(int32_t)) &&
+			pwrite(fd, idx->name_buckets, idx->num_buckets * sizeof(int32_t), header.name_buckets_offset) == (ssize_t)(idx->num_buckets * sizeof(int32_t)) &&
+			pwrite(fd, idx->names, idx->names_length, header.names_offset) == idx->names_length;
+		close(fd);
+
+		if(!ok || rename(tmp_path, path) != 0) unlink(tmp_path);
+	}
+
+	free(tmp_path);
+	free(path);
+}
+
+
+/*******************************************************************************
+ * function: loadVolume
+ *******************************************************************************
+ * Get the decoded FAT and directory index of a volume with its geometry.
+ *
+ * With the sidecar turned on a valid sidecar is mapped instead of decoding the
+ * FAT and walking the directory tree, and a missing or stale one is rebuilt.
+ * Otherwise both are built from the image.
+ *
+ * @param	fat_volume *vol	volume context with its geometry
+ * @param	dir_index *idx	index to initialize
+ * @param	char *image_path	path of the disk image
+ *
+ * @return	void		no return value
+ *
+ * @see				bool loadIndex(fat_volume*, dir_index*, char*)
+ ******************************************************************************/
+
+static void loadVolume(fat_volume *vol, dir_index *idx, char *image_path) {
+	bool sidecar = useSidecar();
+	if(sidecar && loadIndex(vol, idx, image_path)) return;
+
+	decodeFAT(vol);
+	buildIndex(vol, idx);
+
+	if(sidecar) saveIndex(vol, idx, image_path);
+}
+
+
+/*******************************************************************************
+ * function: openVolume
+ *******************************************************************************
+ * Build the volume context and directory index for a mapped image.
+ *
+ * With the sidecar turned on a valid sidecar is mapped instead of decoding the
+ * FAT and walking the directory tree, and a missing or stale one is rebuilt.
+ * Otherwise both are built from the image.
+ *
+ * @param	fat_volume *vol	volume context to initialize
+ * @param	dir_index *idx	index to initialize
+ * @param	char *ptr	a pointer to the first byte of the fs image
+ * @param	char *image_path	path of the disk image
+ *
+ * @return	void		no return value
+ *
+ * @see				diskindex.h
+ * @see				void getGeometry(fat_volume*, char*)
+ * @see				void loadVolume(fat_volume*, dir_index*, char*)
+ ******************************************************************************/
+
+void openVolume(fat_volume *vol, dir_index *idx, char *ptr, char *image_path) {
+	getGeometry(vol, ptr);
+	loadVolume(vol, idx, image_path);
+}
+
+
+/*******************************************************************************
+ * function: checkVolume
+ *******************************************************************************
+ * Build the volume context and directory index for a mapped image, or say why
+ * the image can't be read.
+ *
+ * The same as openVolume but a bad image is reported instead of ending the
+ * program, for the daemon. The image also has to be as large as its volume so
+ * nothing past the end of the mapping is ever read.
+ *
+ * @param	fat_volume *vol	volume context to initialize
+ * @param	dir_index *idx	index to initialize
+ * @param	char *ptr	a pointer to the first byte of the fs image
+ * @param	int64_t size	size of the mapping in bytes
+ * @param	char *image_path	path of the disk image
+ * @param	char *error	set to why the image can't be read, must hold
+ * 				GEOMETRY_ERROR bytes
+ *
+ * @return	bool		false if the image can't be read, with nothing
+ * 				left to free
+ *
+ * @see				diskindex.h
+ * @see				bool checkGeometry(fat_volume*, char*, char*)
+ * @see				void loadVolume(fat_volume*, dir_index*, char*)
+ ******************************************************************************/
+
+bool checkVolume(fat_volume *vol, dir_index *idx, char *ptr, int64_t size, char *image_path, char *error) {
+	if(size < 512) {
+		snprintf(error, GEOMETRY_ERROR, "Not a FAT disk image");
+		return false;
+	}
+
+	if(!checkGeometry(vol, ptr, error)) return false;
+
+	if(vol->sector_count * vol->bytes_per_sector > size) {
+		snprintf(error, GEOMETRY_ERROR, "Disk image is smaller than its file system");
+		return false;
+	}
+
+	loadVolume(vol, idx, image_path);
+	return true;
+}
+
+
+/*******************************************************************************
+ * function: openDevice
+ *******************************************************************************
+ * Build the volume context and directory index for an image opened through a
+ * block device.
+ *
+ * Only the boot sector is read to get the geometry. A mapped device is then
+ * used like any mapped image, otherwise every later read of the image goes
+ * through the device.
+ *
+ * @param	fat_volume *vol	volume context to initialize
+ * @param	dir_index *idx	index to initialize
+ * @param	block_device *dev	device the image is opened with
+ * @param	char *image_path	path of the disk image
+ *
+ * @return	void		no return value
+ *
+ * @see				diskindex.h
+ * @see				diskblock.h
+ * @see				void openVolume(fat_volume*, dir_index*, char*, char*)
+ ******************************************************************************/
+
+void openDevice(fat_volume *vol, dir_index *idx, block_device *dev, char *image_path) {
+	char boot[512];
+	if(!readBlocks(dev, 0, boot, sizeof(boot))) {
+		printf("ERROR: Not a FAT disk image\n");
+		exit(EXIT_FAILURE);
+	}
+
+	getGeometry(vol, boot);
+	vol->ptr = dev->map;
+	vol->dev = dev;
+
+	loadVolume(vol, idx, image_path);
+}
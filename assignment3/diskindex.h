@@ -0,0 +1,81 @@
+/***** diskindex.h *************************************************************
+ * University of Victoria
+ * CSC 360 Fall 2018
+ * Italo Borrelli
+ * V00884840
+ *******************************************************************************
+ * This header file declares the mehods defined in diskindex.c.
+ ******************************************************************************/
+
+#ifndef DISK_INDEX_H_
+#define DISK_INDEX_H_
+
+#include <stdint.h>
+
+#include "diskhelpers.h"
+#include "diskblock.h"
+
+
+/*******************************************************************************
+ * DIRECTORY INDEX
+ *******************************************************************************
+ * Every file and subdirectory of a disk image, found with one traversal of the
+ * directory tree and hashed by full path and by file name.
+ *
+ * Records, buckets and names are flat arrays that refer to each other by
+ * position rather than by pointer, which lets them be saved to and mapped
+ * straight back from a sidecar index file next to the image.
+ ******************************************************************************/
+
+typedef struct dir_record {
+	int64_t offset;			//byte offset of the directory entry
+	uint32_t first_cluster;		//first FAT entry of the file
+	uint32_t size;			//size of the file in bytes
+	int32_t parent;			//record of the parent directory, -1 for root
+	int32_t path;			//position of the full path in the names
+	int32_t name;			//position of the file name in the names
+	int32_t next_path;		//next record in the same path bucket
+	int32_t next_name;		//next record in the same name bucket
+	uint8_t attr;			//attribute byte of the directory entry
+} dir_record;
+
+typedef struct dir_index {
+	dir_record *records;		//one record per file and subdirectory
+	int count;			//number of records in use
+	int capacity;			//number of records allocated
+
+	int32_t *path_buckets;		//first record of each path bucket or -1
+	int32_t *name_buckets;		//first record of each name bucket or -1
+	int num_buckets;		//number of buckets, always a power of two
+
+	char *names;			//nul terminated paths, one after the other
+	int names_length;		//number of bytes of names in use
+	int names_capacity;		//number of bytes of names allocated
+
+	bool mapped;			//arrays point into the sidecar mapping
+} dir_index;
+
+
+/*******************************************************************************
+ * FUNCTION DECLARATIONS
+ ******************************************************************************/
+
+void openVolume(fat_volume *vol, dir_index *idx, char *ptr, char *image_path);
+bool checkVolume(fat_volume *vol, dir_index *idx, char *ptr, int64_t size, char *image_path, char *error);
+void openDevice(fat_volume *vol, dir_index *idx, block_device *dev, char *image_path);
+void buildIndex(fat_volume *vol, dir_index *idx);
+bool loadIndex(fat_volume *vol, dir_index *idx, char *image_path);
+void saveIndex(fat_volume *vol, dir_index *idx, char *image_path);
+bool useSidecar(void);
+bool statImage(char *image_path, uint64_t *size, int64_t *mtime);
+void freeIndex(dir_index *idx);
+int addRecord(dir_index *idx, int parent, char *entry, int64_t offset);
+int findPath(dir_index *idx, char *path);
+int findName(dir_index *idx, char *name);
+void formatName(char *entry, char *name);
+
+#define recordPath(idx, r)	((idx)->names + (idx)->records[r].path)
+#define recordName(idx, r)	((idx)->names + (idx)->records[r].name)
+
+
+#endif //DISK_INDEX_H_
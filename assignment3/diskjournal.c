@@ -0,0 +1,537 @@
+/***** diskjournal.c ***********************************************************
+ * University of Victoria
+ * CSC 360 Fall 2018
+ * Italo Borrelli
+ * V00884840
+ *******************************************************************************
+ * diskjournal.c is a source file for the write-ahead journal used to make
+ * writes to a disk image crash consistent.
+ *
+ * When the DISK_JOURNAL environment variable is set a writer maps the image
+ * copy on write, so nothing it changes reaches the image file until the batch
+ * is committed. Every change is remembered as a range of bytes, either file
+ * data or metadata, the FAT and directory entries. A commit then
+ *	1. writes the data to the free clusters it went to and flushes the image,
+ *	2. writes the metadata to <image>.journal and flushes the journal,
+ *	3. writes the metadata to the image and flushes it again,
+ *	4. removes the journal.
+ * The journal is only valid once its checksum matches, so a crash before step
+ * 2 finishes leaves the image as it was before the batch, and a crash after it
+ * leaves a journal that replayJournal applies the next time the image is
+ * opened by any of the tools.
+ *
+ * However many files a batch puts it costs three flushes, not three per file.
+ *
+ * Every tool holds a flock on the image from the time it replays the journal
+ * until it is done with the image, shared to read it and exclusive to write
+ * it. A writer holds the image alone from decoding the FAT to committing, so
+ * no two writers pick the same free clusters, nothing reads the image while a
+ * batch is applied to it and a journal is never removed while another process
+ * is still writing it.
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <string.h>
+
+#include "diskjournal.h"
+
+#define JOURNAL_MAGIC "FATJNL1"		//first bytes of every journal
+#define JOURNAL_VERSION 1		//bumped whenever the layout below changes
+#define JOURNAL_SUFFIX ".journal"	//added to the image path
+
+
+/*******************************************************************************
+ * JOURNAL HEADER
+ *******************************************************************************
+ * Start of a journal file. It is followed by count records, each a
+ * journal_record and the bytes it covers.
+ ******************************************************************************/
+
+typedef struct journal_header {
+	char magic[8];			//JOURNAL_MAGIC
+	uint32_t version;		//JOURNAL_VERSION
+	uint32_t count;			//number of records that follow
+	uint64_t length;		//number of bytes of records that follow
+	uint64_t checksum;		//checksum of the records
+} journal_header;
+
+typedef struct journal_record {
+	uint64_t offset;		//byte offset in the image to write to
+	uint64_t length;		//number of bytes that follow the record
+} journal_record;
+
+
+/*******************************************************************************
+ * function: useJournal
+ *******************************************************************************
+ * Check whether writes are journaled for this run.
+ *
+ * @return	bool		true if the DISK_JOURNAL environment variable is set
+ *
+ * @see				diskjournal.h
+ ******************************************************************************/
+
+bool useJournal(void) {
+	return getenv("DISK_JOURNAL") != NULL;
+}
+
+
+/*******************************************************************************
+ * function: journalPath
+ *******************************************************************************
+ * Build the path of the journal of an image.
+ *
+ * @param	char *image_path	path of the disk image
+ *
+ * @return	char*		malloced path that the caller must free
+ ******************************************************************************/
+
+static char *journalPath(char *image_path) {
+	char *path = (char *)malloc(strlen(image_path) + strlen(JOURNAL_SUFFIX) + 1);
+	if(path == NULL) {
+		printf("ERROR: Failed to allocate journal path\n");
+		exit(EXIT_FAILURE);
+	}
+
+	strcpy(path, image_path);
+	strcat(path, JOURNAL_SUFFIX);
+	return path;
+}
+
+
+/*******************************************************************************
+ * function: checksumRecords
+ *******************************************************************************
+ * FNV-1a checksum of the records of a journal.
+ *
+ * @param	char *records	first byte of the records
+ * @param	uint64_t length	number of bytes of records
+ *
+ * @return	uint64_t	the checksum
+ ******************************************************************************/
+
+static uint64_t checksumRecords(char *records, uint64_t length) {
+	uint64_t hash = 14695981039346656037ull;
+	uint64_t i;
+
+	for(i = 0; i < length; i++) {
+		hash = (hash ^ (unsigned char)records[i]) * 1099511628211ull;
+	}
+
+	return hash;
+}
+
+
+/*******************************************************************************
+ * function: writeAll
+ *******************************************************************************
+ * Writes a whole buffer at an offset of a file.
+ *
+ * @param	int fd		file to write to
+ * @param	char *buf	bytes to write
+ * @param	int64_t length	number of bytes to write
+ * @param	int64_t offset	byte offset in the file to write at
+ *
+ * @return	bool		false if the write failed
+ ******************************************************************************/
+
+static bool writeAll(int fd, char *buf, int64_t length, int64_t offset) {
+	while(length > 0) {
+		ssize_t done = pwrite(fd, buf, length, offset);
+		if(done <= 0) return false;
+
+		buf += done;
+		length -= done;
+		offset += done;
+	}
+
+	return true;
+}
+
+
+/*******************************************************************************
+ * function: syncDirectory
+ *******************************************************************************
+ * Flushes the directory a journal is in so creating or removing the journal
+ * is as durable as its contents.
+ *
+ * @param	char *path	path of the journal
+ *
+ * @return	void		no return value
+ ******************************************************************************/
+
+static void syncDirectory(char *path) {
+	char *dir = strdup(path);
+	if(dir == NULL) {
+		printf("ERROR: Failed to allocate journal path\n");
+		exit(EXIT_FAILURE);
+	}
+
+	char *slash = strrchr(dir, '/');
+	if(slash == NULL) strcpy(dir, ".");
+	else if(slash == dir) slash[1] = '\0';
+	else slash[0] = '\0';
+
+	int fd = open(dir, O_RDONLY|O_DIRECTORY);
+	if(fd < 0 || fsync(fd) != 0) {
+		printf("ERROR: Failed to flush journal directory\n");
+		exit(EXIT_FAILURE);
+	}
+
+	close(fd);
+	free(dir);
+}
+
+
+/*******************************************************************************
+ * function: lockJournal
+ *******************************************************************************
+ * Changes the flock a process holds on an image.
+ *
+ * @param	int lock	image file the lock is held through
+ * @param	int operation	LOCK_SH or LOCK_EX
+ *
+ * @return	void		no return value
+ ******************************************************************************/
+
+static void lockJournal(int lock, int operation) {
+	if(flock(lock, operation) != 0) {
+		printf("ERROR: Failed to lock disk image\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
+
+/*******************************************************************************
+ * function: replayJournal
+ *******************************************************************************
+ * Finishes a batch that was committed to the journal of an image but may not
+ * have reached the image itself.
+ *
+ * Called before the image is mapped. A journal that is incomplete or damaged
+ * was never committed and is removed without touching the image. A journal
+ * is only read while the image is locked exclusively. The lock is then kept
+ * for the caller, shared unless it writes, and dropped by closing the file
+ * returned.
+ *
+ * @param	char *image_path	path of the disk image
+ * @param	bool write	true to keep the image locked exclusively
+ *
+ * @return	int		image file holding the lock, -1 if the image
+ * 				could not be opened
+ *
+ * @see				diskjournal.h
+ ******************************************************************************/
+
+int replayJournal(char *image_path, bool write) {
+	int operation = write ? LOCK_EX : LOCK_SH;
+
+	int lock = open(image_path, O_RDONLY);
+	if(lock < 0) return -1;
+
+	//a journal is only left behind by a crash, so most of the time a
+	//reader never has to take the lock exclusively
+	lockJournal(lock, operation);
+
+	char *path = journalPath(image_path);
+	if(access(path, F_OK) != 0) {
+		free(path);
+		return lock;
+	}
+
+	lockJournal(lock, LOCK_EX);
+
+	int fd = open(path, O_RDONLY);
+	if(fd < 0) {
+		free(path);
+		lockJournal(lock, operation);
+		return lock;
+	}
+
+	struct stat buff;
+	fstat(fd, &buff);
+
+	char *journal = (buff.st_size > 0) ? (char *)malloc(buff.st_size) : NULL;
+	bool valid = journal != NULL && pread(fd, journal, buff.st_size, 0) == buff.st_size;
+	close(fd);
+
+	journal_header *header = (journal_header *)journal;
+	valid = valid && (size_t)buff.st_size >= sizeof(journal_header) &&
+		memcmp(header->magic, JOURNAL_MAGIC, sizeof(header->magic)) == 0 &&
+		header->version == JOURNAL_VERSION &&
+		header->length == buff.st_size - sizeof(journal_header) &&
+		header->checksum == checksumRecords(journal + sizeof(journal_header), header->length);
+
+	if(valid) {
+		int image = open(image_path, O_RDWR);
+		if(image < 0) {
+			printf("ERROR: Failed to replay journal\n");
+			exit(EXIT_FAILURE);
+		}
+
+		char *next = journal + sizeof(journal_header);
+		uint32_t i;
+		for(i = 0; i < header->count; i++) {
+			journal_record *record = (journal_record *)next;
+			next += sizeof(journal_record);
+
+			if(!writeAll(image, next, record->length, record->offset)) {
+				printf("ERROR: Failed to replay journal\n");
+				exit(EXIT_FAILURE);
+			}
+
+			next += record->length;
+		}
+
+		if(fdatasync(image) != 0) {
+			printf("ERROR: Failed to replay journal\n");
+			exit(EXIT_FAILURE);
+		}
+
+		close(image);
+	}
+
+	unlink(path);
+	syncDirectory(path);
+	free(journal);
+	free(path);
+
+	lockJournal(lock, operation);
+	return lock;
+}
+
+
+/*******************************************************************************
+ * function: openJournal
+ *******************************************************************************
+ * Starts journaling the writes to a volume.
+ *
+ * The image must be mapped copy on write so the changes made to the mapping
+ * stay out of the image file until they are committed.
+ *
+ * @param	fat_volume *vol	volume context of a privately mapped diskimage
+ * @param	int fd		image file opened for writing
+ * @param	char *image_path	path of the disk image
+ *
+ * @return	void		no return value
+ *
+ * @see				diskjournal.h
+ ******************************************************************************/
+
+void openJournal(fat_volume *vol, int fd, char *image_path) {
+	disk_journal *journal = (disk_journal *)calloc(1, sizeof(disk_journal));
+	if(journal == NULL) {
+		printf("ERROR: Failed to allocate journal\n");
+		exit(EXIT_FAILURE);
+	}
+
+	journal->fd = fd;
+	journal->path = journalPath(image_path);
+	vol->journal = journal;
+}
+
+
+/*******************************************************************************
+ * function: markWritten
+ *******************************************************************************
+ * Remembers a range of the image changed in the mapping.
+ *
+ * Does nothing unless the volume is journaled. A range that carries on from
+ * the last one of the same kind is merged into it, which is what file data
+ * written one extent after the other looks like.
+ *
+ * @param	fat_volume *vol	volume context of the diskimage
+ * @param	int64_t offset	byte offset of the range in the image
+ * @param	int64_t length	number of bytes in the range
+ * @param	bool metadata	true for FAT and directory bytes
+ *
+ * @return	void		no return value
+ *
+ * @see				diskjournal.h
+ ******************************************************************************/
+
+void markWritten(fat_volume *vol, int64_t offset, int64_t length, bool metadata) {
+	disk_journal *journal = vol->journal;
+	if(journal == NULL || length <= 0) return;
+
+	if(journal->count > 0) {
+		written_range *last = &journal->ranges[journal->count-1];
+		if(last->metadata == metadata && last->offset + last->length == offset) {
+			last->length += length;
+			return;
+		}
+	}
+
+	if(journal->count == journal->capacity) {
+		journal->capacity = (journal->capacity == 0) ? 64 : journal->capacity * 2;
+		journal->ranges = (written_range *)realloc(journal->ranges, journal->capacity * sizeof(written_range));
+		if(journal->ranges == NULL) {
+			printf("ERROR: Failed to allocate journal\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	journal->ranges[journal->count].offset = offset;
+	journal->ranges[journal->count].length = length;
+	journal->ranges[journal->count].metadata = metadata;
+	journal->count++;
+}
+
+
+/*******************************************************************************
+ * function: compareRange
+ *******************************************************************************
+ * Orders written ranges by offset for qsort.
+ *
+ * @param	const void *a	first range
+ * @param	const void *b	second range
+ *
+ * @return	int		negative, zero or positive like strcmp
+ ******************************************************************************/
+
+static int compareRange(const void *a, const void *b) {
+	int64_t x = ((written_range *)a)->offset, y = ((written_range *)b)->offset;
+	return (x > y) - (x < y);
+}
+
+
+/*******************************************************************************
+ * function: commitJournal
+ *******************************************************************************
+ * Makes everything written since the last commit durable, in order.
+ *
+ * The ranges are sorted and overlapping or touching ranges of the same kind
+ * merged so each byte is written once. Data goes to the image first, then the
+ * metadata to the journal and then to the image, with a flush after each.
+ * The caller holds the image locked exclusively, see replayJournal.
+ * flushFAT has to be called before this so the FAT is in the mapping.
+ *
+ * @param	fat_volume *vol	volume context of a journaled diskimage
+ *
+ * @return	void		no return value
+ *
+ * @see				diskjournal.h
+ ******************************************************************************/
+
+void commitJournal(fat_volume *vol) {
+	disk_journal *journal = vol->journal;
+	if(journal == NULL || journal->count == 0) return;
+
+	qsort(journal->ranges, journal->count, sizeof(written_range), compareRange);
+
+	int i, merged = 0;
+	for(i = 1; i < journal->count; i++) {
+		written_range *last = &journal->ranges[merged];
+		written_range *range = &journal->ranges[i];
+
+		if(range->metadata == last->metadata && range->offset <= last->offset + last->length) {
+			int64_t end = range->offset + range->length;
+			if(end > last->offset + last->length) last->length = end - last->offset;
+		} else {
+			journal->ranges[++merged] = *range;
+		}
+	}
+	journal->count = merged + 1;
+
+	//the data has to be on disk before any metadata points at it
+	uint64_t length = 0;
+	uint32_t count = 0;
+	for(i = 0; i < journal->count; i++) {
+		written_range *range = &journal->ranges[i];
+
+		if(range->metadata) {
+			length += sizeof(journal_record) + range->length;
+			count++;
+		} else if(!writeAll(journal->fd, vol->ptr + range->offset, range->length, range->offset)) {
+			printf("ERROR: Failed to write disk image\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if(fdatasync(journal->fd) != 0) {
+		printf("ERROR: Failed to flush disk image\n");
+		exit(EXIT_FAILURE);
+	}
+
+	//the whole journal is built in memory and written with one write
+	char *buf = (char *)malloc(sizeof(journal_header) + length);
+	if(buf == NULL) {
+		printf("ERROR: Failed to allocate journal\n");
+		exit(EXIT_FAILURE);
+	}
+
+	char *next = buf + sizeof(journal_header);
+	for(i = 0; i < journal->count; i++) {
+		written_range *range = &journal->ranges[i];
+		if(!range->metadata) continue;
+
+		journal_record record = {range->offset, range->length};
+		memcpy(next, &record, sizeof(record));
+		memcpy(next + sizeof(record), vol->ptr + range->offset, range->length);
+		next += sizeof(record) + range->length;
+	}
+
+	journal_header header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, JOURNAL_MAGIC, sizeof(header.magic));
+	header.version = JOURNAL_VERSION;
+	header.count = count;
+	header.length = length;
+	header.checksum = checksumRecords(buf + sizeof(journal_header), length);
+	memcpy(buf, &header, sizeof(header));
+
+	int fd = open(journal->path, O_WRONLY|O_CREAT|O_TRUNC, 0666);
+	if(fd < 0 || !writeAll(fd, buf, sizeof(journal_header) + length, 0) || fsync(fd) != 0) {
+		printf("ERROR: Failed to write journal\n");
+		exit(EXIT_FAILURE);
+	}
+	close(fd);
+	syncDirectory(journal->path);
+
+	//the batch is committed, now it can be applied to the image
+	for(i = 0; i < journal->count; i++) {
+		written_range *range = &journal->ranges[i];
+		if(range->metadata && !writeAll(journal->fd, vol->ptr + range->offset, range->length, range->offset)) {
+			printf("ERROR: Failed to write disk image\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if(fdatasync(journal->fd) != 0) {
+		printf("ERROR: Failed to flush disk image\n");
+		exit(EXIT_FAILURE);
+	}
+
+	unlink(journal->path);
+	syncDirectory(journal->path);
+	free(buf);
+	journal->count = 0;
+}
+
+
+/*******************************************************************************
+ * function: closeJournal
+ *******************************************************************************
+ * Stops journaling the writes to a volume. Anything not committed is dropped.
+ *
+ * @param	fat_volume *vol	volume context of the diskimage
+ *
+ * @return	void		no return value
+ *
+ * @see				diskjournal.h
+ ******************************************************************************/
+
+void closeJournal(fat_volume *vol) {
+	disk_journal *journal = vol->journal;
+	if(journal == NULL) return;
+
+	free(journal->ranges);
+	free(journal->path);
+	free(journal);
+	vol->journal = NULL;
+}
@@ -0,0 +1,60 @@
+/***** diskjournal.h ***********************************************************
+ * University of Victoria
+ * CSC 360 Fall 2018
+ * Italo Borrelli
+ * V00884840
+ *******************************************************************************
+ * This header file declares the mehods defined in diskjournal.c.
+ ******************************************************************************/
+
+#ifndef DISK_JOURNAL_H_
+#define DISK_JOURNAL_H_
+
+#include <stdint.h>
+
+#include "diskhelpers.h"
+
+
+/*******************************************************************************
+ * WRITTEN RANGE
+ *******************************************************************************
+ * A run of bytes of the image changed in the private mapping and not yet
+ * written to the image file.
+ ******************************************************************************/
+
+typedef struct written_range {
+	int64_t offset;			//byte offset of the range in the image
+	int64_t length;			//number of bytes in the range
+	bool metadata;			//FAT or directory bytes, data otherwise
+} written_range;
+
+
+/*******************************************************************************
+ * DISK JOURNAL
+ *******************************************************************************
+ * Everything a journaled batch has changed since it was last committed.
+ ******************************************************************************/
+
+typedef struct disk_journal {
+	int fd;				//image file opened for writing
+	char *path;			//path of the journal file
+
+	written_range *ranges;		//ranges in the order they were written
+	int count;			//number of ranges in use
+	int capacity;			//number of ranges allocated
+} disk_journal;
+
+
+/*******************************************************************************
+ * FUNCTION DECLARATIONS
+ ******************************************************************************/
+
+bool useJournal(void);
+int replayJournal(char *image_path, bool write);
+void openJournal(fat_volume *vol, int fd, char *image_path);
+void markWritten(fat_volume *vol, int64_t offset, int64_t length, bool metadata);
+void commitJournal(fat_volume *vol);
+void closeJournal(fat_volume *vol);
+
+
+#endif //DISK_JOURNAL_H_
@@ -5,6 +5,10 @@
  * V00884840
  *******************************************************************************
  * diskput.c reads a file and copies it to a file system image.
+ *
+ * Regular files are mapped and written in one go. Standard input, given as -,
+ * FIFOs and anything else that can't be mapped are streamed onto the image as
+ * the data arrives.
  ******************************************************************************/
 
 #include <stdio.h>
@@ -15,311 +19,174 @@
 #include <sys/stat.h>
 #include <string.h>
 #include <errno.h>
-#include <ctype.h>
+#include <time.h>
 
 #include "diskhelpers.h"
-
-#define MAX_DEPTH 128		//max depth of directories
-
+#include "diskblock.h"
+#include "diskindex.h"
+#include "diskwrite.h"
+#include "diskjournal.h"
 
 
 /*******************************************************************************
- * function: writeDirectory
+ * PUT FILE
  *******************************************************************************
- * Writes directory entry for the file being added
- *
- * @param	char *ptr	pointer to diskimage
- * @param	int new_dir	byte value to start of dir to write to
- * @param	int first_sector	first sector to use for the file
- * @param	char *filename	name of file being copied
- * @param	struct stat buff	buffer of file being copied
- *
- * @return	void		no return value
+ * A host file planned to be put on the disk image.
  ******************************************************************************/
 
-void writeDirectory(char *ptr, int new_dir, int first_sector, char *filename, struct stat buff) {
-	ptr += new_dir;
-	int i, period = -1;
-	char letter;
-
-	for(i = 0; i < 8; i++) {
-		letter = filename[i];
-		if(letter == '.') period = i;
-		ptr[i] = (period == -1) ? toupper(letter) : ' ';
-	}
-
-	while(period == -1) {
-		if(filename[i] == '.') period = i;
-		i++;
-	}
-
-	bool end = false;
-	for(i = 0; i < 3; i++) {
-		if(filename[i+period+1] == '\0') { end = true; ptr[i+8] = ' '; }
-		else if(end) ptr[i+8] = ' ';
-		else ptr[i+8] = toupper(filename[i+period+1]);
-	}
-
-	ptr[11] = 0x00;
-
-	time_t time = buff.st_mtime;
-	ptr[14] = ptr[22] = time & 0xff;
-	ptr[15] = ptr[23] = (time & 0xff00) >> 8;
-	ptr[16] = ptr[24] = (time & 0xff0000) >> 16;
-	ptr[17] = ptr[25] = (time & 0xff000000) >> 24;
+typedef struct put_file {
+	char *filename;			//name of the host file and the new entry
+	int parent;			//index record of its directory, -1 for root
+	int dir_cluster;		//first cluster of its directory, 0 for root
+	int fd;				//file descriptor of the host file
+	char *ptr_file;			//mapping of the host file, NULL if empty
+	bool stream;			//read as it arrives instead of mapped
+	struct stat buff;		//statistics of the host file
+} put_file;
 
-	ptr[26] = (first_sector-31) & 0xff;
-	ptr[27] = ((first_sector-31) & 0xff00) >> 8;
-
-	int size = buff.st_size;
-	ptr[28] = size & 0xff;
-	ptr[29] = (size & 0xff00) >> 8;
-	ptr[30] = (size & 0xff0000) >> 16;
-	ptr[31] = (size & 0xff000000) >> 24;
-
-	ptr -= new_dir;
-}
 
 
 /*******************************************************************************
- * function: setFAT
+ * function: parseFileName
  *******************************************************************************
- * Sets a FAT value.
+ * Looks at the file name and parses it to subdirectory path and the file name.
  *
- * @param	char *ptr	pointer to diskimage
- * @param	int fat_entry	fat entry to write
- * @param	int val		value to write to fat table
+ * @param	char *arg	full argument from command line
+ * @param	char **filename	filename to modify
+ * @param	char **dir_path	subdirectory path to modify, empty for root
  *
  * @return	void		no return value
  ******************************************************************************/
 
-void setFAT(char *ptr, int fat_entry, int val) {
-	if((fat_entry % 2) == 0) {
-		ptr[BYTES_PER_SECTOR + (int)((3*fat_entry)/2)+1] = (val >> 8) & 0x0f;
-		ptr[BYTES_PER_SECTOR + (int)((3*fat_entry)/2)] = val & 0xff;
+void parseFileName(char *arg, char **filename, char **dir_path) {
+	char *slash = strrchr(arg, '/');
+
+	if(slash == NULL) {
+		*filename = arg;
+		*dir_path = "";
 	} else {
-		ptr[BYTES_PER_SECTOR + (int)((3*fat_entry)/2)] = (val << 4) & 0xf0;
-		ptr[BYTES_PER_SECTOR + (int)((3*fat_entry)/2)+1] = (val >> 4) & 0xff;
+		*slash = '\0';
+		*filename = slash + 1;
+		*dir_path = arg;
 	}
 }
 
 
 /*******************************************************************************
- * function: getFreeFAT
+ * function: readManifest
  *******************************************************************************
- * Finds the next available sector using the FAT table.
+ * Reads the list of files to put from a manifest file.
  *
- * @param	char *ptr	pointer to diskimage
+ * Each non empty line of the manifest is one file name, written the same way
+ * as on the command line.
  *
- * @return	int		empty fat entry
- ******************************************************************************/
-
-int getFreeFAT(char *ptr) {
-	int fat_entry = 2;
-	while(getFATEntry(ptr, fat_entry) != 0x000) {
-		fat_entry++;
-	}
-
-	return fat_entry;
-}
-
-
-/*******************************************************************************
- * function: writeToDisk
- *******************************************************************************
- * Byte by byte writes from the open file to the disk image.
- *
- * @param	char *ptr	pointer to diskimage
- * @param	char *ptr_file	pointer to file being copied
- * @param	int file_size	size of file being copied
+ * @param	char *manifest	path of the manifest file
+ * @param	int *count	set to the number of file names read
  *
- * @return	int		the first sector used for the file
+ * @return	char**		malloced array of malloced file names
  ******************************************************************************/
 
-int writeToDisk(char *ptr, char *ptr_file, int file_size) {
-	int i;
-	int size_left = file_size;
-	int fat_entry = getFreeFAT(ptr);
-	int first_sector = fat_entry+31;
-	int next;
-	while(size_left > 0) {
-		for(i = 0; i < BYTES_PER_SECTOR; i++) {
-			if(size_left == 0) {
-				setFAT(ptr, fat_entry, 0xfff);
-				return first_sector;
-			}
-
-			ptr[((fat_entry+31)*BYTES_PER_SECTOR)+i] = ptr_file[file_size-size_left];
-			size_left--;
-		}
-
-		setFAT(ptr, fat_entry, 0xfff);
-		next = getFreeFAT(ptr);
-		setFAT(ptr, fat_entry, next);
-		fat_entry = next;
+char **readManifest(char *manifest, int *count) {
+	FILE *fp = fopen(manifest, "r");
+	if(fp == NULL) {
+		printf("ERROR: Opening manifest failed\n");
+		exit(EXIT_FAILURE);
 	}
-}
-
 
-/*******************************************************************************
- * function: findEmptyDir
- *******************************************************************************
- * Tries to find space for a directory in the given subdirectory.
- *
- * @param	char *ptr	pointer to diskimage
- * @param	int dir		value of the start of the sector being searched
- *
- * @return	int		byte value of start of an empty directory
- ******************************************************************************/
-
- int findEmptyDir(char *ptr, int dir) {
-	if(dir == ROOT_SECTOR_START) {
-		for(dir; dir < (ROOT_SECTOR_START + SECTORS_FOR_ROOT) * BYTES_PER_SECTOR; dir += 0x20) {
-			if(ptr[dir] == 0x00) return dir;
+	int capacity = 16;
+	char **names = (char **)malloc(capacity * sizeof(char *));
+	char *line = NULL;
+	size_t line_size = 0;
+	ssize_t length;
+
+	*count = 0;
+	while(names != NULL && (length = getline(&line, &line_size, fp)) != -1) {
+		while(length > 0 && (line[length-1] == '\n' || line[length-1] == '\r')) line[--length] = '\0';
+		if(length == 0) continue;
+
+		if(*count == capacity) {
+			capacity *= 2;
+			names = (char **)realloc(names, capacity * sizeof(char *));
+			if(names == NULL) break;
 		}
 
-		/*
-		 * if we get here the max 144 directories in root have already
-		 * been used and there is no space to put it in the root
-		 * directory
-		 */
-		printf("ERROR: No space in root directory");
-		exit(EXIT_FAILURE);
-	} else {
-		int i, dir_save = dir;
-		do {
-			for(i = 0; i < BYTES_PER_SECTOR/0x20; i++) {
-				if(ptr[dir+(i*0x20)] == 0x00) return dir+(i*0x20);
-			}
-
-			dir = (getFATEntry(ptr, (dir-31)/BYTES_PER_SECTOR)+31) * BYTES_PER_SECTOR;
-		} while(dir-31 != 0xfff);
-
-		/*
-		 * if we get here all dir space has been used and we need to
-		 * make new space in the directory so we'll relink the fat
-		 * table and call this again (but I'm not doing this)
-		 */
+		names[(*count)++] = strdup(line);
 	}
-}
 
-
-/*******************************************************************************
- * function: dirCompare
- *******************************************************************************
- * Compares name of the directory being searched for to the current directory.
- *
- * @param	char *ptr	pointer to diskimage
- * @param	int dir_start	byte value of start of directory
- * @param	char *name	name to compare to
- *
- * @return	int		N/A
- ******************************************************************************/
-
-bool dirCompare(char *ptr, int dir_start, char *name) {
-	int i;
-	for(i = 0; i < 8; i++) {
-		if(name[i] != ptr[dir_start+i]) return false;
-		else if(name[i] == '\0' && ptr[dir_start+i] == 0x20) return true;
+	if(names == NULL) {
+		printf("ERROR: Failed to allocate manifest\n");
+		exit(EXIT_FAILURE);
 	}
 
-	if(name[8] != '\0') return false;
-	return true;
+	free(line);
+	fclose(fp);
+	return names;
 }
 
 
 /*******************************************************************************
- * function: searchSector
+ * function: planFile
  *******************************************************************************
- * Goes through the given sector to find the subdirectory being searched for.
+ * Checks that a file can be put and opens it.
  *
- * @param	char *ptr	pointer to diskimage
- * @param	char *name	name of directory being searched for
- * @param	int sector	sector being searched
+ * Resolves the directory the file goes in, makes sure nothing of the same name
+ * is already there and maps the host file so it is ready to be written. Files
+ * that aren't regular files, and standard input, are left to be streamed.
  *
- * @return	int		byte location of the subdirectory being searched for
- *				-2 if not found in this sector and at end
- *				-1 if not found in this sector
+ * @param	fat_volume *vol	volume context of the diskimage
+ * @param	dir_index *idx	directory index of the diskimage
+ * @param	char *arg	file name as given on the command line
+ * @param	bool from_stdin	true to read the file from standard input
+ * @param	put_file *file	file to fill in
+ *
+ * @return	int		number of clusters the file needs, 0 if it is
+ * 				streamed and its size isn't known
  ******************************************************************************/
 
-int searchSector(char *ptr, char *name, int sector) {
-	int dir_start = sector * BYTES_PER_SECTOR;
-	while(ptr[dir_start] != 0x00 && dir_start < (sector + 1) * BYTES_PER_SECTOR) {
-		if((ptr[dir_start+11] & 0x10) != 0) {
-			if(dirCompare(ptr, dir_start, name)) return dir_start;
-		}
-		dir_start += 0x20;
-	}
+int planFile(fat_volume *vol, dir_index *idx, char *arg, bool from_stdin, put_file *file) {
+	char *dir_path;
+	parseFileName(arg, &file->filename, &dir_path);
 
-	if(ptr[dir_start] = 0x00) return -2;
-	else return -1;
-}
-
-
-/*******************************************************************************
- * function: changeDirectory
- *******************************************************************************
- * Goes to the start of the given next directory.
- *
- * @param	char *ptr	pointer to diskimage
- * @param	char **current	directory we are in
- * @param	char *next	next directory to go to
- * @param	int *sector	start of this directory
- *
- * @return	bool	true if dir found, false if not
- ******************************************************************************/
+	//look up the first cluster of the necessary directory
+	if(!findDirectory(vol, idx, dir_path, &file->parent, &file->dir_cluster)) {
+		printf("The directory not found\n");
+		exit(EXIT_FAILURE);
+	}
 
-bool changeDirectory(char *ptr, char **current, char *next, int *sector) {
-	int dir_loc;
-	if(*current == "root") {
-		int i;
-		for(i = 0; i < SECTORS_FOR_ROOT; i++) {
-			dir_loc = searchSector(ptr, next, *sector+i);
-			if(dir_loc == -2) return false;
-			else if(dir_loc != -1) break;
-		}
-	} else {
-		int fat_entry = *sector-31;
-		do {
-			dir_loc = searchSector(ptr, next, fat_entry+31);
-			if(dir_loc == -2) return false;
-			else if(dir_loc != -1) break;
-
-			fat_entry = getFATEntry(ptr, fat_entry);
-		} while(fat_entry != 0xfff);
+	//opens the file to be copied as read
+	file->fd = from_stdin ? STDIN_FILENO : open(file->filename, O_RDONLY);
+	if(file->fd < 0) {
+		//checks if file doesn't exist or if failed for another reason
+		if(errno == ENOENT) printf("File not found\n");
+		else printf("ERROR: Opening file for copying failed\n");
+		exit(EXIT_FAILURE);
 	}
 
-	if(dir_loc == -1) return false;
+	fstat(file->fd, &file->buff);
 
-	*current = next;
-	*sector = ptr[dir_loc+26] + (ptr[dir_loc+27] << 8) + 31;
-}
+	//pipes and FIFOs have no size until they are read to the end
+	file->ptr_file = NULL;
+	file->stream = from_stdin || !S_ISREG(file->buff.st_mode);
+	if(file->stream) return 0;
 
+	//a file too large for a directory entry or the whole volume is turned
+	//away before anything is written
+	if(checkSize(vol, file->buff.st_size) != PUT_OK) {
+		printf("ERROR: File too large: %s\n", file->filename);
+		exit(EXIT_FAILURE);
+	}
 
-/*******************************************************************************
- * function: parseFileName
- *******************************************************************************
- * Looks at the file name and parses it to subdirectory path and the file name.
- *
- * @param	char *arg	full argument from command line
- * @param	char **filename	filename to modify
- * @param	char *directories[]	array of subdirectory path to modify
- *
- * @return	int		number of subdirectories
- ******************************************************************************/
+	//map ptr to file to copy, empty files have nothing to map
+	if(file->buff.st_size > 0) {
+		file->ptr_file = mmap(0, file->buff.st_size, PROT_READ, MAP_SHARED, file->fd, 0);
 
-int parseFileName(char *arg, char **filename, char **filename_fat, char *directories[]) {
-	int dir_depth = 0;
-	char *ptr = strtok(arg, "/");
-	while(ptr != NULL) {
-		directories[dir_depth++] = ptr;
-		ptr = strtok(NULL, "/");
+		if(file->ptr_file == MAP_FAILED) {
+			printf("ERROR: Failed to map file\n");
+			exit(EXIT_FAILURE);
+		}
 	}
 
-	*filename = directories[dir_depth-1];
-	directories[dir_depth-1] = NULL;
-
-	return dir_depth-1;
+	return (file->buff.st_size + vol->cluster_size - 1) / vol->cluster_size;
 }
 
 
@@ -328,6 +195,13 @@ int parseFileName(char *arg, char **filename, char **filename_fat, char *directo
  *******************************************************************************
  * Main execution for diskput.
  *
+ * Every file named on the command line, or in the manifest given with -m, is
+ * planned first so a missing file, directory or lack of space is caught before
+ * anything is written. The files are then written one after the other and the
+ * FAT is updated once for the whole batch. With DISK_JOURNAL set the batch is
+ * committed through the journal of the image. Streamed files can't be counted
+ * in advance so they may still run out of space while they are written.
+ *
  * @param	int argc	number of arguments passed during execution
  * @param	char *argv[]	vector of arguments passed during execution
  *
@@ -335,14 +209,29 @@ int parseFileName(char *arg, char **filename, char **filename_fat, char *directo
  ******************************************************************************/
 
 int main(int argc, char *argv[]) {
-	if(argc < 3) {
-		printf("ERROR: Usage \"diskput <disk_image> <file_name>\"\n");
+	bool from_stdin = argc >= 3 && strcmp(argv[2], "-") == 0;
+	bool manifest = argc >= 3 && strcmp(argv[2], "-m") == 0;
+
+	if(argc < 3 || (manifest && argc < 4) || (from_stdin && argc != 4)) {
+		printf("ERROR: Usage \"diskput <disk_image> <file_name> [file_name ...]\"\n");
+		printf("       or    \"diskput <disk_image> -m <manifest>\"\n");
+		printf("       or    \"diskput <disk_image> - <file_name>\"\n");
 		exit(EXIT_FAILURE);
 	}
 
-	char *filename = malloc(sizeof(char)), *filename_fat = malloc(sizeof(char));
-	char *directories[MAX_DEPTH];
-	int dir_depth = parseFileName(argv[2], &filename, &filename_fat, directories);
+	//the files come from the command line, from a manifest or there is one
+	//file read from standard input
+	char **names = argv + 2;
+	int i, count = argc - 2;
+	if(manifest) names = readManifest(argv[3], &count);
+	else if(from_stdin) { names = argv + 3; count = 1; }
+
+	//the image is always mapped, the backends only serve the readers
+	requireMapBackend(stdout, "diskput");
+
+	//finish a batch an earlier run committed but did not get to apply, the
+	//image stays locked exclusively until the batch is done
+	int lock = replayJournal(argv[1], true);
 
 	//opens the file system as read/write
 	int fs = open(argv[1], O_RDWR);
@@ -354,70 +243,85 @@ int main(int argc, char *argv[]) {
 	//create buffer for file statistics
 	struct stat buff;
 	fstat(fs, &buff);
-	int disk_size = buff.st_size;
+	size_t disk_size = buff.st_size;
 
-	//map ptr to file system image
-	char *ptr = mmap(0, disk_size, PROT_READ|PROT_WRITE, MAP_SHARED, fs, 0);
+	//map ptr to file system image, copy on write if the batch is journaled
+	//so nothing reaches the image before it is committed
+	bool journaled = useJournal();
+	char *ptr = mmap(0, disk_size, PROT_READ|PROT_WRITE, journaled ? MAP_PRIVATE : MAP_SHARED, fs, 0);
 
 	if(ptr == MAP_FAILED) {
 		printf("ERROR: Failed to map disk image\n");
 		exit(EXIT_FAILURE);
 	}
 
-	//opens the file to be copied as read
-	int fc = open(filename, O_RDONLY);
-	if(fc < 0) {
-		//checks if file doesn't exist or if failed for another reason
-		if(errno == ENOENT) printf("File not found\n");
-		else printf("ERROR: Opening file for copying failed\n");
+	//build the volume context and directory index for the image, which
+	//come with the number of free clusters, the free cluster map is only
+	//built once the batch is known to fit
+	fat_volume vol;
+	dir_index idx;
+	openVolume(&vol, &idx, ptr, argv[1]);
+	if(journaled) openJournal(&vol, fs, argv[1]);
+
+	//plan the whole batch before writing anything
+	put_file *files = (put_file *)malloc(count * sizeof(put_file));
+	if(files == NULL) {
+		printf("ERROR: Failed to allocate batch\n");
 		exit(EXIT_FAILURE);
 	}
 
-	//reuse buffer for file statistics
-	fstat(fc, &buff);
-	int file_size = buff.st_size;
-
-	//map ptr to file to copy
-	char *ptr_file = mmap(0, file_size, PROT_READ, MAP_SHARED, fc, 0);
-
-	if(ptr_file == MAP_FAILED) {
-		printf("ERROR: Failed to map file\n");
-		exit(EXIT_FAILURE);
+	int64_t clusters_needed = 0;
+	for(i = 0; i < count; i++) {
+		clusters_needed += planFile(&vol, &idx, names[i], from_stdin, &files[i]);
 	}
 
-	//initialize data for disk image and get the amount of free space
-	getBasicInfo(ptr);
-	int free_space = getFreeSpace(ptr);
-
-	if(file_size > free_space) {
+	//the count may be the FSInfo hint, which is only taken at its word when
+	//the batch fits, otherwise the free map counts the clusters again
+	if(clusters_needed > vol.free_count) buildFreeMap(&vol);
+	if(clusters_needed > vol.free_count) {
 		printf("Not enough free space in the disk image\n");
 		exit(EXIT_FAILURE);
 	}
 
-	int i, dir_sector = ROOT_SECTOR_START;
-	char *current_dir = "root";
+	bool failed = false;
+	for(i = 0; i < count; i++) {
+		put_status status;
+		if(files[i].stream) status = putStream(&vol, &idx, files[i].parent, files[i].dir_cluster, files[i].filename, files[i].fd, time(NULL));
+		else status = putFile(&vol, &idx, files[i].parent, files[i].dir_cluster, files[i].filename, files[i].ptr_file, files[i].buff.st_size, files[i].buff.st_mtime);
 
-	//go through disk and find first logical sector of the necessary
-	//directory
-	for(i = 0; i < dir_depth; i++) {
-		int found = changeDirectory(ptr, &current_dir, directories[i], &dir_sector);
-		if(!found) {
-			printf("The directory not found\n");
-			exit(EXIT_FAILURE);
-		}
+		if(status == PUT_EXISTS) printf("File already exists: %s\n", files[i].filename);
+		else if(status == PUT_DIR_FULL) printf("ERROR: No space in directory for %s\n", files[i].filename);
+		else if(status == PUT_NO_SPACE) printf("Not enough free space in the disk image\n");
+		else if(status == PUT_TOO_LARGE) printf("ERROR: File too large: %s\n", files[i].filename);
+		else if(status == PUT_READ_FAILED) printf("ERROR: Failed to read %s\n", files[i].filename);
+
+		if(status != PUT_OK) failed = true;
 	}
 
-	//find an empty directory in the given subdirectory
-	int new_dir = findEmptyDir(ptr, dir_sector*BYTES_PER_SECTOR);
+	//update the FAT once for the whole batch and commit the batch in one go
+	flushFAT(&vol);
+	commitJournal(&vol);
+
+	//the sidecar of the image no longer matches it so save it again
+	if(useSidecar()) saveIndex(&vol, &idx, argv[1]);
 
-	//write data to disk and get first used fat
-	int first_sector = writeToDisk(ptr, ptr_file, file_size);
+	for(i = 0; i < count; i++) {
+		if(files[i].ptr_file != NULL) munmap(files[i].ptr_file, files[i].buff.st_size);
+		close(files[i].fd);
+	}
 
-	//write the directory entry
-	writeDirectory(ptr, new_dir, first_sector, filename, buff);
+	if(manifest) {
+		for(i = 0; i < count; i++) free(names[i]);
+		free(names);
+	}
 
+	free(files);
+	freeIndex(&idx);
+	closeJournal(&vol);
+	freeVolume(&vol);
 	munmap(ptr, disk_size);
-	munmap(ptr_file, file_size);
 	close(fs);
-	close(fc);
+	close(lock);
+
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
 }
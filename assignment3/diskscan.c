@@ -0,0 +1,426 @@
+/***** diskscan.c **************************************************************
+ * University of Victoria
+ * CSC 360 Fall 2018
+ * Italo Borrelli
+ * V00884840
+ *******************************************************************************
+ * diskscan.c is a source file that contains the kernels used to unpack a whole
+ * FAT table at once, one for each FAT width.
+ *
+ * Every three bytes of a FAT12 table hold two 12 bit entries. On x86 the bytes
+ * are shuffled so each entry lands in its own 16 bit lane, eight entries at a
+ * time with SSSE3 or sixteen at a time with AVX2. FAT16 and FAT32 entries are
+ * already whole so they only need to be loaded with SSE2. Free and end of chain
+ * entries are counted with a compare per vector. The instruction set is picked
+ * when a kernel runs, so the same binary works on any x86 machine, and every
+ * other machine uses the plain loops.
+ *
+ * Setting the DISK_SIMD environment variable to 0 forces the plain loop.
+ ******************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "diskscan.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define DISK_SCAN_X86
+#include <immintrin.h>
+#endif
+
+
+/*******************************************************************************
+ * function: useSIMD
+ *******************************************************************************
+ * Whether the vector kernels may be used at all.
+ *
+ * @return	bool		false if DISK_SIMD is 0 or the machine isn't x86
+ ******************************************************************************/
+
+static bool useSIMD(void) {
+#ifdef DISK_SCAN_X86
+	char *simd = getenv("DISK_SIMD");
+	if(simd != NULL && strcmp(simd, "0") == 0) return false;
+
+	__builtin_cpu_init();
+	return true;
+#else
+	return false;
+#endif
+}
+
+
+/*******************************************************************************
+ * function: decodeFATEntry
+ *******************************************************************************
+ * Decode a 12 bit FAT entry straight from the disk image.
+ *
+ * Two entries are packed into every three bytes so even entries take the low
+ * nibble of the second byte and odd entries take the high nibble of the first.
+ *
+ * @param	unsigned char *fat
+ * 				a pointer to the first byte of the FAT table
+ * @param	int n		the entry to decode
+ *
+ * @return	int		the value of the n-th FAT entry
+ ******************************************************************************/
+
+static int decodeFATEntry(unsigned char *fat, int n) {
+	int i = (3*n) / 2;
+
+	if((n%2) == 0) {
+		return ((fat[i+1] & 0x0f) << 8) + fat[i];
+	} else {
+		return ((fat[i] & 0xf0) >> 4) + (fat[i+1] << 4);
+	}
+}
+
+
+/*******************************************************************************
+ * function: unpackScalar
+ *******************************************************************************
+ * Unpacks and counts entries one at a time.
+ *
+ * @param	unsigned char *fat
+ * 				a pointer to the first byte of the FAT table
+ * @param	int first	first entry to unpack
+ * @param	int last	entry after the last one to unpack
+ * @param	uint16_t *out	decoded entries, NULL to only count them
+ * @param	fat_counts *counts	counts to add the entries to
+ *
+ * @return	void		no return value
+ ******************************************************************************/
+
+static void unpackScalar(unsigned char *fat, int first, int last, uint16_t *out, fat_counts *counts) {
+	int n;
+
+	for(n = first; n < last; n++) {
+		int entry = decodeFATEntry(fat, n);
+		if(out != NULL) out[n] = entry;
+
+		if(entry == 0x000) counts->free++;
+		else if(entry >= 0xff8) counts->eoc++;
+	}
+}
+
+
+#ifdef DISK_SCAN_X86
+
+/*******************************************************************************
+ * function: unpackSSSE3
+ *******************************************************************************
+ * Unpacks and counts eight entries, twelve bytes, per step.
+ *
+ * The shuffle puts the two bytes holding each entry in its 16 bit lane. Even
+ * entries are the low 12 bits of their lane and odd entries the high 12 bits,
+ * so even lanes are multiplied by 16 to push their top nibble out and then
+ * every lane is shifted right by four.
+ *
+ * @param	unsigned char *fat
+ * 				a pointer to the first byte of the FAT table
+ * @param	int steps	number of eight entry steps to unpack
+ * @param	uint16_t *out	decoded entries, NULL to only count them
+ * @param	fat_counts *counts	counts to add the entries to
+ *
+ * @return	void		no return value
+ ******************************************************************************/
+
+__attribute__((target("ssse3")))
+static void unpackSSSE3(unsigned char *fat, int steps, uint16_t *out, fat_counts *counts) {
+	const __m128i shuffle = _mm_setr_epi8(0, 1, 1, 2, 3, 4, 4, 5, 6, 7, 7, 8, 9, 10, 10, 11);
+	const __m128i scale = _mm_setr_epi16(16, 1, 16, 1, 16, 1, 16, 1);
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i last_used = _mm_set1_epi16(0xff7);
+	int i, free_lanes = 0, eoc_lanes = 0;
+
+	for(i = 0; i < steps; i++) {
+		__m128i bytes = _mm_loadu_si128((__m128i *)(fat + 12*i));
+		__m128i lanes = _mm_shuffle_epi8(bytes, shuffle);
+		__m128i entries = _mm_srli_epi16(_mm_mullo_epi16(lanes, scale), 4);
+
+		if(out != NULL) _mm_storeu_si128((__m128i *)(out + 8*i), entries);
+
+		//each 16 bit lane sets two bits of the byte mask
+		free_lanes += __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi16(entries, zero)));
+		eoc_lanes += __builtin_popcount(_mm_movemask_epi8(_mm_cmpgt_epi16(entries, last_used)));
+	}
+
+	counts->free += free_lanes / 2;
+	counts->eoc += eoc_lanes / 2;
+}
+
+
+/*******************************************************************************
+ * function: unpackAVX2
+ *******************************************************************************
+ * Unpacks and counts sixteen entries, twenty four bytes, per step.
+ *
+ * Works like unpackSSSE3 on both halves of the register at once, the upper
+ * half loaded from twelve bytes further on since AVX2 shuffles never cross
+ * from one half to the other.
+ *
+ * @param	unsigned char *fat
+ * 				a pointer to the first byte of the FAT table
+ * @param	int steps	number of sixteen entry steps to unpack
+ * @param	uint16_t *out	decoded entries, NULL to only count them
+ * @param	fat_counts *counts	counts to add the entries to
+ *
+ * @return	void		no return value
+ ******************************************************************************/
+
+__attribute__((target("avx2")))
+static void unpackAVX2(unsigned char *fat, int steps, uint16_t *out, fat_counts *counts) {
+	const __m256i shuffle = _mm256_setr_epi8(
+		0, 1, 1, 2, 3, 4, 4, 5, 6, 7, 7, 8, 9, 10, 10, 11,
+		0, 1, 1, 2, 3, 4, 4, 5, 6, 7, 7, 8, 9, 10, 10, 11);
+	const __m256i scale = _mm256_setr_epi16(16, 1, 16, 1, 16, 1, 16, 1, 16, 1, 16, 1, 16, 1, 16, 1);
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i last_used = _mm256_set1_epi16(0xff7);
+	int i, free_lanes = 0, eoc_lanes = 0;
+
+	for(i = 0; i < steps; i++) {
+		unsigned char *group = fat + 24*i;
+		__m256i bytes = _mm256_inserti128_si256(
+			_mm256_castsi128_si256(_mm_loadu_si128((__m128i *)group)),
+			_mm_loadu_si128((__m128i *)(group + 12)), 1);
+		__m256i lanes = _mm256_shuffle_epi8(bytes, shuffle);
+		__m256i entries = _mm256_srli_epi16(_mm256_mullo_epi16(lanes, scale), 4);
+
+		if(out != NULL) _mm256_storeu_si256((__m256i *)(out + 16*i), entries);
+
+		//each 16 bit lane sets two bits of the byte mask
+		free_lanes += __builtin_popcount(_mm256_movemask_epi8(_mm256_cmpeq_epi16(entries, zero)));
+		eoc_lanes += __builtin_popcount(_mm256_movemask_epi8(_mm256_cmpgt_epi16(entries, last_used)));
+	}
+
+	counts->free += free_lanes / 2;
+	counts->eoc += eoc_lanes / 2;
+}
+
+#endif //DISK_SCAN_X86
+
+
+/*******************************************************************************
+ * function: unpackFAT12
+ *******************************************************************************
+ * Unpacks a whole FAT12 table and counts its free and end of chain entries.
+ *
+ * As many entries as possible go through the widest kernel the processor
+ * supports and the few left at the end go through the plain loop. A vector
+ * step loads four bytes past the twelve it uses, so it only runs while those
+ * are still inside the entries being unpacked.
+ *
+ * Entries 0 and 1 are unpacked but not counted since they are reserved.
+ *
+ * @param	unsigned char *fat
+ * 				a pointer to the first byte of the FAT table
+ * @param	int num_entries	number of entries in the table
+ * @param	uint16_t *out	decoded entries, NULL to only count them
+ * @param	fat_counts *counts	set to the counts of entries 2 and up
+ *
+ * @return	void		no return value
+ ******************************************************************************/
+
+void unpackFAT12(unsigned char *fat, int num_entries, uint16_t *out, fat_counts *counts) {
+	int n = 0;
+	counts->free = 0;
+	counts->eoc = 0;
+
+#ifdef DISK_SCAN_X86
+	int table_bytes = (3*num_entries + 1) / 2;
+
+	if(useSIMD()) {
+		if(__builtin_cpu_supports("avx2") && table_bytes >= 28) {
+			int steps = (table_bytes - 28) / 24 + 1;
+			unpackAVX2(fat, steps, out, counts);
+			n = 16 * steps;
+		}
+
+		if(__builtin_cpu_supports("ssse3") && table_bytes - 3*n/2 >= 16) {
+			int steps = (table_bytes - 3*n/2 - 16) / 12 + 1;
+			unpackSSSE3(fat + 3*n/2, steps, (out != NULL) ? out + n : NULL, counts);
+			n += 8 * steps;
+		}
+	}
+#endif
+
+	unpackScalar(fat, n, num_entries, out, counts);
+
+	//take the reserved entries back out of the counts
+	int i;
+	for(i = 0; i < 2 && i < num_entries; i++) {
+		int entry = decodeFATEntry(fat, i);
+		if(entry == 0x000) counts->free--;
+		else if(entry >= 0xff8) counts->eoc--;
+	}
+}
+
+
+#ifdef DISK_SCAN_X86
+
+/*******************************************************************************
+ * function: unpackSSE2x16
+ *******************************************************************************
+ * Copies and counts eight FAT16 entries per step.
+ *
+ * SSE2 only compares signed lanes, so the entries are flipped around 0x8000
+ * before being compared against the smallest end of chain value.
+ *
+ * @param	unsigned char *fat
+ * 				a pointer to the first byte of the FAT table
+ * @param	int steps	number of eight entry steps to unpack
+ * @param	uint16_t *out	decoded entries, NULL to only count them
+ * @param	fat_counts *counts	counts to add the entries to
+ *
+ * @return	void		no return value
+ ******************************************************************************/
+
+__attribute__((target("sse2")))
+static void unpackSSE2x16(unsigned char *fat, int steps, uint16_t *out, fat_counts *counts) {
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i flip = _mm_set1_epi16((short)0x8000);
+	const __m128i last_used = _mm_set1_epi16((short)(0xfff7 ^ 0x8000));
+	int i, free_lanes = 0, eoc_lanes = 0;
+
+	for(i = 0; i < steps; i++) {
+		__m128i entries = _mm_loadu_si128((__m128i *)(fat + 16*i));
+
+		if(out != NULL) _mm_storeu_si128((__m128i *)(out + 8*i), entries);
+
+		//each 16 bit lane sets two bits of the byte mask
+		free_lanes += __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi16(entries, zero)));
+		eoc_lanes += __builtin_popcount(_mm_movemask_epi8(_mm_cmpgt_epi16(_mm_xor_si128(entries, flip), last_used)));
+	}
+
+	counts->free += free_lanes / 2;
+	counts->eoc += eoc_lanes / 2;
+}
+
+
+/*******************************************************************************
+ * function: unpackSSE2x32
+ *******************************************************************************
+ * Masks and counts four FAT32 entries per step.
+ *
+ * @param	unsigned char *fat
+ * 				a pointer to the first byte of the FAT table
+ * @param	int steps	number of four entry steps to unpack
+ * @param	uint32_t *out	decoded entries, NULL to only count them
+ * @param	fat_counts *counts	counts to add the entries to
+ *
+ * @return	void		no return value
+ ******************************************************************************/
+
+__attribute__((target("sse2")))
+static void unpackSSE2x32(unsigned char *fat, int steps, uint32_t *out, fat_counts *counts) {
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i mask = _mm_set1_epi32(0x0fffffff);
+	const __m128i last_used = _mm_set1_epi32(0x0ffffff7);
+	int i, free_lanes = 0, eoc_lanes = 0;
+
+	for(i = 0; i < steps; i++) {
+		__m128i entries = _mm_and_si128(_mm_loadu_si128((__m128i *)(fat + 16*i)), mask);
+
+		if(out != NULL) _mm_storeu_si128((__m128i *)(out + 4*i), entries);
+
+		//each 32 bit lane sets four bits of the byte mask
+		free_lanes += __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi32(entries, zero)));
+		eoc_lanes += __builtin_popcount(_mm_movemask_epi8(_mm_cmpgt_epi32(entries, last_used)));
+	}
+
+	counts->free += free_lanes / 4;
+	counts->eoc += eoc_lanes / 4;
+}
+
+#endif //DISK_SCAN_X86
+
+
+/*******************************************************************************
+ * function: unpackFAT16
+ *******************************************************************************
+ * Unpacks a whole FAT16 table and counts its free and end of chain entries.
+ *
+ * Entries 0 and 1 are unpacked but not counted since they are reserved.
+ *
+ * @param	unsigned char *fat
+ * 				a pointer to the first byte of the FAT table
+ * @param	int num_entries	number of entries in the table
+ * @param	uint16_t *out	decoded entries, NULL to only count them
+ * @param	fat_counts *counts	set to the counts of entries 2 and up
+ *
+ * @return	void		no return value
+ ******************************************************************************/
+
+void unpackFAT16(unsigned char *fat, int num_entries, uint16_t *out, fat_counts *counts) {
+	int n = 0;
+	counts->free = 0;
+	counts->eoc = 0;
+
+#ifdef DISK_SCAN_X86
+	if(useSIMD() && __builtin_cpu_supports("sse2")) {
+		unpackSSE2x16(fat, num_entries / 8, out, counts);
+		n = num_entries / 8 * 8;
+	}
+#endif
+
+	for(; n < num_entries; n++) {
+		int entry = fat[2*n] + (fat[2*n+1] << 8);
+		if(out != NULL) out[n] = entry;
+
+		if(entry == 0x0000) counts->free++;
+		else if(entry >= 0xfff8) counts->eoc++;
+	}
+
+	//take the reserved entries back out of the counts
+	for(n = 0; n < 2 && n < num_entries; n++) {
+		int entry = fat[2*n] + (fat[2*n+1] << 8);
+		if(entry == 0x0000) counts->free--;
+		else if(entry >= 0xfff8) counts->eoc--;
+	}
+}
+
+
+/*******************************************************************************
+ * function: unpackFAT32
+ *******************************************************************************
+ * Unpacks a whole FAT32 table and counts its free and end of chain entries.
+ *
+ * The top four bits of every entry are reserved and masked off. Entries 0 and
+ * 1 are unpacked but not counted since they are reserved.
+ *
+ * @param	unsigned char *fat
+ * 				a pointer to the first byte of the FAT table
+ * @param	int num_entries	number of entries in the table
+ * @param	uint32_t *out	decoded entries, NULL to only count them
+ * @param	fat_counts *counts	set to the counts of entries 2 and up
+ *
+ * @return	void		no return value
+ ******************************************************************************/
+
+void unpackFAT32(unsigned char *fat, int num_entries, uint32_t *out, fat_counts *counts) {
+	int n = 0;
+	counts->free = 0;
+	counts->eoc = 0;
+
+#ifdef DISK_SCAN_X86
+	if(useSIMD() && __builtin_cpu_supports("sse2")) {
+		unpackSSE2x32(fat, num_entries / 4, out, counts);
+		n = num_entries / 4 * 4;
+	}
+#endif
+
+	for(; n < num_entries; n++) {
+		uint32_t entry = (fat[4*n] + (fat[4*n+1] << 8) + (fat[4*n+2] << 16) + ((uint32_t)fat[4*n+3] << 24)) & 0x0fffffff;
+		if(out != NULL) out[n] = entry;
+
+		if(entry == 0x00000000) counts->free++;
+		else if(entry >= 0x0ffffff8) counts->eoc++;
+	}
+
+	//take the reserved entries back out of the counts
+	for(n = 0; n < 2 && n < num_entries; n++) {
+		uint32_t entry = (fat[4*n] + (fat[4*n+1] << 8) + (fat[4*n+2] << 16) + ((uint32_t)fat[4*n+3] << 24)) & 0x0fffffff;
+		if(entry == 0x00000000) counts->free--;
+		else if(entry >= 0x0ffffff8) counts->eoc--;
+	}
+}
@@ -0,0 +1,48 @@
+/***** diskscan.h **************************************************************
+ * University of Victoria
+ * CSC 360 Fall 2018
+ * Italo Borrelli
+ * V00884840
+ *******************************************************************************
+ * This header file declares the mehods defined in diskscan.c.
+ ******************************************************************************/
+
+#ifndef DISK_SCAN_H_
+#define DISK_SCAN_H_
+
+#include <stdint.h>
+
+#include "diskhelpers.h"
+
+
+/*******************************************************************************
+ * FAT COUNTS
+ *******************************************************************************
+ * Number of entries of each kind found while unpacking a FAT table.
+ ******************************************************************************/
+
+typedef struct fat_counts {
+	int free;			//entries that are 0x000
+	int eoc;			//entries that end a chain, FAT_EOC_MIN and up
+} fat_counts;
+
+
+/*******************************************************************************
+ * FUNCTION DECLARATIONS
+ ******************************************************************************/
+
+void unpackFAT12(unsigned char *fat, int num_entries, uint16_t *out, fat_counts *counts);
+void unpackFAT16(unsigned char *fat, int num_entries, uint16_t *out, fat_counts *counts);
+void unpackFAT32(unsigned char *fat, int num_entries, uint32_t *out, fat_counts *counts);
+
+//the decoder for the FAT width the tools are built for
+#if FAT_BITS == 12
+#define unpackFAT unpackFAT12
+#elif FAT_BITS == 16
+#define unpackFAT unpackFAT16
+#else
+#define unpackFAT unpackFAT32
+#endif
+
+
+#endif //DISK_SCAN_H_
@@ -0,0 +1,547 @@
+/***** disktree.c **************************************************************
+ * University of Victoria
+ * CSC 360 Fall 2018
+ * Italo Borrelli
+ * V00884840
+ *******************************************************************************
+ * disktree.c is a source file for walking the directory tree of a FAT disk
+ * image with several threads.
+ *
+ * Every directory is a task. A thread scans a directory with the scan it is
+ * given, which writes whatever it wants to say about the directory to the
+ * output of the directory and hands each subdirectory it finds to treeChild.
+ * The subdirectory goes on the deque of that thread, so a thread works down
+ * its own part of the tree depth first while idle threads take the oldest,
+ * and usually largest, parts of the tree from the others.
+ *
+ * Threads finish directories in no particular order, so the outputs are only
+ * put together once the walk is over. mergeTree goes through the tree in the
+ * order a single thread would have and hands over each directory's output
+ * with the output of every subdirectory at the point it was found, so the
+ * result is the same whatever the number of threads.
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "disktree.h"
+#include "diskindex.h"
+
+int tree_threads = 0;
+
+
+/*******************************************************************************
+ * function: setTreeThreads
+ *******************************************************************************
+ * Sets the number of threads used by every later walk of the tree.
+ *
+ * @param	int threads	number of threads, 0 for one per processor
+ *
+ * @return	void		no return value
+ *
+ * @see				disktree.h
+ ******************************************************************************/
+
+void setTreeThreads(int threads) {
+	tree_threads = threads;
+}
+
+
+/*******************************************************************************
+ * function: getTreeThreads
+ *******************************************************************************
+ * Gets the number of threads a walk of the tree uses.
+ *
+ * @return	int		number of threads, from 1 to TREE_MAX_THREADS
+ *
+ * @see				disktree.h
+ ******************************************************************************/
+
+int getTreeThreads(void) {
+	int threads = tree_threads;
+	if(threads <= 0) threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+	if(threads < 1) threads = 1;
+	if(threads > TREE_MAX_THREADS) threads = TREE_MAX_THREADS;
+
+	return threads;
+}
+
+
+/*******************************************************************************
+ * function: newDirectory
+ *******************************************************************************
+ * Allocates a directory of the tree with nothing scanned yet.
+ *
+ * @param	tree_dir *parent	directory it is in, NULL for root
+ * @param	int first_cluster	first cluster of the directory, 0 for root
+ *
+ * @return	tree_dir*	the new directory
+ ******************************************************************************/
+
+static tree_dir *newDirectory(tree_dir *parent, int first_cluster) {
+	tree_dir *dir = (tree_dir *)calloc(1, sizeof(tree_dir));
+	if(dir == NULL) {
+		printf("ERROR: Failed to allocate directory\n");
+		exit(EXIT_FAILURE);
+	}
+
+	dir->first_cluster = first_cluster;
+	dir->depth = (parent == NULL) ? 0 : parent->depth + 1;
+	dir->parent = parent;
+	dir->record = -1;
+
+	return dir;
+}
+
+
+/*******************************************************************************
+ * function: pushTask
+ *******************************************************************************
+ * Adds a directory to the newest end of a deque.
+ *
+ * @param	tree_deque *deque	deque of the thread that found it
+ * @param	tree_dir *dir	directory to add
+ *
+ * @return	void		no return value
+ ******************************************************************************/
+
+static void pushTask(tree_deque *deque, tree_dir *dir) {
+	if(pthread_mutex_lock(&deque->mutex) != 0) {
+		printf("ERROR: Failed to lock mutex\n");
+		exit(EXIT_FAILURE);
+	}
+
+	if(deque->tail == deque->capacity) {
+		//slide the tasks down over the ones taken from the head before
+		//making the array any larger
+		if(deque->head > 0) {
+			memmove(deque->tasks, deque->tasks + deque->head, (deque->tail - deque->head) * sizeof(tree_dir *));
+			deque->tail -= deque->head;
+			deque->head = 0;
+		} else {
+			deque->capacity = (deque->capacity == 0) ? 64 : deque->capacity * 2;
+			deque->tasks = (tree_dir **)realloc(deque->tasks, deque->capacity * sizeof(tree_dir *));
+			if(deque->tasks == NULL) {
+				printf("ERROR: Failed to allocate tasks\n");
+				exit(EXIT_FAILURE);
+			}
+		}
+	}
+
+	deque->tasks[deque->tail++] = dir;
+
+	if(pthread_mutex_unlock(&deque->mutex) != 0) {
+		printf("ERROR: Failed to unlock mutex\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
+
+/*******************************************************************************
+ * function: takeTask
+ *******************************************************************************
+ * Takes a directory from one end of a deque.
+ *
+ * @param	tree_deque *deque	deque to take from
+ * @param	bool newest	true for the owner, false to steal the oldest
+ *
+ * @return	tree_dir*	the directory or NULL if the deque is empty
+ ******************************************************************************/
+
+static tree_dir *takeTask(tree_deque *deque, bool newest) {
+	tree_dir *dir = NULL;
+
+	if(pthread_mutex_lock(&deque->mutex) != 0) {
+		printf("ERROR: Failed to lock mutex\n");
+		exit(EXIT_FAILURE);
+	}
+
+	if(deque->tail > deque->head) {
+		dir = newest ? deque->tasks[--deque->tail] : deque->tasks[deque->head++];
+	}
+
+	if(pthread_mutex_unlock(&deque->mutex) != 0) {
+		printf("ERROR: Failed to unlock mutex\n");
+		exit(EXIT_FAILURE);
+	}
+
+	return dir;
+}
+
+
+/*******************************************************************************
+ * function: treeChild
+ *******************************************************************************
+ * Hands a subdirectory found by a scan to the walk.
+ *
+ * The subdirectory is hooked into the output of its directory at the point
+ * the scan has written up to, so the scan has to have written everything that
+ * comes before it. Subdirectories deeper than the walk allows are left out,
+ * which also ends a loop of directories.
+ *
+ * @param	tree_walk *walk	walk the scan is part of
+ * @param	tree_dir *dir	directory being scanned
+ * @param	char *entry	directory entry of the subdirectory
+ * @param	int worker	thread the scan runs on
+ *
+ * @return	tree_dir*	the subdirectory or NULL if it is too deep
+ *
+ * @see				disktree.h
+ ******************************************************************************/
+
+tree_dir *treeChild(tree_walk *walk, tree_dir *dir, char *entry, int worker) {
+	if(dir->depth + 1 > walk->max_depth) return NULL;
+
+	fflush(dir->out);
+
+	tree_dir *child = newDirectory(dir, getEntryCluster(entry));
+	formatName(entry, child->name);
+
+	if(dir->child_count == dir->child_capacity) {
+		dir->child_capacity = (dir->child_capacity == 0) ? 8 : dir->child_capacity * 2;
+		dir->children = (tree_child *)realloc(dir->children, dir->child_capacity * sizeof(tree_child));
+		if(dir->children == NULL) {
+			printf("ERROR: Failed to allocate directory\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	dir->children[dir->child_count].position = dir->length;
+	dir->children[dir->child_count].dir = child;
+	dir->child_count++;
+
+	//count the task before anyone can take it so the walk can't be
+	//thought over while it is still waiting
+	if(pthread_mutex_lock(&walk->mutex) != 0) {
+		printf("ERROR: Failed to lock mutex\n");
+		exit(EXIT_FAILURE);
+	}
+
+	walk->pending++;
+	pushTask(&walk->deques[worker], child);
+
+	if(pthread_cond_signal(&walk->cond) != 0 || pthread_mutex_unlock(&walk->mutex) != 0) {
+		printf("ERROR: Failed to unlock mutex\n");
+		exit(EXIT_FAILURE);
+	}
+
+	return child;
+}
+
+
+/*******************************************************************************
+ * function: treePath
+ *******************************************************************************
+ * Builds the path of a directory from the root, e.g. "SUB/INNER".
+ *
+ * @param	tree_dir *dir	directory to build the path of
+ * @param	char *path	char array to modify
+ * @param	int size	size of path
+ *
+ * @return	int		length of the path, cut short if it doesn't fit
+ *
+ * @see				disktree.h
+ ******************************************************************************/
+
+int treePath(tree_dir *dir, char *path, int size) {
+	int length = 0;
+
+	if(dir->parent != NULL && dir->parent->parent != NULL) {
+		length = treePath(dir->parent, path, size);
+		if(length + 1 < size) path[length++] = '/';
+	}
+
+	int name_length = strlen(dir->name);
+	if(length + name_length >= size) name_length = size - length - 1;
+
+	memcpy(path + length, dir->name, name_length);
+	length += name_length;
+	path[length] = '\0';
+
+	return length;
+}
+
+
+/*******************************************************************************
+ * function: runTask
+ *******************************************************************************
+ * Scans one directory and marks it done.
+ *
+ * @param	tree_walk *walk	walk the directory is part of
+ * @param	tree_dir *dir	directory to scan
+ * @param	int worker	thread the scan runs on
+ *
+ * @return	void		no return value
+ ******************************************************************************/
+
+static void runTask(tree_walk *walk, tree_dir *dir, int worker) {
+	dir->out = open_memstream(&dir->output, &dir->length);
+	if(dir->out == NULL) {
+		printf("ERROR: Failed to allocate directory output\n");
+		exit(EXIT_FAILURE);
+	}
+
+	walk->scan(walk, dir, worker);
+
+	fclose(dir->out);
+	dir->out = NULL;
+
+	if(pthread_mutex_lock(&walk->mutex) != 0) {
+		printf("ERROR: Failed to lock mutex\n");
+		exit(EXIT_FAILURE);
+	}
+
+	//the last directory done ends the walk for every thread
+	if(--walk->pending == 0 && pthread_cond_broadcast(&walk->cond) != 0) {
+		printf("ERROR: Failed to signal threads\n");
+		exit(EXIT_FAILURE);
+	}
+
+	if(pthread_mutex_unlock(&walk->mutex) != 0) {
+		printf("ERROR: Failed to unlock mutex\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
+
+/*******************************************************************************
+ * function: hasTasks
+ *******************************************************************************
+ * Checks whether any thread has a directory waiting to be scanned.
+ *
+ * @param	tree_walk *walk	walk to check
+ *
+ * @return	bool		true if a deque isn't empty
+ ******************************************************************************/
+
+static bool hasTasks(tree_walk *walk) {
+	int i;
+	bool found = false;
+
+	for(i = 0; i < walk->threads && !found; i++) {
+		if(pthread_mutex_lock(&walk->deques[i].mutex) != 0) {
+			printf("ERROR: Failed to lock mutex\n");
+			exit(EXIT_FAILURE);
+		}
+
+		found = walk->deques[i].tail > walk->deques[i].head;
+
+		if(pthread_mutex_unlock(&walk->deques[i].mutex) != 0) {
+			printf("ERROR: Failed to unlock mutex\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	return found;
+}
+
+
+/*******************************************************************************
+ * WORKER
+ *******************************************************************************
+ * What each thread of a walk is given.
+ ******************************************************************************/
+
+typedef struct tree_worker {
+	tree_walk *walk;		//walk the thread is part of
+	int id;				//number of the thread and its deque
+} tree_worker;
+
+
+/*******************************************************************************
+ * function: walkWorker
+ *******************************************************************************
+ * Scans directories until there are none left anywhere in the tree.
+ *
+ * @param	void *arg	pointer to the tree_worker of the thread
+ *
+ * @return	void*		always NULL
+ ******************************************************************************/
+
+static void *walkWorker(void *arg) {
+	tree_walk *walk = ((tree_worker *)arg)->walk;
+	int id = ((tree_worker *)arg)->id;
+
+	while(true) {
+		//own newest task first, then the oldest of every other thread
+		tree_dir *dir = takeTask(&walk->deques[id], true);
+
+		int i;
+		for(i = 1; dir == NULL && i < walk->threads; i++) {
+			dir = takeTask(&walk->deques[(id + i) % walk->threads], false);
+		}
+
+		if(dir != NULL) {
+			runTask(walk, dir, id);
+			continue;
+		}
+
+		if(pthread_mutex_lock(&walk->mutex) != 0) {
+			printf("ERROR: Failed to lock mutex\n");
+			exit(EXIT_FAILURE);
+		}
+
+		while(walk->pending > 0 && !hasTasks(walk)) {
+			if(pthread_cond_wait(&walk->cond, &walk->mutex) != 0) {
+				printf("ERROR: Failed to wait for tasks\n");
+				exit(EXIT_FAILURE);
+			}
+		}
+
+		bool done = walk->pending == 0;
+
+		if(pthread_mutex_unlock(&walk->mutex) != 0) {
+			printf("ERROR: Failed to unlock mutex\n");
+			exit(EXIT_FAILURE);
+		}
+
+		if(done) break;
+	}
+
+	return NULL;
+}
+
+
+/*******************************************************************************
+ * function: walkTree
+ *******************************************************************************
+ * Scans every directory of the image, starting at the root.
+ *
+ * The calling thread is one of the threads of the walk, so a walk with one
+ * thread never starts another.
+ *
+ * @param	fat_volume *vol	volume context
+ * @param	tree_scan scan	scans one directory
+ * @param	void *arg	anything the scan needs, as walk->arg
+ * @param	int max_depth	deepest directory to scan, the root is 0
+ *
+ * @return	tree_dir*	the root with everything found under it, to be
+ * 				merged and freed by the caller
+ *
+ * @see				disktree.h
+ * @see				void mergeTree(tree_dir*, tree_emit, tree_enter, void*)
+ ******************************************************************************/
+
+tree_dir *walkTree(fat_volume *vol, tree_scan scan, void *arg, int max_depth) {
+	tree_walk walk;
+	memset(&walk, 0, sizeof(walk));
+	walk.vol = vol;
+	walk.scan = scan;
+	walk.arg = arg;
+	walk.threads = getTreeThreads();
+	walk.max_depth = max_depth;
+
+	int i;
+	bool failed = pthread_mutex_init(&walk.mutex, NULL) != 0 || pthread_cond_init(&walk.cond, NULL) != 0;
+	for(i = 0; i < walk.threads; i++) {
+		failed = failed || pthread_mutex_init(&walk.deques[i].mutex, NULL) != 0;
+	}
+
+	if(failed) {
+		printf("ERROR: Failed to initialize walk\n");
+		exit(EXIT_FAILURE);
+	}
+
+	tree_dir *root = newDirectory(NULL, 0);
+	walk.pending = 1;
+	pushTask(&walk.deques[0], root);
+
+	pthread_t threads[TREE_MAX_THREADS];
+	tree_worker workers[TREE_MAX_THREADS];
+	for(i = 0; i < walk.threads; i++) {
+		workers[i].walk = &walk;
+		workers[i].id = i;
+	}
+
+	for(i = 1; i < walk.threads; i++) {
+		if(pthread_create(&threads[i], NULL, walkWorker, &workers[i]) != 0) {
+			printf("ERROR: Failed to create thread\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	walkWorker(&workers[0]);
+
+	for(i = 1; i < walk.threads; i++) {
+		if(pthread_join(threads[i], NULL) != 0) {
+			printf("ERROR: Failed to join thread\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	for(i = 0; i < walk.threads; i++) {
+		free(walk.deques[i].tasks);
+		pthread_mutex_destroy(&walk.deques[i].mutex);
+	}
+	pthread_mutex_destroy(&walk.mutex);
+	pthread_cond_destroy(&walk.cond);
+
+	return root;
+}
+
+
+/*******************************************************************************
+ * function: mergeTree
+ *******************************************************************************
+ * Goes through the output of a walk in the order of a single threaded walk.
+ *
+ * The output of each directory is handed to emit in pieces, split at the
+ * points its subdirectories were found. At each of those points enter is
+ * called, if given, and the subdirectory is merged before the rest of the
+ * directory.
+ *
+ * @param	tree_dir *root	directory to merge, with everything under it
+ * @param	tree_emit emit	takes each piece of output
+ * @param	tree_enter enter	told about each subdirectory, may be NULL
+ * @param	void *arg	passed to emit and enter
+ *
+ * @return	void		no return value
+ *
+ * @see				disktree.h
+ ******************************************************************************/
+
+void mergeTree(tree_dir *root, tree_emit emit, tree_enter enter, void *arg) {
+	size_t position = 0;
+	int i;
+
+	for(i = 0; i < root->child_count; i++) {
+		tree_child *child = &root->children[i];
+
+		if(child->position > position) emit(root, root->output + position, child->position - position, arg);
+		position = child->position;
+
+		if(enter != NULL) enter(root, child->dir, arg);
+		mergeTree(child->dir, emit, enter, arg);
+	}
+
+	if(root->length > position) emit(root, root->output + position, root->length - position, arg);
+}
+
+
+/*******************************************************************************
+ * function: freeTree
+ *******************************************************************************
+ * Releases a directory of a walk and everything under it.
+ *
+ * @param	tree_dir *root	directory to release
+ *
+ * @return	void		no return value
+ *
+ * @see				disktree.h
+ ******************************************************************************/
+
+void freeTree(tree_dir *root) {
+	int i;
+
+	for(i = 0; i < root->child_count; i++) {
+		freeTree(root->children[i].dir);
+	}
+
+	free(root->children);
+	free(root->output);
+	free(root);
+}
@@ -0,0 +1,100 @@
+/***** disktree.h **************************************************************
+ * University of Victoria
+ * CSC 360 Fall 2018
+ * Italo Borrelli
+ * V00884840
+ *******************************************************************************
+ * This header file declares the mehods defined in disktree.c.
+ ******************************************************************************/
+
+#ifndef DISK_TREE_H_
+#define DISK_TREE_H_
+
+#include <stdio.h>
+#include <pthread.h>
+
+#include "diskhelpers.h"
+
+#define TREE_MAX_THREADS 16	//most threads a walk of the tree uses
+
+
+/*******************************************************************************
+ * TREE DIRECTORY
+ *******************************************************************************
+ * One directory of a walk of the directory tree. What a scan writes about the
+ * directory is kept as its output, with each subdirectory hooked in at the
+ * point of the output it was found at.
+ ******************************************************************************/
+
+typedef struct tree_child {
+	size_t position;		//bytes of output before the subdirectory
+	struct tree_dir *dir;		//the subdirectory
+} tree_child;
+
+typedef struct tree_dir {
+	int first_cluster;		//first cluster of the directory, 0 for root
+	int depth;			//how many directories deep this one is
+	char name[13];			//name of the directory, empty for root
+	struct tree_dir *parent;	//directory this one is in, NULL for root
+	int record;			//free for the merge to use, -1 to start
+
+	FILE *out;			//stream the scan writes the output to
+	char *output;			//everything the scan wrote
+	size_t length;			//number of bytes of output
+
+	tree_child *children;		//subdirectories in the order found
+	int child_count;		//number of subdirectories
+	int child_capacity;		//number of subdirectories allocated
+} tree_dir;
+
+
+/*******************************************************************************
+ * TREE WALK
+ *******************************************************************************
+ * A walk of the directory tree by several threads. Each directory is a task
+ * on the deque of the thread that found it. A thread takes its own newest task
+ * first and when it has none takes the oldest task of another thread.
+ ******************************************************************************/
+
+typedef struct tree_deque {
+	tree_dir **tasks;		//tasks from head up to but not including tail
+	int head;			//oldest task, taken by other threads
+	int tail;			//one past the newest task, taken by the owner
+	int capacity;			//number of tasks allocated
+	pthread_mutex_t mutex;		//taken to change head or tail
+} tree_deque;
+
+struct tree_walk;
+typedef void (*tree_scan)(struct tree_walk *walk, tree_dir *dir, int worker);
+typedef void (*tree_emit)(tree_dir *dir, char *bytes, size_t length, void *arg);
+typedef void (*tree_enter)(tree_dir *parent, tree_dir *child, void *arg);
+
+typedef struct tree_walk {
+	fat_volume *vol;		//volume being walked
+	tree_scan scan;			//scans one directory
+	void *arg;			//anything the scan needs
+	int threads;			//number of threads walking
+	int max_depth;			//deepest directory that is scanned
+
+	tree_deque deques[TREE_MAX_THREADS];
+	int pending;			//directories found but not yet scanned
+	pthread_mutex_t mutex;		//taken to change pending
+	pthread_cond_t cond;		//signalled when a task is added or the
+					//walk is over
+} tree_walk;
+
+
+/*******************************************************************************
+ * FUNCTION DECLARATIONS
+ ******************************************************************************/
+
+void setTreeThreads(int threads);
+int getTreeThreads(void);
+tree_dir *treeChild(tree_walk *walk, tree_dir *dir, char *entry, int worker);
+int treePath(tree_dir *dir, char *path, int size);
+tree_dir *walkTree(fat_volume *vol, tree_scan scan, void *arg, int max_depth);
+void mergeTree(tree_dir *root, tree_emit emit, tree_enter enter, void *arg);
+void freeTree(tree_dir *root);
+
+
+#endif //DISK_TREE_H_
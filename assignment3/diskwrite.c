@@ -0,0 +1,667 @@
+/***** diskwrite.c *************************************************************
+ * University of Victoria
+ * CSC 360 Fall 2018
+ * Italo Borrelli
+ * V00884840
+ *******************************************************************************
+ * diskwrite.c is a source file that contains the methods used to put a file on
+ * a FAT disk image: finding a directory and a free entry in it, writing the
+ * file data to free clusters and writing the new directory entry.
+ *
+ * None of these exit when a file can't be put, they report why to the caller
+ * so both diskput and diskd can decide what to do about it.
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+
+#include "diskwrite.h"
+#include "diskjournal.h"
+
+#define STREAM_BUFFER 65536
+
+
+/*******************************************************************************
+ * function: packName
+ *******************************************************************************
+ * Packs a file name into the 8.3 name of a directory entry.
+ *
+ * The part before the last period is the name and the part after it the
+ * extension, each upper cased and padded with spaces; a name with no period
+ * has a blank extension. Parts longer than a field are cut off.
+ *
+ * @param	char *filename	name of the file being put
+ * @param	char *entry	first 11 bytes of the directory entry to fill
+ *
+ * @return	void		no return value
+ ******************************************************************************/
+
+static void packName(char *filename, char *entry) {
+	int i, period = -1;
+	for(i = 0; filename[i] != '\0'; i++) {
+		if(filename[i] == '.') period = i;
+	}
+
+	int name_length = (period == -1) ? i : period;
+	int ext_length = (period == -1) ? 0 : i - period - 1;
+	for(i = 0; i < 8; i++) {
+		entry[i] = (i < name_length) ? toupper(filename[i]) : ' ';
+	}
+	for(i = 0; i < 3; i++) {
+		entry[i+8] = (i < ext_length) ? toupper(filename[period+1+i]) : ' ';
+	}
+}
+
+
+/*******************************************************************************
+ * function: writeDirectory
+ *******************************************************************************
+ * Writes directory entry for the file being added
+ *
+ * @param	char *ptr	pointer to diskimage
+ * @param	int64_t new_dir	byte value to start of dir to write to
+ * @param	int first_entry	first FAT entry used for the file
+ * @param	char *filename	name of file being copied
+ * @param	uint32_t size	size of file being copied
+ * @param	time_t mtime	modification time of file being copied
+ *
+ * @return	void		no return value
+ ******************************************************************************/
+
+void writeDirectory(char *ptr, int64_t new_dir, int first_entry, char *filename, uint32_t size, time_t mtime) {
+	ptr += new_dir;
+	packName(filename, ptr);
+
+	ptr[11] = 0x00;
+
+	time_t time = mtime;
+	ptr[14] = ptr[22] = time & 0xff;
+	ptr[15] = ptr[23] = (time & 0xff00) >> 8;
+	ptr[16] = ptr[24] = (time & 0xff0000) >> 16;
+	ptr[17] = ptr[25] = (time & 0xff000000) >> 24;
+
+	setEntryCluster(ptr, first_entry);
+
+	ptr[28] = size & 0xff;
+	ptr[29] = (size & 0xff00) >> 8;
+	ptr[30] = (size & 0xff0000) >> 16;
+	ptr[31] = (size & 0xff000000) >> 24;
+
+	ptr -= new_dir;
+}
+
+
+/*******************************************************************************
+ * function: freeChain
+ *******************************************************************************
+ * Frees every entry of a chain a failed put had reserved.
+ *
+ * @param	fat_volume *vol	volume context of a writable diskimage
+ * @param	int first_entry	first FAT entry of the chain, -1 if there is none
+ *
+ * @return	void		no return value
+ ******************************************************************************/
+
+static void freeChain(fat_volume *vol, int first_entry) {
+	int fat_entry = first_entry, links = 0;
+	while(fat_entry >= 2 && !isEndOfChain(fat_entry) && links++ < vol->num_entries) {
+		int next = getFATEntry(vol, fat_entry);
+		setFAT(vol, fat_entry, 0);
+		fat_entry = next;
+	}
+}
+
+
+/*******************************************************************************
+ * function: writeToDisk
+ *******************************************************************************
+ * Writes the open file to the disk image one contiguous extent at a time.
+ *
+ * Each extent is reserved and chained by reserveExtent, filled with a single
+ * copy and then linked to the end of the previous one. The unused end of the
+ * last cluster is zeroed. If the volume runs out of clusters part way the
+ * extents reserved so far are freed again.
+ *
+ * @param	fat_volume *vol	volume context of the diskimage
+ * @param	char *ptr_file	pointer to file being copied
+ * @param	int64_t file_size	size of file being copied
+ *
+ * @return	int		the first FAT entry used for the file, -1 if the
+ * 				volume is full
+ *
+ * @see				diskhelpers.h
+ * @see				int reserveExtent(fat_volume*, int, int*)
+ * @see				void freeChain(fat_volume*, int)
+ ******************************************************************************/
+
+int writeToDisk(fat_volume *vol, char *ptr_file, int64_t file_size) {
+	//empty files own no clusters at all
+	if(file_size == 0) return 0;
+
+	int clusters_left = (file_size + vol->cluster_size - 1) / vol->cluster_size;
+	int64_t copied = 0;
+	int first_entry = -1, last_entry = -1;
+
+	while(clusters_left > 0) {
+		int length;
+		int start = reserveExtent(vol, clusters_left, &length);
+		if(start == -1) {
+			freeChain(vol, first_entry);
+			return -1;
+		}
+
+		//link the new extent to the end of the chain so far
+		if(first_entry == -1) first_entry = start;
+		else setFAT(vol, last_entry, start);
+
+		int64_t extent_bytes = (int64_t)length * vol->cluster_size;
+		int64_t bytes = file_size - copied;
+		if(bytes > extent_bytes) bytes = extent_bytes;
+
+		char *dest = vol->ptr + getClusterOffset(vol, start);
+		memcpy(dest, ptr_file + copied, bytes);
+		memset(dest + bytes, 0, extent_bytes - bytes);
+		markWritten(vol, getClusterOffset(vol, start), extent_bytes, false);
+
+		copied += bytes;
+		clusters_left -= length;
+		last_entry = start + length - 1;
+	}
+
+	return first_entry;
+}
+
+
+/*******************************************************************************
+ * function: getDirSlot
+ *******************************************************************************
+ * Finds the free entry cursor of a directory in the slot cache of the volume,
+ * adding one that starts at the first entry if the directory has none yet.
+ *
+ * @param	fat_volume *vol	volume context of the diskimage
+ * @param	int dir_cluster	first cluster of the directory, 0 for the fixed
+ * 				FAT12 and FAT16 root
+ *
+ * @return	dir_slot*	cursor of the directory
+ ******************************************************************************/
+
+static dir_slot *getDirSlot(fat_volume *vol, int dir_cluster) {
+	int i;
+
+	//grow the table before it is half full so probes stay short
+	if(vol->slot_cache_count * 2 >= vol->slot_cache_size) {
+		dir_slot *old = vol->slot_cache;
+		int old_size = vol->slot_cache_size;
+
+		vol->slot_cache_size = (old_size == 0) ? 16 : old_size * 2;
+		vol->slot_cache = (dir_slot *)malloc(vol->slot_cache_size * sizeof(dir_slot));
+		if(vol->slot_cache == NULL) {
+			printf("ERROR: Failed to allocate slot cache\n");
+			exit(EXIT_FAILURE);
+		}
+
+		for(i = 0; i < vol->slot_cache_size; i++) vol->slot_cache[i].dir_cluster = -1;
+
+		for(i = 0; i < old_size; i++) {
+			if(old[i].dir_cluster == -1) continue;
+
+			int h = (old[i].dir_cluster * 2654435761u) & (vol->slot_cache_size - 1);
+			while(vol->slot_cache[h].dir_cluster != -1) h = (h + 1) & (vol->slot_cache_size - 1);
+			vol->slot_cache[h] = old[i];
+		}
+
+		free(old);
+	}
+
+	int h = (dir_cluster * 2654435761u) & (vol->slot_cache_size - 1);
+	while(vol->slot_cache[h].dir_cluster != -1) {
+		if(vol->slot_cache[h].dir_cluster == dir_cluster) return &vol->slot_cache[h];
+		h = (h + 1) & (vol->slot_cache_size - 1);
+	}
+
+	vol->slot_cache[h].dir_cluster = dir_cluster;
+	vol->slot_cache[h].cluster = dir_cluster;
+	vol->slot_cache[h].entry = 0;
+	vol->slot_cache_count++;
+
+	return &vol->slot_cache[h];
+}
+
+
+/*******************************************************************************
+ * function: growDirectory
+ *******************************************************************************
+ * Adds a cluster to the end of a directory.
+ *
+ * The new cluster is taken as close after the last one as possible, zeroed so
+ * every entry in it reads as free and linked to the end of the chain.
+ *
+ * @param	fat_volume *vol	volume context of a writable diskimage
+ * @param	int last_cluster	last cluster of the directory
+ *
+ * @return	int		the new cluster or -1 if the disk is full
+ ******************************************************************************/
+
+static int growDirectory(fat_volume *vol, int last_cluster) {
+	int cluster = findFreeCluster(vol, last_cluster + 1);
+	if(cluster == -1) return -1;
+
+	setFAT(vol, cluster, FAT_EOC);
+	setFAT(vol, last_cluster, cluster);
+
+	int64_t offset = getClusterOffset(vol, cluster);
+	memset(vol->ptr + offset, 0, vol->cluster_size);
+	markWritten(vol, offset, vol->cluster_size, true);
+
+	return cluster;
+}
+
+
+/*******************************************************************************
+ * function: shrinkDirectory
+ *******************************************************************************
+ * Gives back the cluster growDirectory just added to the end of a directory.
+ *
+ * The cluster is cut off the chain and freed, and the search of the directory
+ * is left at the end of the cluster before it, which is full.
+ *
+ * @param	fat_volume *vol	volume context of a writable diskimage
+ * @param	int dir_cluster	first cluster of the directory
+ * @param	int cluster	cluster added last
+ *
+ * @return	void		no return value
+ *
+ * @see				int growDirectory(fat_volume*, int)
+ ******************************************************************************/
+
+static void shrinkDirectory(fat_volume *vol, int dir_cluster, int cluster) {
+	int prev = dir_cluster, links = 0;
+	while(getFATEntry(vol, prev) != cluster) {
+		prev = getFATEntry(vol, prev);
+		if(prev < 2 || isEndOfChain(prev) || links++ >= vol->num_entries) return;
+	}
+
+	setFAT(vol, prev, FAT_EOC);
+	setFAT(vol, cluster, 0);
+
+	dir_slot *slot = getDirSlot(vol, dir_cluster);
+	slot->cluster = prev;
+	slot->entry = vol->cluster_size / 0x20;
+}
+
+
+/*******************************************************************************
+ * function: findEmptyDir
+ *******************************************************************************
+ * Tries to find space for a directory in the given subdirectory.
+ *
+ * Entries that were never used and entries of deleted files, starting with
+ * 0xe5, are both free. The search picks up where the last one for the same
+ * directory left off, so filling a large directory doesn't scan it from the
+ * start each time. A directory that is a cluster chain is grown by a cluster
+ * when it is full, only the fixed FAT12 and FAT16 root can run out of entries.
+ *
+ * The entry returned must be used before the next search of the directory or
+ * it is handed out again.
+ *
+ * @param	fat_volume *vol	volume context of the diskimage
+ * @param	int dir_cluster	first cluster of the directory being searched,
+ * 				0 for the fixed FAT12 and FAT16 root
+ *
+ * @return	int64_t		byte value of start of an empty directory or -1 if
+ * 				the directory is full
+ *
+ * @see				dir_slot *getDirSlot(fat_volume*, int)
+ * @see				int growDirectory(fat_volume*, int)
+ ******************************************************************************/
+
+int64_t findEmptyDir(fat_volume *vol, int dir_cluster) {
+	dir_slot *slot = getDirSlot(vol, dir_cluster);
+	unsigned char *ptr = (unsigned char *)vol->ptr;
+	int per_cluster = vol->cluster_size / 0x20, links = 0;
+
+	if(dir_cluster == 0) per_cluster = vol->sectors_for_root * vol->bytes_per_sector / 0x20;
+
+	while(true) {
+		int64_t base = (dir_cluster == 0) ? vol->root_sector_start * vol->bytes_per_sector : getClusterOffset(vol, slot->cluster);
+
+		for(; slot->entry < per_cluster; slot->entry++) {
+			int64_t dir = base + slot->entry * 0x20;
+			if(ptr[dir] == 0x00 || ptr[dir] == 0xe5) return dir;
+		}
+
+		//the fixed root region can't grow
+		if(dir_cluster == 0) return -1;
+
+		//a chain can never be longer than the FAT
+		if(links++ >= vol->num_entries) return -1;
+
+		int next = getFATEntry(vol, slot->cluster);
+		if(next < 2 || isEndOfChain(next)) next = growDirectory(vol, slot->cluster);
+		if(next == -1) return -1;
+
+		slot->cluster = next;
+		slot->entry = 0;
+	}
+}
+
+
+/*******************************************************************************
+ * function: entryExists
+ *******************************************************************************
+ * Checks if the directory a file goes in already has an entry of its name.
+ *
+ * @param	dir_index *idx	directory index of the diskimage
+ * @param	int parent	index record of the directory, -1 for root
+ * @param	char *filename	name of the file being put
+ *
+ * @return	bool		true if the name is taken
+ ******************************************************************************/
+
+bool entryExists(dir_index *idx, int parent, char *filename) {
+	char entry[11];
+	char name[13];
+
+	//format the name the way it will be written to the directory entry so
+	//the index can be asked for the exact path
+	packName(filename, entry);
+	formatName(entry, name);
+
+	if(parent == -1) return findPath(idx, name) != -1;
+
+	char *dir = recordPath(idx, parent);
+	char *path = (char *)malloc(strlen(dir) + strlen(name) + 2);
+	if(path == NULL) {
+		printf("ERROR: Failed to allocate path\n");
+		exit(EXIT_FAILURE);
+	}
+
+	sprintf(path, "%s/%s", dir, name);
+	bool exists = findPath(idx, path) != -1;
+	free(path);
+
+	return exists;
+}
+
+
+/*******************************************************************************
+ * function: findDirectory
+ *******************************************************************************
+ * Looks up the directory a file is to be put in.
+ *
+ * @param	fat_volume *vol	volume context of the diskimage
+ * @param	dir_index *idx	directory index of the diskimage
+ * @param	char *dir_path	path of the directory, empty for root
+ * @param	int *parent	set to the index record of the directory
+ * @param	int *dir_cluster	set to the first cluster of the directory,
+ * 				0 for the fixed FAT12 and FAT16 root
+ *
+ * @return	bool		false if there is no such directory
+ *
+ * @see				diskindex.h
+ ******************************************************************************/
+
+bool findDirectory(fat_volume *vol, dir_index *idx, char *dir_path, int *parent, int *dir_cluster) {
+	*parent = -1;
+	*dir_cluster = vol->root_cluster;
+	if(dir_path[0] == '\0') return true;
+
+	*parent = findPath(idx, dir_path);
+	if(*parent == -1 || (idx->records[*parent].attr & 0x10) == 0) return false;
+
+	*dir_cluster = idx->records[*parent].first_cluster;
+	return true;
+}
+
+
+/*******************************************************************************
+ * function: checkSize
+ *******************************************************************************
+ * Checks a file of the given size could ever be put on the volume.
+ *
+ * A directory entry holds a 32 bit size, and a file can't take more clusters
+ * than the volume has. Whether there are enough free clusters for it now is
+ * left to putFile.
+ *
+ * @param	fat_volume *vol	volume context of the diskimage
+ * @param	int64_t size	size of the file in bytes
+ *
+ * @return	put_status	PUT_TOO_LARGE if the file can never be put,
+ * 				PUT_OK otherwise
+ ******************************************************************************/
+
+put_status checkSize(fat_volume *vol, int64_t size) {
+	if(size < 0 || size > 0xffffffffll) return PUT_TOO_LARGE;
+	if((size + vol->cluster_size - 1) / vol->cluster_size > vol->num_entries - 2) return PUT_TOO_LARGE;
+
+	return PUT_OK;
+}
+
+
+/*******************************************************************************
+ * function: putFile
+ *******************************************************************************
+ * Puts a file held in memory on the disk image.
+ *
+ * Writes the data, the directory entry and adds the new file to the index. The
+ * space is checked before the directory is searched, and a cluster the
+ * directory had to grow by is given back if the file no longer fits after it.
+ * The FAT is only changed in the volume context, flushFAT has to be called
+ * after.
+ *
+ * @param	fat_volume *vol	volume context of the diskimage
+ * @param	dir_index *idx	directory index of the diskimage
+ * @param	int parent	index record of the directory, -1 for root
+ * @param	int dir_cluster	first cluster of the directory, 0 for the fixed
+ * 				FAT12 and FAT16 root
+ * @param	char *filename	name of the new file
+ * @param	char *data	contents of the new file
+ * @param	int64_t size	size of the new file
+ * @param	time_t mtime	modification time of the new file
+ *
+ * @return	put_status	PUT_OK or why the file could not be put
+ *
+ * @see				put_status checkSize(fat_volume*, int64_t)
+ * @see				void writeDirectory(char*, int64_t, int, char*, uint32_t, time_t)
+ * @see				int writeToDisk(fat_volume*, char*, int64_t)
+ ******************************************************************************/
+
+put_status putFile(fat_volume *vol, dir_index *idx, int parent, int dir_cluster, char *filename, char *data, int64_t size, time_t mtime) {
+	if(checkSize(vol, size) != PUT_OK) return PUT_TOO_LARGE;
+	if(entryExists(idx, parent, filename)) return PUT_EXISTS;
+
+	if(vol->free_map == NULL) buildFreeMap(vol);
+	int clusters = (size + vol->cluster_size - 1) / vol->cluster_size;
+	if(clusters > vol->free_count) return PUT_NO_SPACE;
+
+	//find an empty directory in the given subdirectory
+	int free_before = vol->free_count;
+	int64_t new_dir = findEmptyDir(vol, dir_cluster);
+	if(new_dir == -1) return PUT_DIR_FULL;
+	bool grown = vol->free_count < free_before;
+
+	//the directory may have taken the last cluster the file needed, or the
+	//data may still not fit, in which case the cluster it grew by is given
+	//back
+	int first_entry = (clusters > vol->free_count) ? -1 : writeToDisk(vol, data, size);
+	if(first_entry == -1) {
+		if(grown) shrinkDirectory(vol, dir_cluster, (new_dir - getClusterOffset(vol, 2)) / vol->cluster_size + 2);
+		return PUT_NO_SPACE;
+	}
+
+	//write the directory entry
+	writeDirectory(vol->ptr, new_dir, first_entry, filename, size, mtime);
+	markWritten(vol, new_dir, 0x20, true);
+	addRecord(idx, parent, vol->ptr + new_dir, new_dir);
+
+	return PUT_OK;
+}
+
+
+/*******************************************************************************
+ * function: growChain
+ *******************************************************************************
+ * Reserves the next extent of a chain whose length isn't known in advance.
+ *
+ * The entries right after the end of the chain are taken if they are free so a
+ * stream stays contiguous for as long as it can, otherwise the extent is left
+ * to reserveExtent.
+ *
+ * @param	fat_volume *vol	volume context of a writable diskimage
+ * @param	int last_entry	last entry of the chain so far, -1 if none
+ * @param	int want	number of entries needed
+ * @param	int *length	set to the number of entries reserved
+ *
+ * @return	int		first entry of the extent or -1 if the disk is
+ * 				full
+ *
+ * @see				int reserveExtent(fat_volume*, int, int*)
+ ******************************************************************************/
+
+static int growChain(fat_volume *vol, int last_entry, int want, int *length) {
+	int run, run_length;
+
+	if(last_entry != -1 && (run = findFreeRun(vol, last_entry + 1, &run_length)) == last_entry + 1) {
+		if(run_length > want) run_length = want;
+
+		int i;
+		for(i = run; i < run + run_length - 1; i++) {
+			setFAT(vol, i, i + 1);
+		}
+		setFAT(vol, run + run_length - 1, FAT_EOC);
+
+		*length = run_length;
+		return run;
+	}
+
+	return reserveExtent(vol, want, length);
+}
+
+
+/*******************************************************************************
+ * function: putStream
+ *******************************************************************************
+ * Puts a file read from a pipe, FIFO or anything else without a known size on
+ * the disk image.
+ *
+ * The data is read through a buffer of whole clusters and clusters are only
+ * reserved for what has arrived. The directory entry is written empty first
+ * and its first cluster and size are patched in once the stream ends. If the
+ * file can't be put everything it took is given back, including a cluster the
+ * directory grew by for its entry. The FAT is only changed
+ * in the volume context, flushFAT has to be called after.
+ *
+ * @param	fat_volume *vol	volume context of the diskimage
+ * @param	dir_index *idx	directory index of the diskimage
+ * @param	int parent	index record of the directory, -1 for root
+ * @param	int dir_cluster	first cluster of the directory, 0 for the fixed
+ * 				FAT12 and FAT16 root
+ * @param	char *filename	name of the new file
+ * @param	int fd		file descriptor to read the contents from
+ * @param	time_t mtime	modification time of the new file
+ *
+ * @return	put_status	PUT_OK or why the file could not be put
+ *
+ * @see				void writeDirectory(char*, int64_t, int, char*, uint32_t, time_t)
+ * @see				int growChain(fat_volume*, int, int, int*)
+ ******************************************************************************/
+
+put_status putStream(fat_volume *vol, dir_index *idx, int parent, int dir_cluster, char *filename, int fd, time_t mtime) {
+	if(entryExists(idx, parent, filename)) return PUT_EXISTS;
+
+	if(vol->free_map == NULL) buildFreeMap(vol);
+
+	int free_before = vol->free_count;
+	int64_t new_dir = findEmptyDir(vol, dir_cluster);
+	if(new_dir == -1) return PUT_DIR_FULL;
+	bool grown = vol->free_count < free_before;
+
+	//every fill but the last ends on a cluster boundary
+	int buffer_size = (STREAM_BUFFER / vol->cluster_size) * vol->cluster_size;
+	if(buffer_size == 0) buffer_size = vol->cluster_size;
+
+	char *buffer = (char *)malloc(buffer_size);
+	if(buffer == NULL) {
+		printf("ERROR: Failed to allocate buffer\n");
+		exit(EXIT_FAILURE);
+	}
+
+	//a deleted entry being reused has to be put back as it was on failure
+	char old_entry[0x20];
+	memcpy(old_entry, vol->ptr + new_dir, 0x20);
+
+	writeDirectory(vol->ptr, new_dir, 0, filename, 0, mtime);
+	markWritten(vol, new_dir, 0x20, true);
+
+	put_status status = PUT_OK;
+	int64_t size = 0;
+	int first_entry = 0, last_entry = -1;
+	bool end = false;
+
+	while(!end && status == PUT_OK) {
+		int filled = 0;
+		while(filled < buffer_size) {
+			ssize_t done = read(fd, buffer + filled, buffer_size - filled);
+			if(done < 0 && errno == EINTR) continue;
+			if(done < 0) status = PUT_READ_FAILED;
+			if(done <= 0) { end = true; break; }
+
+			filled += done;
+		}
+
+		if(status != PUT_OK || filled == 0) break;
+		if(checkSize(vol, size + filled) != PUT_OK) { status = PUT_TOO_LARGE; break; }
+
+		int copied = 0;
+		while(copied < filled) {
+			int length;
+			int want = (filled - copied + vol->cluster_size - 1) / vol->cluster_size;
+			int start = growChain(vol, last_entry, want, &length);
+			if(start == -1) { status = PUT_NO_SPACE; break; }
+
+			//link the new extent to the end of the chain so far
+			if(last_entry == -1) first_entry = start;
+			else setFAT(vol, last_entry, start);
+			last_entry = start + length - 1;
+
+			int extent_bytes = length * vol->cluster_size;
+			int bytes = (filled - copied < extent_bytes) ? filled - copied : extent_bytes;
+
+			char *dest = vol->ptr + getClusterOffset(vol, start);
+			memcpy(dest, buffer + copied, bytes);
+			memset(dest + bytes, 0, extent_bytes - bytes);
+			markWritten(vol, getClusterOffset(vol, start), extent_bytes, false);
+
+			copied += bytes;
+		}
+
+		size += copied;
+	}
+
+	free(buffer);
+
+	if(status != PUT_OK) {
+		//give back the clusters and the directory entry
+		if(last_entry != -1) freeChain(vol, first_entry);
+
+		memcpy(vol->ptr + new_dir, old_entry, 0x20);
+		if(grown) shrinkDirectory(vol, dir_cluster, (new_dir - getClusterOffset(vol, 2)) / vol->cluster_size + 2);
+		return status;
+	}
+
+	//patch the entry now the first cluster and size are known
+	char *entry = vol->ptr + new_dir;
+	setEntryCluster(entry, first_entry);
+	entry[28] = size & 0xff;
+	entry[29] = (size & 0xff00) >> 8;
+	entry[30] = (size & 0xff0000) >> 16;
+	entry[31] = (size & 0xff000000) >> 24;
+
+	addRecord(idx, parent, entry, new_dir);
+
+	return PUT_OK;
+}
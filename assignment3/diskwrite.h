@@ -0,0 +1,49 @@
+/***** diskwrite.h *************************************************************
+ * University of Victoria
+ * CSC 360 Fall 2018
+ * Italo Borrelli
+ * V00884840
+ *******************************************************************************
+ * This header file declares the mehods defined in diskwrite.c.
+ ******************************************************************************/
+
+#ifndef DISK_WRITE_H_
+#define DISK_WRITE_H_
+
+#include <time.h>
+
+#include "diskhelpers.h"
+#include "diskindex.h"
+
+
+/*******************************************************************************
+ * PUT STATUS
+ *******************************************************************************
+ * Whether putFile or putStream put the file or why it could not.
+ ******************************************************************************/
+
+typedef enum put_status {
+	PUT_OK,				//the file was put
+	PUT_EXISTS,			//the directory already has that name
+	PUT_DIR_FULL,			//the directory has no free entry
+	PUT_NO_SPACE,			//the disk image has too few free clusters
+	PUT_TOO_LARGE,			//the file outgrows a directory entry or the volume
+	PUT_READ_FAILED			//the streamed data could not be read
+} put_status;
+
+
+/*******************************************************************************
+ * FUNCTION DECLARATIONS
+ ******************************************************************************/
+
+void writeDirectory(char *ptr, int64_t new_dir, int first_entry, char *filename, uint32_t size, time_t mtime);
+int writeToDisk(fat_volume *vol, char *ptr_file, int64_t file_size);
+put_status checkSize(fat_volume *vol, int64_t size);
+int64_t findEmptyDir(fat_volume *vol, int dir_cluster);
+bool entryExists(dir_index *idx, int parent, char *filename);
+bool findDirectory(fat_volume *vol, dir_index *idx, char *dir_path, int *parent, int *dir_cluster);
+put_status putFile(fat_volume *vol, dir_index *idx, int parent, int dir_cluster, char *filename, char *data, int64_t size, time_t mtime);
+put_status putStream(fat_volume *vol, dir_index *idx, int parent, int dir_cluster, char *filename, int fd, time_t mtime);
+
+
+#endif //DISK_WRITE_H_
@@ -0,0 +1,31 @@
+#!/bin/sh
+#checks the sidecar index is thrown away once the image changes under it,
+#run from the directory the tools were built in with make check
+
+status=0
+tools=$(pwd)
+work=$(mktemp -d)
+cp example_disk_images/testImage.IMA $work/image.IMA
+cd $work
+
+#check <name> <path> fails the check unless the file can be found through
+#the sidecar
+check() {
+	if DISK_INDEX=1 $tools/diskget image.IMA $2 - > /dev/null 2>&1; then
+		echo "ok: $1"
+	else
+		echo "FAIL: $1"
+		status=1
+	fi
+}
+
+#the first listing writes the sidecar, the put then only changes a
+#subdirectory cluster and leaves the FAT and root directory alone
+DISK_INDEX=1 $tools/disklist image.IMA > /dev/null
+: > EMPTY.TXT
+$tools/diskput image.IMA SUBLAYER/EMPTY.TXT > /dev/null
+check "sidecar rejected after a subdirectory put" SUBLAYER/EMPTY.TXT
+
+cd $tools
+rm -rf $work
+exit $status
@@ -0,0 +1,32 @@
+#!/bin/sh
+#checks every tool fails with its usage line on a bad option instead of
+#running, run from the directory the tools were built in with make check
+
+status=0
+
+#expect <name> <command...> runs the command with a time limit and fails the
+#check unless it exits with failure and prints the usage line
+expect() {
+	name=$1
+	shift
+	output=$(timeout 5 "$@" 2>&1)
+	code=$?
+	if [ $code -eq 0 ] || [ $code -eq 124 ] || ! echo "$output" | grep -q "Usage"; then
+		echo "FAIL: $name (exit $code)"
+		status=1
+	else
+		echo "ok: $name"
+	fi
+}
+
+image=example_disk_images/disk3.IMA
+
+expect "disklist unknown option" ./disklist --bogus $image
+expect "disklist unknown format" ./disklist --format=csv $image
+expect "diskinfo unknown option" ./diskinfo --bogus $image
+expect "diskcheck unknown option" ./diskcheck -x $image
+expect "diskdefrag unknown option" ./diskdefrag -x $image
+expect "diskgen -h" ./diskgen -h /tmp/diskgen_usage.IMA
+expect "diskgen bad size spec" ./diskgen -z normal:5 /tmp/diskgen_usage.IMA
+
+exit $status